@@ -0,0 +1,585 @@
+/**
+ * @file main.cpp
+ * @brief Decoding and encoding benchmarks of the pgsql module, without server.
+ * @author Frederic SCHERMA (frederic.scherma@dreamoverflow.org)
+ * @date 2019-03-09
+ * @copyright Copyright (c) 2001-2019 Dream Overflow. All rights reserved.
+ * @details The results are built in memory with the libpq result functions, then
+ * decoded as if they were received from a server. Reports ns/row and allocs/row.
+ * The max number of rows can be changed with the PGSQL_BENCH_ROWS environment variable
+ * (default 1000000, up to 10000000). A sample of the decoded values is checked against
+ * the written ones, the program fails on a mismatch. The codecs are checked by the tests.
+ */
+
+// no memory manager, the global new and delete are replaced to count the allocations
+#include <o3d/core/appwindow.h>
+#include <o3d/core/main.h>
+#include <o3d/core/error.h>
+
+#include <o3d/pgsql/pgsqldb.h>
+#include <o3d/pgsql/pgsqlbinary.h>
+#include <o3d/pgsql/pgsqlcolumns.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace o3d;
+using namespace o3d::pgsql;
+using namespace o3d::pgsql::binary;
+
+static std::atomic<UInt64> ms_allocs(0);
+
+void* operator new(size_t size)
+{
+    ms_allocs.fetch_add(1, std::memory_order_relaxed);
+
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+
+    return p;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    free(p);
+}
+
+//! Query decoding results owned by the benchmark, reused for each iteration.
+class BenchQuery : public PgSqlQuery
+{
+public:
+
+    BenchQuery(const PGresult *outputs, const Oid *paramTypes = nullptr, UInt32 numParams = 0) :
+        PgSqlQuery("bench", outputs, paramTypes, numParams)
+    {
+    }
+
+    void attach(PGresult *res)
+    {
+        setResult(res);
+    }
+
+    void detach()
+    {
+        m_pRes = nullptr;
+    }
+};
+
+//! Set of result columns.
+struct Mix
+{
+    const char *name;
+    std::vector<Oid> types;
+};
+
+static const UInt32 ARRAY_SIZE = 8;
+static const UInt32 BLOB_SIZE = 256;
+
+//! Integer values of a row.
+static Int64 int64Of(UInt32 row) { return (Int64)row * 1000003; }
+static Double doubleOf(UInt32 row) { return row * 0.25; }
+static Int64 numericOf(UInt32 row) { return (Int64)row * 12345 + 7; }   // scale 2
+static Int64 timestampOf(UInt32 row) { return (Int64)row * binary::USECS_PER_SEC + 123456; }
+
+//! Text of a row, or nullptr for a NULL value, one every 16 rows.
+static const char* textOf(UInt32 row, char *text, size_t size)
+{
+    if ((row & 15) == 15) {
+        return nullptr;
+    }
+
+    snprintf(text, size, "name_%08u", row);
+    return text;
+}
+
+//! Binary value of a column at a row, empty for NULL.
+static Bool makeValue(Oid type, UInt32 row, std::vector<UInt8> &out)
+{
+    switch (type) {
+    case QINT4OID:
+        out.resize(4);
+        binary::writeInt32(out.data(), (Int32)row);
+        return True;
+    case QINT8OID:
+        out.resize(8);
+        binary::writeInt64(out.data(), int64Of(row));
+        return True;
+    case QFLOAT8OID:
+        out.resize(8);
+        binary::writeDouble(out.data(), doubleOf(row));
+        return True;
+    case QNUMERICOID:
+        out.resize(binary::NUMERIC_FIXED_SIZE);
+        out.resize(binary::encodeNumeric(numericOf(row), 2, out.data()));
+        return True;
+    case QTIMESTAMPOID:
+        out.resize(8);
+        binary::writeInt64(out.data(), timestampOf(row));
+        return True;
+    case QTEXTOID:
+    {
+        char text[32];
+        if (!textOf(row, text, sizeof(text))) {
+            return False;
+        }
+
+        out.assign(text, text + strlen(text));
+        return True;
+    }
+    case QBYTEAOID:
+        out.resize(BLOB_SIZE);
+        for (UInt32 i = 0; i < BLOB_SIZE; ++i) {
+            out[i] = (UInt8)(row + i);
+        }
+        return True;
+    case SMINT4_ARRAYOID:
+    {
+        out.resize(binary::ARRAY_HEADER_SIZE + ARRAY_SIZE * 8);
+        UInt8 *p = out.data() + binary::writeArrayHeader(out.data(), QINT4OID, ARRAY_SIZE);
+        for (UInt32 i = 0; i < ARRAY_SIZE; ++i, p += 8) {
+            binary::writeInt32(p, 4);
+            binary::writeInt32(p + 4, (Int32)(row + i));
+        }
+        return True;
+    }
+    default:
+        return False;
+    }
+}
+
+//! Rows whose decoded values are checked, including some NULL texts.
+static Bool isSampled(UInt32 row, UInt32 rows)
+{
+    return row < 32 || row % 997 == 0 || row == rows - 1;
+}
+
+//! Check a value decoded by fetch() against the one written in the result.
+static Bool checkOut(Oid type, UInt32 row, const DbVariable &var)
+{
+    std::vector<UInt8> expected;
+    if (!makeValue(type, row, expected)) {
+        return var.isNull();
+    }
+
+    if (var.isNull()) {
+        return False;
+    }
+
+    switch (type) {
+    case QINT4OID:
+        return var.asInt32() == (Int32)row;
+    case QINT8OID:
+        return var.asInt64() == int64Of(row);
+    case QFLOAT8OID:
+        return var.asDouble() == doubleOf(row);
+    case QNUMERICOID:
+        return var.asDouble() == numericOf(row) / 100.0;
+    case QTIMESTAMPOID:
+        return binary::fromDateTime(var.asDateTime()) == timestampOf(row);
+    case QTEXTOID:
+    {
+        // with a terminal zero
+        const ArrayChar &text = var.asArrayChar();
+        return text.getSize() == (Int32)expected.size() + 1 &&
+               memcmp(text.getData(), expected.data(), expected.size()) == 0;
+    }
+    case QBYTEAOID:
+    case SMINT4_ARRAYOID:
+    {
+        const ArrayUInt8 &data = var.asArrayUInt8();
+        return data.getSize() == (Int32)expected.size() &&
+               memcmp(data.getData(), expected.data(), expected.size()) == 0;
+    }
+    default:
+        return False;
+    }
+}
+
+//! Check a value decoded by fetchColumns() against the one written in the result.
+static Bool checkColumn(Oid type, UInt32 row, const PgSqlColumns &columns, UInt32 col)
+{
+    std::vector<UInt8> expected;
+    if (!makeValue(type, row, expected)) {
+        return columns.isNull(col, row);
+    }
+
+    if (columns.isNull(col, row)) {
+        return False;
+    }
+
+    switch (type) {
+    case QINT4OID:
+        return columns.getInt32s(col)[row] == (Int32)row;
+    case QINT8OID:
+        return columns.getInt64s(col)[row] == int64Of(row);
+    case QFLOAT8OID:
+        return columns.getDoubles(col)[row] == doubleOf(row);
+    case QNUMERICOID:
+        return columns.getDoubles(col)[row] == numericOf(row) / 100.0;
+    case QTIMESTAMPOID:
+        return columns.getInt64s(col)[row] == timestampOf(row);
+    case QTEXTOID:
+    case QBYTEAOID:
+    case SMINT4_ARRAYOID:
+    {
+        UInt32 len;
+        const UInt8 *data = columns.getBytes(col, row, len);
+        return len == expected.size() && memcmp(data, expected.data(), len) == 0;
+    }
+    default:
+        return False;
+    }
+}
+
+static void reportMismatch(const char *bench, const Mix &mix, UInt32 row, UInt32 col)
+{
+    fprintf(stderr, "%s %s: mismatch at row %u column %u\n", bench, mix.name, row, col);
+}
+
+//! Build a binary result of a number of rows, or only the row description if rows is 0.
+static PGresult* makeResult(const Mix &mix, UInt32 rows)
+{
+    PGresult *res = PQmakeEmptyPGresult(nullptr, PGRES_TUPLES_OK);
+    if (!res) {
+        O3D_ERROR(E_InvalidResult("Unable to create a result"));
+    }
+
+    const Int32 numCols = (Int32)mix.types.size();
+
+    std::vector<std::string> names(numCols);
+    std::vector<PGresAttDesc> attrs(numCols);
+
+    for (Int32 c = 0; c < numCols; ++c) {
+        names[c] = "c" + std::to_string(c);
+
+        attrs[c].name = const_cast<char*>(names[c].c_str());
+        attrs[c].tableid = 0;
+        attrs[c].columnid = 0;
+        attrs[c].format = 1;
+        attrs[c].typid = mix.types[c];
+        attrs[c].typlen = -1;
+        attrs[c].atttypmod = -1;
+    }
+
+    if (!PQsetResultAttrs(res, numCols, attrs.data())) {
+        PQclear(res);
+        O3D_ERROR(E_InvalidResult("Unable to set the result attributes"));
+    }
+
+    std::vector<UInt8> value;
+
+    for (UInt32 r = 0; r < rows; ++r) {
+        for (Int32 c = 0; c < numCols; ++c) {
+            Int32 ok;
+            if (makeValue(mix.types[c], r, value)) {
+                ok = PQsetvalue(res, (Int32)r, c, (char*)value.data(), (Int32)value.size());
+            } else {
+                ok = PQsetvalue(res, (Int32)r, c, nullptr, -1);
+            }
+
+            if (!ok) {
+                PQclear(res);
+                O3D_ERROR(E_InvalidResult("Unable to set a result value"));
+            }
+        }
+    }
+
+    return res;
+}
+
+//! Measure of a benchmark.
+class Measure
+{
+public:
+
+    Measure() :
+        m_allocs(ms_allocs.load(std::memory_order_relaxed)),
+        m_start(std::chrono::steady_clock::now())
+    {
+    }
+
+    void report(const char *bench, const char *mix, UInt32 rows, UInt64 count)
+    {
+        const UInt64 ns = (UInt64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - m_start).count();
+        const UInt64 allocs = ms_allocs.load(std::memory_order_relaxed) - m_allocs;
+
+        printf("%-14s %-8s %10u %12.2f %12.4f\n",
+               bench, mix, rows,
+               count ? (Double)ns / count : 0.0,
+               count ? (Double)allocs / count : 0.0);
+    }
+
+private:
+
+    UInt64 m_allocs;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+//! Number of iterations to process at least a million rows.
+static UInt32 iterations(UInt32 rows)
+{
+    return rows >= 1000000 ? 1 : 1000000 / rows;
+}
+
+//! Fetch the rows into the output variables.
+//! @return The number of mismatching values.
+static UInt32 benchFetch(const Mix &mix, PGresult *res, UInt32 rows)
+{
+    BenchQuery query(res);
+    const UInt32 iters = iterations(rows);
+    const UInt32 numCols = (UInt32)mix.types.size();
+
+    UInt32 errors = 0;
+
+    // first one to build the decoding plan and check the values
+    query.attach(res);
+
+    for (UInt32 r = 0; query.fetch(); ++r) {
+        if (!isSampled(r, rows)) {
+            continue;
+        }
+
+        for (UInt32 c = 0; c < numCols; ++c) {
+            if (!checkOut(mix.types[c], r, query.getOut(c))) {
+                reportMismatch("fetch", mix, r, c);
+                ++errors;
+            }
+        }
+    }
+
+    query.detach();
+
+    Measure measure;
+
+    for (UInt32 i = 0; i < iters; ++i) {
+        query.attach(res);
+        while (query.fetch()) {
+        }
+        query.detach();
+    }
+
+    measure.report("fetch", mix.name, rows, (UInt64)iters * rows);
+    return errors;
+}
+
+//! Fetch the rows column by column.
+//! @return The number of mismatching values.
+static UInt32 benchFetchColumns(const Mix &mix, PGresult *res, UInt32 rows)
+{
+    BenchQuery query(res);
+    PgSqlColumns columns;
+    const UInt32 iters = iterations(rows);
+    const UInt32 numCols = (UInt32)mix.types.size();
+
+    UInt32 errors = 0;
+
+    // first one to allocate the columns and check the values
+    query.attach(res);
+    query.fetchColumns(columns);
+    query.detach();
+
+    if (columns.getNumRows() != rows) {
+        reportMismatch("fetchColumns", mix, columns.getNumRows(), 0);
+        ++errors;
+    } else {
+        for (UInt32 r = 0; r < rows; ++r) {
+            if (!isSampled(r, rows)) {
+                continue;
+            }
+
+            for (UInt32 c = 0; c < numCols; ++c) {
+                if (!checkColumn(mix.types[c], r, columns, c)) {
+                    reportMismatch("fetchColumns", mix, r, c);
+                    ++errors;
+                }
+            }
+        }
+    }
+
+    Measure measure;
+
+    for (UInt32 i = 0; i < iters; ++i) {
+        query.attach(res);
+        query.fetchColumns(columns);
+        query.detach();
+    }
+
+    measure.report("fetchColumns", mix.name, rows, (UInt64)iters * rows);
+    return errors;
+}
+
+//! Encoding of the parameters of a row, as done before each execute().
+static void benchParams(UInt32 rows)
+{
+    static const Oid types[] = {
+        QINT4OID, QINT8OID, QFLOAT8OID, QTEXTOID, QNUMERICOID, QTIMESTAMPOID
+    };
+
+    PGresult *outputs = PQmakeEmptyPGresult(nullptr, PGRES_COMMAND_OK);
+    BenchQuery query(outputs, types, sizeof(types) / sizeof(Oid));
+
+    const CString text("name_00000000");
+
+    DateTime timestamp;
+    binary::toDateTime(0, timestamp);
+
+    Measure measure;
+
+    for (UInt32 r = 0; r < rows; ++r) {
+        query.setInt32(0, (Int32)r);
+        query.setInt64(1, (Int64)r * 1000003);
+        query.setDouble(2, r * 0.25);
+        query.setCString(3, text);
+        query.setNumeric(4, (Int64)r * 12345 + 7, 2);
+        query.setTimestamp(5, timestamp);
+    }
+
+    measure.report("params", "mixed", rows, rows);
+
+    PQclear(outputs);
+}
+
+//! Lookup of the output attributes by name.
+static void benchLookup(const Mix &mix, UInt32 count)
+{
+    PGresult *outputs = makeResult(mix, 0);
+    BenchQuery query(outputs);
+
+    std::vector<CString> names;
+    for (size_t c = 0; c < mix.types.size(); ++c) {
+        names.push_back(CString(("c" + std::to_string(c)).c_str()));
+    }
+
+    UInt64 sum = 0;
+
+    Measure measure;
+
+    for (UInt32 i = 0; i < count; ++i) {
+        sum += query.getOutAttr(names[i % names.size()]);
+    }
+
+    measure.report("getOutAttr", mix.name, count, count);
+
+    // keep the lookups
+    if (sum == 0) {
+        printf("no lookup\n");
+    }
+
+    PQclear(outputs);
+}
+
+class PgSqlBench
+{
+public:
+
+// Program main
+static Int32 main()
+{
+    PgSql::init();
+
+    UInt32 maxRows = 1000000;
+    const char *env = getenv("PGSQL_BENCH_ROWS");
+    if (env) {
+        maxRows = (UInt32)strtoul(env, nullptr, 10);
+        if (maxRows < 1) {
+            maxRows = 1;
+        } else if (maxRows > 10000000) {
+            maxRows = 10000000;
+        }
+    }
+
+    std::vector<Mix> mixes = {
+        { "int", { QINT4OID, QINT8OID } },
+        { "mixed", { QINT4OID, QINT8OID, QFLOAT8OID, QTEXTOID, QNUMERICOID, QTIMESTAMPOID } },
+        { "blob", { QINT4OID, QTEXTOID, QBYTEAOID } },
+        { "array", { QINT4OID, SMINT4_ARRAYOID } },
+        { "wide", {} }
+    };
+
+    // 64 columns
+    for (UInt32 c = 0; c < 64; ++c) {
+        static const Oid types[] = { QINT4OID, QINT8OID, QFLOAT8OID, QTEXTOID };
+        mixes.back().types.push_back(types[c & 3]);
+    }
+
+    static const UInt32 rowCounts[] = { 1, 1000, 100000, 1000000, 10000000 };
+
+    UInt32 errors = 0;
+
+    printf("%-14s %-8s %10s %12s %12s\n", "bench", "mix", "rows", "ns/row", "allocs/row");
+
+    for (const Mix &mix : mixes) {
+        for (UInt32 rows : rowCounts) {
+            // limit the memory of the wide results to the one of 16 columns
+            const UInt32 limit = mix.types.size() > 16 ? maxRows * 16 / (UInt32)mix.types.size() : maxRows;
+            if (rows > limit) {
+                break;
+            }
+
+            PGresult *res = makeResult(mix, rows);
+
+            errors += benchFetch(mix, res, rows);
+            errors += benchFetchColumns(mix, res, rows);
+
+            PQclear(res);
+        }
+    }
+
+    benchParams(maxRows);
+
+    benchLookup(mixes[1], maxRows);
+    benchLookup(mixes.back(), maxRows);
+
+    PgSql::quit();
+
+    if (errors > 0) {
+        fprintf(stderr, "%u failed checks\n", errors);
+        return 1;
+    }
+
+    return 0;
+}
+};
+
+class MyAppSettings : public AppSettings
+{
+public:
+
+    MyAppSettings() : AppSettings()
+    {
+        useDisplay = false;
+        clearLog = false;
+    }
+};
+
+// We Call our application in console mode
+O3D_CONSOLE_MAIN(PgSqlBench, MyAppSettings)
@@ -0,0 +1,607 @@
+/**
+ * @file pgsqlbinary.h
+ * @brief PostgreSQL binary wire format helpers.
+ * @author Frederic SCHERMA (frederic.scherma@dreamoverflow.org)
+ * @date 2019-03-09
+ * @copyright Copyright (c) 2001-2019 Dream Overflow. All rights reserved.
+ * @details Values are exchanged in network byte order (big-endian). Dates are
+ * counted in days and timestamps in microseconds since 2000-01-01.
+ */
+
+#ifndef _O3D_PGSQLBINARY_H
+#define _O3D_PGSQLBINARY_H
+
+#include "pgsql.h"
+
+#include <o3d/core/base.h>
+#include <o3d/core/date.h>
+#include <o3d/core/datetime.h>
+
+#include <postgresql/libpq-fe.h>
+
+#include <string.h>
+
+#include <cmath>
+#include <limits>
+
+namespace o3d {
+namespace pgsql {
+namespace binary {
+
+// type OIDs, postgres defines them in a private header file
+static const Oid QBOOLOID = 16;
+static const Oid QINT8OID = 20;
+static const Oid QINT2OID = 21;
+static const Oid QINT4OID = 23;
+static const Oid QNUMERICOID = 1700;
+static const Oid QFLOAT4OID = 700;
+static const Oid QFLOAT8OID = 701;
+static const Oid QABSTIMEOID = 702;
+static const Oid QRELTIMEOID = 703;
+static const Oid QDATEOID = 1082;
+static const Oid QTIMEOID = 1083;
+static const Oid QTIMETZOID = 1266;
+static const Oid QTIMESTAMPOID = 1114;
+static const Oid QTIMESTAMPTZOID = 1184;
+static const Oid QOIDOID = 26;
+static const Oid QBYTEAOID = 17;
+static const Oid QNAMEOID = 19;
+static const Oid QTEXTOID = 25;
+static const Oid QBPCHAROID = 1042;
+static const Oid QVARCHAROID = 1043;
+static const Oid QREGPROCOID = 24;
+static const Oid QXIDOID = 28;
+static const Oid QCIDOID = 29;
+
+static const Oid QBITOID = 1560;
+static const Oid QVARBITOID = 1562;
+
+// add json
+
+static const Oid SMJSONOID = 114;
+static const Oid SMJSONBOID = 3802;
+
+// add arrays
+
+static const Oid SMBOOL_ARRAYOID = 1000;
+static const Oid SMINT8_ARRAYOID = 1016;
+static const Oid SMINT2_ARRAYOID = 1005;
+static const Oid SMINT4_ARRAYOID = 1007;
+static const Oid SMNUMERIC_ARRAYOID = 1231;
+static const Oid SMFLOAT4_ARRAYOID = 1021;
+static const Oid SMFLOAT8_ARRAYOID = 1022;
+static const Oid SMABSTIME_ARRAYOID = 1023;
+static const Oid SMRELTIME_ARRAYOID = 1024;
+static const Oid SMDATE_ARRAYOID = 1182;
+static const Oid SMTIME_ARRAYOID = 1183;
+static const Oid SMTIMETZ_ARRAYOID = 1270;
+static const Oid SMTIMESTAMP_ARRAYOID = 1115;
+static const Oid SMTIMESTAMPTZ_ARRAYOID = 1185;
+static const Oid SMBYTEA_ARRAYOID = 1001;
+static const Oid SMREGPROC_ARRAYOID = 1008;
+static const Oid SMXID_ARRAYOID = 1011;
+static const Oid SMCID_ARRAYOID = 1012;
+static const Oid SMJSON_ARRAYOID = 199;
+static const Oid SMJSONB_ARRAYOID = 3807;
+
+static const Oid SMVARCHAR_ARRAYOID = 1015;
+static const Oid SMTEXT_ARRAYOID = 1009;
+
+//! Number of days from 1970-01-01 to 2000-01-01, the PostgreSQL epoch.
+static const Int32 PG_EPOCH_DAYS = 10957;
+
+//! Number of microseconds per day.
+static const Int64 USECS_PER_DAY = 86400000000LL;
+
+//! Number of microseconds per second.
+static const Int64 USECS_PER_SEC = 1000000LL;
+
+//! Number of microseconds from 1970-01-01 to 2000-01-01.
+static const Int64 PG_EPOCH_USECS = PG_EPOCH_DAYS * USECS_PER_DAY;
+
+inline void writeUInt16(UInt8 *p, UInt16 v)
+{
+    p[0] = (UInt8)(v >> 8);
+    p[1] = (UInt8)v;
+}
+
+inline void writeUInt32(UInt8 *p, UInt32 v)
+{
+    p[0] = (UInt8)(v >> 24);
+    p[1] = (UInt8)(v >> 16);
+    p[2] = (UInt8)(v >> 8);
+    p[3] = (UInt8)v;
+}
+
+inline void writeUInt64(UInt8 *p, UInt64 v)
+{
+    writeUInt32(p, (UInt32)(v >> 32));
+    writeUInt32(p + 4, (UInt32)v);
+}
+
+inline void writeInt16(UInt8 *p, Int16 v) { writeUInt16(p, (UInt16)v); }
+inline void writeInt32(UInt8 *p, Int32 v) { writeUInt32(p, (UInt32)v); }
+inline void writeInt64(UInt8 *p, Int64 v) { writeUInt64(p, (UInt64)v); }
+
+inline void writeFloat(UInt8 *p, Float v)
+{
+    UInt32 u;
+    memcpy(&u, &v, 4);
+    writeUInt32(p, u);
+}
+
+inline void writeDouble(UInt8 *p, Double v)
+{
+    UInt64 u;
+    memcpy(&u, &v, 8);
+    writeUInt64(p, u);
+}
+
+inline UInt16 readUInt16(const UInt8 *p)
+{
+    return (UInt16)((p[0] << 8) | p[1]);
+}
+
+inline UInt32 readUInt32(const UInt8 *p)
+{
+    return ((UInt32)p[0] << 24) | ((UInt32)p[1] << 16) | ((UInt32)p[2] << 8) | (UInt32)p[3];
+}
+
+inline UInt64 readUInt64(const UInt8 *p)
+{
+    return ((UInt64)readUInt32(p) << 32) | (UInt64)readUInt32(p + 4);
+}
+
+inline Int16 readInt16(const UInt8 *p) { return (Int16)readUInt16(p); }
+inline Int32 readInt32(const UInt8 *p) { return (Int32)readUInt32(p); }
+inline Int64 readInt64(const UInt8 *p) { return (Int64)readUInt64(p); }
+
+inline Float readFloat(const UInt8 *p)
+{
+    UInt32 u = readUInt32(p);
+    Float v;
+    memcpy(&v, &u, 4);
+    return v;
+}
+
+inline Double readDouble(const UInt8 *p)
+{
+    UInt64 u = readUInt64(p);
+    Double v;
+    memcpy(&v, &u, 8);
+    return v;
+}
+
+/**
+ * @brief Convert n big-endian 32 bits values to the native byte order.
+ * Vectorized with AVX2 or SSSE3 when supported by the CPU. dst can be src.
+ */
+O3D_PGSQL_API void swap32(const UInt8 *src, UInt32 *dst, size_t n);
+
+/**
+ * @brief Convert n big-endian 64 bits values to the native byte order.
+ * Vectorized with AVX2 or SSSE3 when supported by the CPU. dst can be src.
+ */
+O3D_PGSQL_API void swap64(const UInt8 *src, UInt64 *dst, size_t n);
+
+/**
+ * @brief Gather the 32 bits values of a column of a binary result, count rows from
+ * row first, and convert them to the native byte order. NULL values are zero.
+ * @return False if the column is not in binary format or a value is not 4 bytes long.
+ */
+O3D_PGSQL_API Bool decodeColumn32(const PGresult *res, Int32 col, Int32 first, UInt32 count, UInt32 *dst);
+
+/**
+ * @brief Gather the 64 bits values of a column of a binary result, count rows from
+ * row first, and convert them to the native byte order. NULL values are zero.
+ * @return False if the column is not in binary format or a value is not 8 bytes long.
+ */
+O3D_PGSQL_API Bool decodeColumn64(const PGresult *res, Int32 col, Int32 first, UInt32 count, UInt64 *dst);
+
+/**
+ * @brief Number of days since 1970-01-01 of a proleptic gregorian date.
+ * @param year Full year.
+ * @param month Month [1..12].
+ * @param mday Day of the month [1..31].
+ */
+inline Int32 daysFromCivil(Int32 year, UInt32 month, UInt32 mday)
+{
+    year -= month <= 2 ? 1 : 0;
+    const Int32 era = (year >= 0 ? year : year - 399) / 400;
+    const UInt32 yoe = (UInt32)(year - era * 400);
+    const UInt32 doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + mday - 1;
+    const UInt32 doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + (Int32)doe - 719468;
+}
+
+/**
+ * @brief Proleptic gregorian date from a number of days since 1970-01-01.
+ * @param days Days since 1970-01-01.
+ * @param year Full year.
+ * @param month Month [1..12].
+ * @param mday Day of the month [1..31].
+ */
+inline void civilFromDays(Int32 days, Int32 &year, UInt32 &month, UInt32 &mday)
+{
+    days += 719468;
+    const Int32 era = (days >= 0 ? days : days - 146096) / 146097;
+    const UInt32 doe = (UInt32)(days - era * 146097);
+    const UInt32 yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const UInt32 doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const UInt32 mp = (5 * doy + 2) / 153;
+
+    mday = doy - (153 * mp + 2) / 5 + 1;
+    month = mp < 10 ? mp + 3 : mp - 9;
+    year = (Int32)yoe + era * 400 + (month <= 2 ? 1 : 0);
+}
+
+//! Day of the week [0..6] (0 is sunday) of a number of days since 1970-01-01.
+inline UInt32 weekdayFromDays(Int32 days)
+{
+    const Int32 wday = (days + 4) % 7;  // 1970-01-01 is a thursday
+    return (UInt32)(wday < 0 ? wday + 7 : wday);
+}
+
+//! Microseconds since 2000-01-01 of a date, with its time to the millisecond.
+inline Int64 fromDate(const Date &date)
+{
+    Int32 days = daysFromCivil(date.year, date.month + 1, date.mday + 1) - PG_EPOCH_DAYS;
+    Int64 secs = (Int64)days * 86400 + date.hour * 3600 + date.minute * 60 + date.second;
+
+    return secs * USECS_PER_SEC + date.millisecond * 1000;
+}
+
+//! Microseconds since 2000-01-01 of a date time.
+inline Int64 fromDateTime(const DateTime &date)
+{
+    Int32 days = daysFromCivil(date.year, date.month + 1, date.mday + 1) - PG_EPOCH_DAYS;
+    Int64 secs = (Int64)days * 86400 + date.hour * 3600 + date.minute * 60 + date.second;
+
+    return secs * USECS_PER_SEC + date.microsecond;
+}
+
+//! Split microseconds since 2000-01-01 into days since 2000-01-01 and microseconds of the day.
+inline Int32 splitDays(Int64 usecs, Int64 &usecsOfDay)
+{
+    Int64 days = usecs / USECS_PER_DAY;
+    usecsOfDay = usecs - days * USECS_PER_DAY;
+
+    if (usecsOfDay < 0) {
+        --days;
+        usecsOfDay += USECS_PER_DAY;
+    }
+
+    return (Int32)days;
+}
+
+//! Date from a number of days since 2000-01-01, at midnight.
+inline void toDate(Int32 pgDays, Date &date)
+{
+    Int32 year;
+    UInt32 month, mday;
+    civilFromDays(pgDays + PG_EPOCH_DAYS, year, month, mday);
+
+    date.year = (UInt16)year;
+    date.month = (Month)(month - 1);
+    date.mday = (UInt8)(mday - 1);
+    date.day = (Day)weekdayFromDays(pgDays + PG_EPOCH_DAYS);
+    date.hour = 0;
+    date.minute = 0;
+    date.second = 0;
+    date.millisecond = 0;
+}
+
+//! Date from microseconds since 2000-01-01, truncated to the millisecond.
+inline void toDate(Int64 usecs, Date &date)
+{
+    Int64 usecsOfDay;
+    toDate(splitDays(usecs, usecsOfDay), date);
+
+    const UInt32 secs = (UInt32)(usecsOfDay / USECS_PER_SEC);
+    date.hour = (UInt8)(secs / 3600);
+    date.minute = (UInt8)((secs / 60) % 60);
+    date.second = (UInt8)(secs % 60);
+    date.millisecond = (UInt16)((usecsOfDay % USECS_PER_SEC) / 1000);
+}
+
+//! Date time from microseconds since 2000-01-01.
+inline void toDateTime(Int64 usecs, DateTime &date)
+{
+    Int64 usecsOfDay;
+    const Int32 days = splitDays(usecs, usecsOfDay) + PG_EPOCH_DAYS;
+
+    Int32 year;
+    UInt32 month, mday;
+    civilFromDays(days, year, month, mday);
+
+    const UInt32 secs = (UInt32)(usecsOfDay / USECS_PER_SEC);
+
+    date.year = year;
+    date.month = (Month)(month - 1);
+    date.mday = (UInt8)(mday - 1);
+    date.day = (Day)weekdayFromDays(days);
+    date.hour = (UInt8)(secs / 3600);
+    date.minute = (UInt8)((secs / 60) % 60);
+    date.second = (UInt8)(secs % 60);
+    date.microsecond = (UInt32)(usecsOfDay % USECS_PER_SEC);
+}
+
+/**
+ * @brief Microseconds since 2000-01-01 of a binary date or time value.
+ * A time or timetz is relative to 2000-01-01, the zone of a timetz being applied.
+ * @return False if the type is not a date or time.
+ */
+inline Bool decodeTimestamp(Oid type, const UInt8 *data, Int64 &usecs)
+{
+    switch (type) {
+    case QDATEOID:
+        usecs = readInt32(data) * USECS_PER_DAY;
+        return True;
+    case QTIMEOID:
+    case QTIMESTAMPOID:
+    case QTIMESTAMPTZOID:
+        usecs = readInt64(data);
+        return True;
+    case QTIMETZOID:
+        // the zone is in seconds west of UTC
+        usecs = readInt64(data) + readInt32(data + 8) * USECS_PER_SEC;
+        return True;
+    default:
+        return False;
+    }
+}
+
+/**
+ * @brief Decode a binary numeric into a fixed-point integer, the value multiplied by
+ * 10^scale, rounded half away from zero.
+ * @return False for NaN, infinity, an invalid value, or if out of the Int64 range.
+ */
+O3D_PGSQL_API Bool decodeNumeric(const UInt8 *data, UInt32 len, UInt32 scale, Int64 &out);
+
+/**
+ * @brief Decode a binary numeric into the nearest double. NaN and infinities are
+ * supported, and a value out of the double range gives zero or an infinity.
+ */
+O3D_PGSQL_API Double decodeNumeric(const UInt8 *data, UInt32 len);
+
+//! Max size of a binary numeric encoded from a fixed-point Int64.
+static const UInt32 NUMERIC_FIXED_SIZE = 32;
+
+/**
+ * @brief Encode the fixed-point integer v / 10^scale (scale up to 18) as a binary
+ * numeric with a display scale of scale.
+ * @return The size, at most NUMERIC_FIXED_SIZE.
+ */
+O3D_PGSQL_API UInt32 encodeNumeric(Int64 v, UInt32 scale, UInt8 *out);
+
+/**
+ * @brief Encode a double as a binary numeric, with the fewest decimal digits giving
+ * back the same double. NaN and infinities are encoded as such (infinities need
+ * PostgreSQL 14).
+ * @return The size, at most NUMERIC_FIXED_SIZE, or 0 if too large or too small to be
+ * written with an Int64 and a scale up to 18.
+ */
+O3D_PGSQL_API UInt32 encodeNumeric(Double v, UInt8 *out);
+
+/**
+ * @brief Format the fixed-point integer v / 10^scale (scale up to 18) as text,
+ * the integer part then the fractional part padded with zeros.
+ * @return The length, without the terminal zero, at most 22.
+ */
+O3D_PGSQL_API UInt32 formatNumeric(Int64 v, UInt32 scale, Char *out, UInt32 size);
+
+/**
+ * @brief Encode an integer to the binary representation of a type.
+ * @param isUnsigned v is an UInt64, above the Int64 range if negative.
+ * @return The size, or 0 if the type is not supported or the value is out of its range.
+ */
+inline UInt32 encodeInteger(Oid type, Int64 v, UInt8 *out, Bool isUnsigned = False)
+{
+    // only the real types can take an UInt64 above the Int64 range
+    if (isUnsigned && v < 0) {
+        if (type == QFLOAT4OID) {
+            writeFloat(out, (Float)(UInt64)v);
+            return 4;
+        } else if (type == QFLOAT8OID) {
+            writeDouble(out, (Double)(UInt64)v);
+            return 8;
+        }
+        return 0;
+    }
+
+    switch (type) {
+    case QBOOLOID:
+        if (v != 0 && v != 1) {
+            return 0;
+        }
+        out[0] = (UInt8)v;
+        return 1;
+    case QINT2OID:
+        if (v < -32768 || v > 32767) {
+            return 0;
+        }
+        writeInt16(out, (Int16)v);
+        return 2;
+    case QINT4OID:
+        if (v < -2147483647LL - 1 || v > 2147483647LL) {
+            return 0;
+        }
+        writeInt32(out, (Int32)v);
+        return 4;
+    case QOIDOID:
+        if (v < 0 || v > 4294967295LL) {
+            return 0;
+        }
+        writeUInt32(out, (UInt32)v);
+        return 4;
+    case QINT8OID:
+        writeInt64(out, v);
+        return 8;
+    case QNUMERICOID:
+        return encodeNumeric(v, 0, out);
+    case QFLOAT4OID:
+        writeFloat(out, (Float)v);
+        return 4;
+    case QFLOAT8OID:
+        writeDouble(out, (Double)v);
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Encode a real to the binary representation of a type. An integer type only
+ * takes an integral value of its range.
+ * @return The size, or 0 if the type is not supported or the value is out of its range.
+ */
+inline UInt32 encodeReal(Oid type, Double v, UInt8 *out)
+{
+    switch (type) {
+    case QFLOAT4OID:
+        // NaN and infinities are kept
+        if (std::fabs(v) > std::numeric_limits<Float>::max() && !std::isinf(v)) {
+            return 0;
+        }
+        writeFloat(out, (Float)v);
+        return 4;
+    case QFLOAT8OID:
+        writeDouble(out, v);
+        return 8;
+    case QNUMERICOID:
+        return encodeNumeric(v, out);
+    case QBOOLOID:
+    case QINT2OID:
+    case QINT4OID:
+    case QINT8OID:
+    {
+        // false for NaN, infinities, out of the Int64 range, and fractions
+        if (!(v >= -9223372036854775808.0 && v < 9223372036854775808.0) || (Double)(Int64)v != v) {
+            return 0;
+        }
+        return encodeInteger(type, (Int64)v, out);
+    }
+    default:
+        return 0;
+    }
+}
+
+//! Encode microseconds since 2000-01-01 to the binary representation of a type, returns 0 if not possible.
+inline UInt32 encodeTimestamp(Oid type, Int64 usecs, UInt8 *out)
+{
+    switch (type) {
+    case QTIMESTAMPOID:
+    case QTIMESTAMPTZOID:
+        writeInt64(out, usecs);
+        return 8;
+    case QDATEOID:
+    {
+        Int64 days = usecs / USECS_PER_DAY;
+        if (usecs < 0 && days * USECS_PER_DAY != usecs) {
+            --days;
+        }
+
+        writeInt32(out, (Int32)days);
+        return 4;
+    }
+    default:
+        return 0;
+    }
+}
+
+//! Is a type transmitted as raw text in binary format.
+inline Bool isTextual(Oid type)
+{
+    switch (type) {
+    case QTEXTOID:
+    case QVARCHAROID:
+    case QBPCHAROID:
+    case QNAMEOID:
+    case SMJSONOID:
+        return True;
+    default:
+        return False;
+    }
+}
+
+//! Element type of a one dimension array type, or 0 if not an array type.
+inline Oid arrayElementType(Oid type)
+{
+    switch (type) {
+    case SMBOOL_ARRAYOID: return QBOOLOID;
+    case SMINT2_ARRAYOID: return QINT2OID;
+    case SMINT4_ARRAYOID: return QINT4OID;
+    case SMINT8_ARRAYOID: return QINT8OID;
+    case SMNUMERIC_ARRAYOID: return QNUMERICOID;
+    case SMFLOAT4_ARRAYOID: return QFLOAT4OID;
+    case SMFLOAT8_ARRAYOID: return QFLOAT8OID;
+    case SMDATE_ARRAYOID: return QDATEOID;
+    case SMTIME_ARRAYOID: return QTIMEOID;
+    case SMTIMETZ_ARRAYOID: return QTIMETZOID;
+    case SMTIMESTAMP_ARRAYOID: return QTIMESTAMPOID;
+    case SMTIMESTAMPTZ_ARRAYOID: return QTIMESTAMPTZOID;
+    case SMBYTEA_ARRAYOID: return QBYTEAOID;
+    case SMJSON_ARRAYOID: return SMJSONOID;
+    case SMJSONB_ARRAYOID: return SMJSONBOID;
+    case SMVARCHAR_ARRAYOID: return QVARCHAROID;
+    case SMTEXT_ARRAYOID: return QTEXTOID;
+    default: return 0;
+    }
+}
+
+//! Size of a one dimension array header.
+static const UInt32 ARRAY_HEADER_SIZE = 20;
+
+/**
+ * @brief Write the header of a one dimension array without NULL, lower bound 1.
+ * Each element then follows as its length in an Int32, and its value.
+ * @return The header size, smaller for an empty array.
+ */
+inline UInt32 writeArrayHeader(UInt8 *out, Oid elementType, UInt32 count)
+{
+    // an empty array has no dimension
+    writeInt32(out, count > 0 ? 1 : 0);
+    writeInt32(out + 4, 0);
+    writeUInt32(out + 8, elementType);
+
+    if (count == 0) {
+        return 12;
+    }
+
+    writeInt32(out + 12, (Int32)count);
+    writeInt32(out + 16, 1);
+
+    return ARRAY_HEADER_SIZE;
+}
+
+//! Parsed header of a binary array value.
+struct ArrayHeader
+{
+    Oid elementType;
+    UInt32 count;            //!< Number of elements, of every dimension
+    Bool hasNull;
+    const UInt8 *elements;   //!< First element length
+    const UInt8 *end;
+};
+
+/**
+ * @brief Parse the header of a binary array value. Multi dimensional arrays are
+ * seen as a flat array of their elements.
+ * @return False if the value is not a valid array.
+ */
+O3D_PGSQL_API Bool readArrayHeader(const UInt8 *data, UInt32 len, ArrayHeader &header);
+
+/**
+ * @brief Decode the elements of an array of 32 bits or 64 bits values (size is 4 or 8)
+ * into out, in the native byte order, with a vectorized conversion. NULL elements
+ * are zero.
+ * @return False if an element has not the expected size or is truncated.
+ */
+O3D_PGSQL_API Bool decodeArrayElements(const ArrayHeader &header, UInt32 size, void *out);
+
+} // namespace binary
+} // namespace pgsql
+} // namespace o3d
+
+#endif // _O3D_PGSQLBINARY_H
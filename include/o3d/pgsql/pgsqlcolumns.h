@@ -0,0 +1,141 @@
+/**
+ * @file pgsqlcolumns.h
+ * @brief Columnar storage of a range of result rows.
+ * @author Frederic SCHERMA (frederic.scherma@dreamoverflow.org)
+ * @date 2019-03-09
+ * @copyright Copyright (c) 2001-2019 Dream Overflow. All rights reserved.
+ * @details
+ */
+
+#ifndef _O3D_PGSQLCOLUMNS_H
+#define _O3D_PGSQLCOLUMNS_H
+
+#include "pgsql.h"
+
+#include <o3d/core/base.h>
+#include <o3d/core/string.h>
+
+#include <postgresql/libpq-fe.h>
+
+#include <vector>
+
+namespace o3d {
+namespace pgsql {
+
+/**
+ * @brief PgSqlColumns rows of a result decoded column by column into contiguous typed
+ * arrays (structure of arrays). Integers are stored as Int32 or Int64, reals as Double,
+ * and the others as bytes, concatenated with an offset per row. Each column has a
+ * null bitmap, with a bit set for a NULL value.
+ * The buffers are reused by the next fetch, so their capacity only grows.
+ * @author Frederic SCHERMA (frederic.scherma@dreamoverflow.org)
+ * @date 2019-03-09
+ */
+class O3D_PGSQL_API PgSqlColumns
+{
+public:
+
+    //! Storage of a column.
+    enum Storage
+    {
+        STORAGE_INT32,    //!< bool, int2, int4, date (days since 2000-01-01)
+        STORAGE_INT64,    //!< int8, time, timestamp, timestamptz (microseconds)
+        STORAGE_DOUBLE,   //!< float4, float8, numeric (nearest double)
+        STORAGE_BYTES     //!< text and raw binary values
+    };
+
+    PgSqlColumns();
+
+    //! Remove the rows, keeping the columns and the allocated memory.
+    void clear();
+
+    //! Number of decoded rows.
+    UInt32 getNumRows() const { return m_numRows; }
+
+    //! Number of columns.
+    UInt32 getNumColumns() const { return (UInt32)m_columns.size(); }
+
+    //! Column name.
+    const CString& getName(UInt32 col) const { return column(col).name; }
+
+    //! Column PostgreSQL type.
+    Oid getType(UInt32 col) const { return column(col).type; }
+
+    //! Column storage.
+    Storage getStorage(UInt32 col) const { return column(col).storage; }
+
+    //! Is a value NULL. NULL values are zero or empty in the data arrays.
+    Bool isNull(UInt32 col, UInt32 row) const
+    {
+        const Column &c = column(col);
+        return (c.nulls[row >> 3] >> (row & 7)) & 1;
+    }
+
+    //! Null bitmap of a column, bit (row & 7) of byte (row >> 3) is set for NULL.
+    const UInt8* getNulls(UInt32 col) const { return column(col).nulls.data(); }
+
+    //! Number of NULL values of a column.
+    UInt32 getNumNulls(UInt32 col) const { return column(col).numNulls; }
+
+    //! Values of an Int32 column.
+    const Int32* getInt32s(UInt32 col) const;
+
+    //! Values of an Int64 column.
+    const Int64* getInt64s(UInt32 col) const;
+
+    //! Values of a Double column.
+    const Double* getDoubles(UInt32 col) const;
+
+    //! Offsets of the values of a bytes column, getNumRows()+1 entries.
+    const UInt32* getOffsets(UInt32 col) const;
+
+    //! Concatenated values of a bytes column.
+    const UInt8* getBytes(UInt32 col) const;
+
+    //! Value of a bytes column, not null terminated.
+    const UInt8* getBytes(UInt32 col, UInt32 row, UInt32 &len) const;
+
+    /**
+     * @brief Setup the columns from the fields of a result, unless they are identical.
+     * @return True if the columns changed, and the rows cleared.
+     */
+    Bool setup(const PGresult *res);
+
+    /**
+     * @brief Decode and append count rows of a result, starting at row first.
+     * The result fields must match the columns setup.
+     */
+    void append(const PGresult *res, UInt32 first, UInt32 count);
+
+    //! Get the storage of a PostgreSQL type.
+    static Storage storageOf(Oid type);
+
+private:
+
+    struct Column
+    {
+        CString name;
+        Oid type;
+        Storage storage;
+
+        UInt32 numNulls;
+
+        std::vector<UInt8> nulls;
+        std::vector<Int32> int32s;
+        std::vector<Int64> int64s;
+        std::vector<Double> doubles;
+        std::vector<UInt32> offsets;
+        std::vector<UInt8> bytes;
+    };
+
+    UInt32 m_numRows;
+    std::vector<Column> m_columns;
+
+    const Column& column(UInt32 col) const;
+    const Column& column(UInt32 col, Storage storage) const;
+};
+
+} // namespace pgsql
+} // namespace o3d
+
+#endif // _O3D_PGSQLCOLUMNS_H
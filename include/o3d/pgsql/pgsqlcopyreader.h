@@ -0,0 +1,134 @@
+/**
+ * @file pgsqlcopyreader.h
+ * @brief Streaming reader using the PostgreSQL binary COPY TO STDOUT.
+ * @author Frederic SCHERMA (frederic.scherma@dreamoverflow.org)
+ * @date 2019-03-09
+ * @copyright Copyright (c) 2001-2019 Dream Overflow. All rights reserved.
+ * @details
+ */
+
+#ifndef _O3D_PGSQLCOPYREADER_H
+#define _O3D_PGSQLCOPYREADER_H
+
+#include "pgsql.h"
+#include "pgsqlnameindex.h"
+
+#include <o3d/core/database.h>
+#include <o3d/core/date.h>
+#include <o3d/core/datetime.h>
+#include <o3d/core/memorydbg.h>
+
+#include <postgresql/libpq-fe.h>
+
+#include <vector>
+
+namespace o3d {
+namespace pgsql {
+
+class PgSqlDb;
+
+/**
+ * @brief PgSqlCopyReader rows reader, streaming the results of a query in binary COPY format.
+ * Only one row is kept in memory at a time, and the values are decoded on demand
+ * directly from the received copy data. The connection is busy until the last row is
+ * fetched or the reader is deleted.
+ * @author Frederic SCHERMA (frederic.scherma@dreamoverflow.org)
+ * @date 2019-03-09
+ */
+class O3D_PGSQL_API PgSqlCopyReader
+{
+    friend class PgSqlDb;
+
+public:
+
+    //! Virtual destructor. Cancel the copy if not entirely read.
+    virtual ~PgSqlCopyReader();
+
+    /**
+     * @brief fetch Fetch the next row.
+     * Can be called in a while for each row of the result.
+     * @return True until there is results row
+     */
+    Bool fetch();
+
+    //! Cancel the copy, the remaining rows are not received. The connection is available again.
+    void cancel();
+
+    //! Number of fetched rows.
+    UInt64 getNumRows() const { return m_numRows; }
+
+    //! Number of columns.
+    UInt32 getNumColumns() const { return m_numCols; }
+
+    //! Get a column id by its name.
+    UInt32 getOutAttr(const CString &name) const;
+
+    //! Get the type of a column.
+    Oid getType(UInt32 attr) const;
+
+    //! Is a column of the current row NULL.
+    Bool isNull(UInt32 attr) const;
+
+    //! Raw binary value of a column of the current row, valid until the next fetch.
+    const UInt8* getData(UInt32 attr, UInt32 &len) const;
+
+    //! Column of the current row as Bool.
+    Bool asBool(UInt32 attr) const;
+
+    //! Column of the current row as Int32.
+    Int32 asInt32(UInt32 attr) const;
+
+    //! Column of the current row as Int64 (microseconds since 2000-01-01 for timestamps).
+    Int64 asInt64(UInt32 attr) const;
+
+    //! Column of the current row as Float.
+    Float asFloat(UInt32 attr) const;
+
+    //! Column of the current row as Double.
+    Double asDouble(UInt32 attr) const;
+
+    //! Column of the current row as CString (copy).
+    CString asCString(UInt32 attr) const;
+
+    //! Column of the current row as Date, from a date or a timestamp.
+    Date asDate(UInt32 attr) const;
+
+    //! Column of the current row as DateTime, from a date, a time or a timestamp.
+    DateTime asDateTime(UInt32 attr) const;
+
+protected:
+
+    //! Start the COPY TO STDOUT of the results of a query.
+    PgSqlCopyReader(PgSqlDb *db, const CString &query);
+
+    PgSqlDb *m_db;
+    PGconn *m_pDB;
+
+    UInt32 m_numCols;
+    UInt64 m_numRows;
+
+    Bool m_active;
+    Bool m_header;         //!< Header already read
+
+    char *m_pData;         //!< Current copy data, owned by libpq
+
+    PgSqlNameIndex m_outputNames;
+
+    std::vector<Oid> m_types;              //!< Columns types
+    std::vector<const UInt8*> m_values;    //!< Current row values in the copy data
+    std::vector<Int32> m_lengths;          //!< Current row values lengths, -1 for NULL
+
+    //! Check the attribute and returns its value, or throws if NULL.
+    const UInt8* value(UInt32 attr) const;
+
+    //! The copy is terminated, the connection is available again.
+    void release();
+
+    void finish();
+    void throwError();
+};
+
+} // namespace pgsql
+} // namespace o3d
+
+#endif // _O3D_PGSQLCOPYREADER_H
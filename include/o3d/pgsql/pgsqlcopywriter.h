@@ -0,0 +1,157 @@
+/**
+ * @file pgsqlcopywriter.h
+ * @brief Bulk writer using the PostgreSQL binary COPY FROM STDIN.
+ * @author Frederic SCHERMA (frederic.scherma@dreamoverflow.org)
+ * @date 2019-03-09
+ * @copyright Copyright (c) 2001-2019 Dream Overflow. All rights reserved.
+ * @details
+ */
+
+#ifndef _O3D_PGSQLCOPYWRITER_H
+#define _O3D_PGSQLCOPYWRITER_H
+
+#include "pgsql.h"
+
+#include <o3d/core/database.h>
+#include <o3d/core/date.h>
+#include <o3d/core/datetime.h>
+#include <o3d/core/memorydbg.h>
+
+#include <postgresql/libpq-fe.h>
+
+#include <vector>
+
+namespace o3d {
+namespace pgsql {
+
+class PgSqlDb;
+
+/**
+ * @brief PgSqlCopyWriter bulk rows writer, streaming in binary COPY format.
+ * Rows are encoded into a local buffer, sent to the server each time it exceeds the
+ * buffer size. The connection is busy until end() or abort() is called.
+ * Attributes are the indices of the columns given at creation, the unset ones are NULL.
+ * The server doesn't check the binary values, so a number out of the range of its column
+ * type (or a real with a fraction for an integer column) is refused with an exception.
+ * @author Frederic SCHERMA (frederic.scherma@dreamoverflow.org)
+ * @date 2019-03-09
+ */
+class O3D_PGSQL_API PgSqlCopyWriter
+{
+    friend class PgSqlDb;
+
+public:
+
+    //! Default flush buffer size in bytes.
+    static const UInt32 DEFAULT_BUFFER_SIZE = 256*1024;
+
+    //! Virtual destructor. Abort the copy if not ended.
+    virtual ~PgSqlCopyWriter();
+
+    //! Set a column as NULL.
+    void setNull(UInt32 attr);
+
+    //! Set a column as ArrayUInt8.
+    void setArrayUInt8(UInt32 attr, const ArrayUInt8 &v);
+
+    //! Set a column as SmartArrayUInt8.
+    void setSmartArrayUInt8(UInt32 attr, const SmartArrayUInt8 &v);
+
+    //! Set a column as Bool.
+    void setBool(UInt32 attr, Bool v);
+
+    //! Set a column as Int32.
+    void setInt32(UInt32 attr, Int32 v);
+
+    //! Set a column as UInt32.
+    void setUInt32(UInt32 attr, UInt32 v);
+
+    //! Set a column as Int64.
+    void setInt64(UInt32 attr, Int64 v);
+
+    //! Set a column as UInt64.
+    void setUInt64(UInt32 attr, UInt64 v);
+
+    //! Set a column as Float.
+    void setFloat(UInt32 attr, Float v);
+
+    //! Set a column as Double. For a NUMERIC column, with the fewest digits giving back v.
+    void setDouble(UInt32 attr, Double v);
+
+    /**
+     * @brief Set a column as a fixed point numeric, of value v / 10^scale.
+     * Exact for a NUMERIC or a textual column, rounded for a float4 or float8 one.
+     * @param scale Number of decimal digits, at most 18.
+     */
+    void setNumeric(UInt32 attr, Int64 v, UInt32 scale);
+
+    //! Set a column as CString.
+    void setCString(UInt32 attr, const CString &v);
+
+    //! Set a column as Date.
+    void setDate(UInt32 attr, const Date &date);
+
+    //! Set a column as Timestamp.
+    void setTimestamp(UInt32 attr, const DateTime &date);
+
+    //! Append the current row, and reset each column to NULL for the next one.
+    void writeRow();
+
+    //! Send the buffered rows to the server.
+    void flush();
+
+    //! Send the remaining rows and terminate the copy. Returns the number of copied rows.
+    UInt64 end();
+
+    //! Abort the copy, none of the rows are inserted.
+    void abort();
+
+    //! Number of rows written so far.
+    UInt64 getNumRows() const { return m_numRows; }
+
+    //! Number of columns.
+    UInt32 getNumColumns() const { return m_numCols; }
+
+protected:
+
+    //! Start the COPY FROM STDIN of the columns of a table.
+    PgSqlCopyWriter(
+            PgSqlDb *db,
+            const CString &table,
+            const std::vector<CString> &columns,
+            UInt32 bufferSize);
+
+    PgSqlDb *m_db;
+    PGconn *m_pDB;
+
+    UInt32 m_numCols;
+    UInt64 m_numRows;
+    UInt32 m_bufferSize;
+
+    Bool m_active;
+
+    std::vector<Oid> m_types;                 //!< Columns types
+    std::vector<Int32> m_lengths;             //!< Current row columns lengths, -1 for NULL
+    std::vector<std::vector<UInt8>> m_fields; //!< Current row columns binary values
+
+    std::vector<UInt8> m_buffer;              //!< Encoded rows not sent yet
+
+    //! Check the attribute id and returns its field storage, grown to at least len bytes.
+    UInt8* field(UInt32 attr, UInt32 len);
+
+    void setInteger(UInt32 attr, Int64 v, Bool isUnsigned);
+    void setReal(UInt32 attr, Double v, Bool isFloat);
+    void setBytes(UInt32 attr, const UInt8 *v, UInt32 len);
+    void setTime(UInt32 attr, Int64 usecs);
+
+    //! The copy is terminated, the connection is available again.
+    void release();
+
+    void putData(const UInt8 *data, UInt32 len);
+    void throwError();
+};
+
+} // namespace pgsql
+} // namespace o3d
+
+#endif // _O3D_PGSQLCOPYWRITER_H
@@ -11,17 +11,39 @@
 #define _O3D_PGSQLDB_H
 
 #include "pgsql.h"
+#include "pgsqlnameindex.h"
+#include "pgsqlstats.h"
+#include "pgsqlvalue.h"
 
 #include <o3d/core/database.h>
 #include <o3d/core/date.h>
 #include <o3d/core/datetime.h>
+#include <o3d/core/instream.h>
+#include <o3d/core/outstream.h>
 #include <o3d/core/memorydbg.h>
 
 #include <postgresql/libpq-fe.h>
 
+#include <deque>
+#include <list>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
 namespace o3d {
 namespace pgsql {
 
+class PgSqlDb;
+class PgSqlQuery;
+class PgSqlCopyWriter;
+class PgSqlCopyReader;
+class PgSqlColumns;
+
 /**
  * @brief PgSql
  * @author Frederic SCHERMA (frederic.scherma@dreamoverflow.org)
@@ -38,6 +60,79 @@ public:
     static void quit();
 };
 
+/**
+ * @brief PgSqlAsync handle on an asynchronous execution of a query.
+ * The result is received into the query, and is available until its next execution.
+ * @author Frederic SCHERMA (frederic.scherma@dreamoverflow.org)
+ * @date 2019-03-09
+ */
+class O3D_PGSQL_API PgSqlAsync
+{
+    friend class PgSqlDb;
+
+public:
+
+    //! Invalid handle.
+    PgSqlAsync() : m_db(nullptr), m_query(nullptr), m_id(0) {}
+
+    //! Is the handle valid.
+    Bool isValid() const { return m_db != nullptr; }
+
+    //! The executed query.
+    PgSqlQuery* getQuery() const { return m_query; }
+
+    //! Is the result received (successfully or not). Need polling the connection.
+    Bool isDone() const;
+
+    //! Wait until the result is received, then throws if the execution failed.
+    void wait();
+
+    //! Throws if the execution failed. Must be done.
+    void check() const;
+
+private:
+
+    PgSqlAsync(PgSqlDb *db, PgSqlQuery *query, UInt64 id) :
+        m_db(db), m_query(query), m_id(id) {}
+
+    PgSqlDb *m_db;
+    PgSqlQuery *m_query;
+    UInt64 m_id;
+};
+
+/**
+ * @brief PgSqlOutHandle output attribute of a query resolved once by its name, then
+ * giving its variable without any lookup. Cheap to copy, it stays valid for the
+ * life of the query, whatever the number of executions.
+ * @author Frederic SCHERMA (frederic.scherma@dreamoverflow.org)
+ * @date 2019-03-09
+ */
+class O3D_PGSQL_API PgSqlOutHandle
+{
+    friend class PgSqlQuery;
+
+public:
+
+    //! Invalid handle.
+    PgSqlOutHandle() : m_attr(0), m_var(nullptr) {}
+
+    Bool isValid() const { return m_var != nullptr; }
+
+    //! Output attribute id.
+    UInt32 getAttr() const { return m_attr; }
+
+    //! Output variable. An array value is only up to date once given by PgSqlQuery::getOut.
+    const DbVariable& operator* () const { return *m_var; }
+    const DbVariable* operator-> () const { return m_var; }
+
+private:
+
+    PgSqlOutHandle(UInt32 attr, const DbVariable *var) : m_attr(attr), m_var(var) {}
+
+    UInt32 m_attr;
+    const DbVariable *m_var;
+};
+
 /**
  * @brief PgSqlDb database client.
  * @author Frederic SCHERMA (frederic.scherma@dreamoverflow.org)
@@ -45,8 +140,21 @@ public:
  */
 class O3D_PGSQL_API PgSqlDb : public Database
 {
+    friend class PgSqlQuery;
+    friend class PgSqlCopyWriter;
+    friend class PgSqlCopyReader;
+    friend class PgSqlAsync;
+
 public:
 
+    //! Asynchronous connection state.
+    enum ConnectState
+    {
+        CONNECT_READING,   //!< Wait until the socket is ready to read, then poll again
+        CONNECT_WRITING,   //!< Wait until the socket is ready to write, then poll again
+        CONNECT_OK         //!< Connection established
+    };
+
 	//! Default ctor
     PgSqlDb();
 
@@ -62,18 +170,356 @@ public:
         const String &password = "",
         Bool keepPassord = True);
 
+    /**
+     * @brief Start to connect to a database without blocking.
+     * Then pollConnect() must be called each time the socket is ready, until it
+     * returns CONNECT_OK.
+     */
+    void connectAsync(
+        const String &host,
+        o3d::UInt32 port,
+        const String &database,
+        const String &user = "",
+        const String &password = "",
+        Bool keepPassord = True);
+
+    //! Advance an asynchronous connection. Throws if the connection failed.
+    ConnectState pollConnect();
+
 	//! Disconnect from the database server
     virtual void disconnect();
 
-	//! Try to maintain the connection established
+    //! Socket of the connection, for waiting on events in an external loop, or -1.
+    Int32 getSocket() const;
+
+    //! Read the data available on the socket without blocking. Returns False on error.
+    Bool consumeInput();
+
+    /**
+     * @brief Send the pending data, read the available data, and process the received
+     * asynchronous results without blocking.
+     * @return The number of asynchronous executions done by this call.
+     */
+    UInt32 poll();
+
+    //! Some data remains to be sent, wait until the socket is ready to write then poll.
+    Bool isWritePending() const { return m_writePending; }
+
+    //! Number of asynchronous executions in flight.
+    UInt32 getNumAsync() const { return (UInt32)m_async.size(); }
+
+    //! Block until every asynchronous execution is done.
+    void waitAsync();
+
+    /**
+     * @brief Try to maintain the connection established.
+     * An idle connection is checked by an empty query, a busy one (stream, batch,
+     * asynchronous executions or copy in progress) by its status only.
+     * A lost connection is reconnected.
+     */
     virtual void pingConnection();
 
+    /**
+     * @brief Return the connection to an idle state, to be used by someone else.
+     * The copy and the stream are cancelled, the asynchronous executions waited, the
+     * batches terminated with their results discarded, and an open or aborted
+     * transaction rolled back. Never throws.
+     * @return False if the connection cannot be cleaned and must be closed.
+     */
+    Bool makeIdle();
+
+    /**
+     * @brief Automatic reconnection, when an execution finds the connection lost.
+     * A query executed out of a transaction is then executed again, an update is not
+     * since it could have been done.
+     * @param maxRetries Number of retries after a failed reconnection, 0 to disable
+     * the automatic reconnection.
+     * @param delayMs Delay before the first retry, doubled for each next one.
+     * @param maxDelayMs Max delay between two retries.
+     */
+    void setReconnect(UInt32 maxRetries, UInt32 delayMs = 100, UInt32 maxDelayMs = 5000);
+
+    //! Max time to establish a connection at each reconnection try.
+    static const UInt32 RECONNECT_TIMEOUT_MS = 10000;
+
+    /**
+     * @brief Reset the connection, retrying as set by setReconnect, then prepare again
+     * the statements of the queries in a single round trip.
+     * Pending results, streams and batches are lost. Throws if every try failed.
+     */
+    void reconnect();
+
+    /**
+     * @brief Start to reset the connection without blocking.
+     * Then pollReset() must be called each time the socket is ready, until it
+     * returns CONNECT_OK.
+     */
+    void resetAsync();
+
+    //! Advance an asynchronous reset. Once connected the statements are prepared again.
+    ConnectState pollReset();
+
+    //! Number of reconnections done.
+    UInt32 getNumReconnects() const { return m_numReconnects; }
+
+    /**
+     * @brief Start a batch of queries executed in pipeline mode.
+     * Queued executions are sent without waiting for the results of the previous ones,
+     * so a whole batch costs about one network round trip.
+     */
+    void beginBatch();
+
+    //! Queue an execution of a query of this connection, with its current bound parameters.
+    void queueBatch(PgSqlQuery *query);
+
+    //! Send the queued executions to the server. Returns the number of results to read.
+    UInt32 syncBatch();
+
+    /**
+     * @brief Read the next synced result of the batch, in the queue order.
+     * @return The query receiving the result, ready to be fetched, or nullptr if
+     * there is no more result to read.
+     */
+    PgSqlQuery* nextBatchResult();
+
+    //! Terminate the batch, discarding any unread result, and leave the pipeline mode.
+    void endBatch();
+
+    //! Default size of the chunks read or written to a large object.
+    static const UInt32 LO_CHUNK_SIZE = 256*1024;
+
+    /**
+     * @brief Create a large object from the content of a stream, read and sent by chunks
+     * so the memory usage doesn't depend on the size of the data.
+     * Done in its own transaction if none is in progress.
+     * @return The large object oid.
+     */
+    Oid writeLargeObject(InStream &is, UInt32 chunkSize = LO_CHUNK_SIZE);
+
+    /**
+     * @brief Read a large object by chunks into a stream.
+     * Done in its own transaction if none is in progress.
+     * @return The number of bytes read.
+     */
+    UInt64 readLargeObject(Oid oid, OutStream &os, UInt32 chunkSize = LO_CHUNK_SIZE);
+
+    //! Delete a large object.
+    void unlinkLargeObject(Oid oid);
+
+    //! Is a batch in progress.
+    Bool isBatch() const { return m_batch; }
+
+    /**
+     * @brief Limits of the prepared statements cache.
+     * Queries with the same SQL, once normalized, share a server side prepared statement.
+     * A statement no longer used by a query is kept for the next query with the same SQL,
+     * and deallocated, least recently used first, beyond a count or a total SQL size.
+     * Statements in use are never deallocated, and don't count against the limits.
+     * @param maxCount Max number of unused statements.
+     * @param maxSize Max total size of the SQL of the unused statements.
+     */
+    void setStatementCache(UInt32 maxCount, UInt32 maxSize);
+
+    //! Number of queries prepared with a cached statement.
+    UInt64 getStatementHits() const { return m_stmtHits; }
+
+    //! Number of queries for which a statement is prepared.
+    UInt64 getStatementMisses() const { return m_stmtMisses; }
+
+    //! Number of prepared statements, used or not.
+    UInt32 getNumStatements() const { return (UInt32)m_statements.size(); }
+
+    //! Deallocate every statement not used by a query.
+    void purgeStatements();
+
+    /**
+     * @brief Enable or disable the statistics of the queries, by query name.
+     * Disabled by default. Once enabled, the counters are lock-free, and are kept
+     * for a name when its queries are deleted.
+     */
+    void setStatsEnabled(Bool enable);
+
+    //! Are the statistics of the queries enabled.
+    Bool isStatsEnabled() const { return m_statsEnabled; }
+
+    /**
+     * @brief Copy the statistics of each query name. Can be called from another thread
+     * than the one executing the queries.
+     * @param reset Reset the counters once copied.
+     */
+    void getStats(std::vector<PgSqlStats::Snapshot> &stats, Bool reset = False);
+
+    //! Reset the statistics of every query name.
+    void resetStats();
+
+    /**
+     * @brief Start a bulk copy of rows into some columns of a table, in binary format.
+     * Until the end of the copy, any other execution on the connection is refused.
+     * @param table Table name, optionally with its schema.
+     * @param columns Columns names, in the order of the writer attributes.
+     * @param bufferSize Encoded rows are sent each time this size is exceeded (0 for default).
+     * @return A new writer, to be deleted by the caller, before this connection.
+     */
+    PgSqlCopyWriter* newCopyWriter(
+            const CString &table,
+            const std::vector<CString> &columns,
+            UInt32 bufferSize = 0);
+
+    /**
+     * @brief Start streaming the results of a query, in binary copy format.
+     * Until the last row is fetched, any other execution on the connection is refused.
+     * @param query A query without parameter.
+     * @return A new reader, to be deleted by the caller, before this connection.
+     */
+    PgSqlCopyReader* newCopyReader(const CString &query);
+
 protected:
 
 	//! Instanciate a new DbQuery object
     virtual DbQuery* newDbQuery(const String &name, const CString &query);
 
+    //! Generate a prepared statement name, unique for this connection.
+    CString nextStatementName();
+
+    //! SQL with the runs of spaces out of literals collapsed, the statement cache key.
+    static std::string normalizeSql(const CString &sql);
+
+    /**
+     * @brief Get the prepared statement of a SQL from the cache, or prepare it.
+     * @param name Receives the statement name.
+     * @param key Receives the cache key, to release the statement.
+     * @return The statement description, owned by the cache.
+     */
+    const PGresult* acquireStatement(const CString &sql, CString &name, std::string &key);
+
+    //! Release a statement acquired by a query.
+    void releaseStatement(const std::string &key);
+
+    //! Deallocate the least recently used unused statements beyond some limits.
+    void trimStatements(UInt32 maxCount, size_t maxSize);
+
+    //! Terminate the current streamed query if any, making the connection available.
+    void endStream();
+
+    //! Throw if a copy is in progress, any other command would abort it.
+    void checkCopy() const;
+
+    //! End the streamed query, and wait for the asynchronous executions.
+    //! Throws if a copy is in progress.
+    void makeAvailable();
+
+    //! Execute a command without result, throws on error.
+    void command(const Char *sql);
+
+    //! Throw the last error of the connection.
+    void throwError();
+
+    //! Forget the pending results, streams and batches, lost with the connection.
+    void resetState();
+
+    //! Reset the connection and wait until established. Returns False if failed.
+    Bool resetConnection();
+
+    /**
+     * @brief Prepare again the statements in use after a reconnection, pipelined.
+     * A statement failing to prepare doesn't abort the others, and is prepared again
+     * at its next execution. Throws only if the connection is lost again.
+     */
+    void prepareStatements();
+
+    /**
+     * @brief Prepare a statement that failed to be prepared again after a reconnection,
+     * before executing it. Throws if it fails again. Not possible during a batch.
+     */
+    void prepareStatement(const std::string &key)
+    {
+        if (m_stmtUnprepared > 0) {
+            retryStatement(key);
+        }
+    }
+
+    void retryStatement(const std::string &key);
+
+    //! Reconnect if the connection is lost and the reconnection enabled.
+    Bool recover();
+
+    //! Get or create the statistics of a query name.
+    PgSqlStats* statsOf(const String &name);
+
+    //! Build the connection string and memorize the connection parameters.
+    String connectionInfo(
+        const String &host,
+        o3d::UInt32 port,
+        const String &database,
+        const String &user,
+        const String &password,
+        Bool keepPassord);
+
+    //! Send an asynchronous execution of a query.
+    PgSqlAsync sendAsync(PgSqlQuery *query);
+
+    //! Process the asynchronous results, blocking or not until the next result.
+    UInt32 processAsync(Bool block);
+
+    //! Block until the asynchronous execution id is done.
+    void waitAsync(UInt64 id);
+
     PGconn *m_pDB;
+
+    UInt32 m_stmtCounter;
+
+    UInt32 m_reconnectRetries;
+    UInt32 m_reconnectDelay;      //!< In ms
+    UInt32 m_reconnectMaxDelay;   //!< In ms
+    UInt32 m_numReconnects;
+
+    std::set<PgSqlQuery*> m_queries;   //!< Queries created on this connection
+
+    struct Statement
+    {
+        CString name;
+        CString sql;         //!< Original text, prepared again from it after a reconnection
+        PGresult *desc;      //!< Parameters and fields description
+        UInt32 refs;         //!< Number of queries using it
+        Bool prepared;       //!< False if failed to be prepared again after a reconnection
+        std::list<std::string>::iterator lru;
+    };
+
+    std::unordered_map<std::string, Statement> m_statements;  //!< By normalized SQL
+    std::list<std::string> m_stmtLru;  //!< Statements keys, most recently used first
+    UInt32 m_stmtMaxCount;
+    size_t m_stmtMaxSize;
+    UInt32 m_stmtUnused;               //!< Number of statements with no reference
+    size_t m_stmtUnusedSize;           //!< Total SQL size of these statements
+    UInt64 m_stmtHits;
+    UInt64 m_stmtMisses;
+    UInt32 m_stmtUnprepared;           //!< Number of statements not prepared since a reconnection
+
+    Bool m_statsEnabled;
+    std::map<String, PgSqlStats*> m_stats;  //!< By query name
+    std::mutex m_statsMutex;                //!< Protects the map, not the counters
+    PgSqlQuery *m_streamQuery;         //!< Query currently streaming its results
+    PgSqlCopyWriter *m_copyWriter;     //!< Copy in progress, the connection is busy until its end
+    PgSqlCopyReader *m_copyReader;     //!< Copy in progress, the connection is busy until its end
+
+    Bool m_batch;
+    std::vector<PgSqlQuery*> m_batchQueue;  //!< Queued executions, nullptr for a sync point
+    size_t m_batchNext;                     //!< Next result to read from the queue
+    size_t m_batchSynced;                   //!< Queue size at the last sync point
+
+    struct AsyncOp
+    {
+        PgSqlQuery *query;
+        UInt64 id;
+        UInt32 step;        //!< Result, end of result, then sync point in pipeline mode
+    };
+
+    std::deque<AsyncOp> m_async;           //!< Asynchronous executions in flight, in order
+    std::map<UInt64, String> m_asyncErrors;  //!< Failed and not checked asynchronous executions
+    UInt64 m_asyncId;                      //!< Last asynchronous execution id
+    UInt64 m_asyncDone;                    //!< Last done asynchronous execution id
+    Bool m_asyncPipeline;                  //!< Pipeline mode entered for asynchronous executions
+    Bool m_writePending;
 };
 
 /**
@@ -96,7 +542,14 @@ public:
     //! Set an input variable as SmartArrayUInt8. The array is duplicated.
     virtual void setSmartArrayUInt8(UInt32 attr, const SmartArrayUInt8 &v);
 
-    //! Set an input variable as InStream. Data are not duplicated. The stream must stay opened.
+    /**
+     * @brief Set an input variable as InStream, read until its end by chunks.
+     * For an oid or int8 parameter, the data are stored into a new large object
+     * without buffering them, and its oid is bound. It must be done in a transaction,
+     * so the large object is removed by the rollback if the statement fails or is not
+     * executed. For a bytea or text parameter, the data are read into the parameter
+     * buffer, without intermediate copy.
+     */
     virtual void setInStream(UInt32 attr, const InStream &v);
 
     //! Set an input variable as Bool.
@@ -120,6 +573,13 @@ public:
     //! Set an input variable as Double.
     virtual void setDouble(UInt32 attr, Double v);
 
+    /**
+     * @brief Set an input variable as a fixed point numeric, of value v / 10^scale.
+     * Sent in binary, without any rounding, if the parameter is a NUMERIC.
+     * @param scale Number of decimal digits, at most 18.
+     */
+    void setNumeric(UInt32 attr, Int64 v, UInt32 scale);
+
     //! Set an input variable as CString.
     virtual void setCString(UInt32 attr, const CString &v);
 
@@ -129,27 +589,158 @@ public:
 	//! Set an input variable as Timestamp.
     virtual void setTimestamp(UInt32 attr, const DateTime &date);
 
+    /**
+     * @brief Set an input variable as an integer array, for an int2[], int4[] or int8[]
+     * parameter, sent in binary array format. The values are duplicated.
+     */
+    void setArrayInt32(UInt32 attr, const Int32 *v, UInt32 n);
+    void setArrayInt32(UInt32 attr, const ArrayInt32 &v) { setArrayInt32(attr, v.getData(), v.getSize()); }
+    void setArrayInt32(UInt32 attr, const SmartArrayInt32 &v) { setArrayInt32(attr, v.getData(), v.getNumElt()); }
+
+    //! Set an input variable as an integer array, for an int2[], int4[] or int8[] parameter.
+    void setArrayInt64(UInt32 attr, const Int64 *v, UInt32 n);
+    void setArrayInt64(UInt32 attr, const ArrayInt64 &v) { setArrayInt64(attr, v.getData(), v.getSize()); }
+    void setArrayInt64(UInt32 attr, const SmartArrayInt64 &v) { setArrayInt64(attr, v.getData(), v.getNumElt()); }
+
+    //! Set an input variable as a real array, for a float4[] or float8[] parameter.
+    void setArrayDouble(UInt32 attr, const Double *v, UInt32 n);
+    void setArrayDouble(UInt32 attr, const ArrayDouble &v) { setArrayDouble(attr, v.getData(), v.getSize()); }
+    void setArrayDouble(UInt32 attr, const SmartArrayDouble &v) { setArrayDouble(attr, v.getData(), v.getNumElt()); }
+
+    //! Set an input variable as a string array, for a text[], varchar[] or bytea[] parameter.
+    void setArrayCString(UInt32 attr, const TemplateArray<CString> &v);
+
+    //! Set an input variable as a timestamp array, for a timestamp[], timestamptz[] or date[] parameter.
+    void setArrayTimestamp(UInt32 attr, const TemplateArray<DateTime> &v);
+
     //! Get an output attribute id by its name.
     virtual UInt32 getOutAttr(const CString &name);
 
     //! Get an output variable by its name.
     const DbVariable& getOut(const CString &name) const;
 
-    //! Get an output variable by its index.
+    /**
+     * @brief Get an output variable by its index.
+     * An array attribute is copied into its variable here, at its first access for a row,
+     * the typed array getters don't need this copy.
+     */
     const DbVariable& getOut(UInt32 attr) const;
 
+    /**
+     * @brief Decode an int2[] or int4[] output attribute of the last fetched row.
+     * NULL elements are 0, and multi dimensional arrays are flattened.
+     * @return The number of elements, 0 for a NULL array.
+     */
+    UInt32 getArrayInt32(UInt32 attr, ArrayInt32 &out) const;
+    UInt32 getArrayInt32(UInt32 attr, SmartArrayInt32 &out) const;
+
+    //! Decode an int2[], int4[] or int8[] output attribute of the last fetched row.
+    UInt32 getArrayInt64(UInt32 attr, ArrayInt64 &out) const;
+    UInt32 getArrayInt64(UInt32 attr, SmartArrayInt64 &out) const;
+
+    //! Decode a float4[] or float8[] output attribute of the last fetched row.
+    UInt32 getArrayDouble(UInt32 attr, ArrayDouble &out) const;
+    UInt32 getArrayDouble(UInt32 attr, SmartArrayDouble &out) const;
+
+    //! Decode a text[], varchar[] or bytea[] output attribute of the last fetched row.
+    UInt32 getArrayCString(UInt32 attr, TemplateArray<CString> &out) const;
+
+    //! Resolve an output attribute by its name, to use outside of the fetch loop.
+    PgSqlOutHandle getOutHandle(const CString &name) const;
+
+    //! Get an output variable by its resolved handle.
+    const DbVariable& getOut(const PgSqlOutHandle &handle) const { return getOut(handle.getAttr()); }
+
+    /**
+     * @brief Raw binary value of an output attribute of the last fetched row, without copy.
+     * Valid until the next execution, or the next chunk of a streamed result.
+     * @param len Receives the length in bytes.
+     * @return The value, or nullptr if NULL.
+     */
+    const UInt8* getData(UInt32 attr, UInt32 &len) const;
+
+    /**
+     * @brief Text value of an output attribute of the last fetched row, without copy.
+     * The value is null terminated. Same validity as getData.
+     * @return The value, or nullptr if NULL.
+     */
+    const Char* getText(UInt32 attr, UInt32 &len) const;
+
+    /**
+     * @brief Exact NUMERIC output attribute of the last fetched row, as a fixed point
+     * integer of value * 10^scale, rounded half away from zero.
+     * NaN, infinities and values overflowing an Int64 throw an error.
+     * @return False if NULL.
+     */
+    Bool getNumeric(UInt32 attr, UInt32 scale, Int64 &v) const;
+
+    /**
+     * @brief Date or time output attribute of the last fetched row, in microseconds
+     * since 1970-01-01, without any calendar conversion.
+     * A time or timetz is relative to 2000-01-01.
+     * @return False if NULL.
+     */
+    Bool getEpochUs(UInt32 attr, Int64 &v) const;
+
+    /**
+     * @brief Enable or disable the decoding of an output attribute into its variable
+     * during fetch. An attribute read only with getData or getText doesn't need it.
+     */
+    void setOutDecoding(UInt32 attr, Bool decode);
+
     //! Execute the query for a SELECT.
     virtual void execute();
 
+    /**
+     * @brief Execute the query without waiting for its result.
+     * The result is received into this query once the handle is done, by polling the
+     * connection. Some executions can be in flight on the same connection at a time.
+     */
+    PgSqlAsync executeAsync();
+
     //! Execute the query for an UPDATE, INSERT, or DELETE.
     virtual void update();
 
     //! Get the number of affected or result rows after an execute or update.
     virtual UInt32 getNumRows();
 
-    //! Get the result variable (ie for an auto increment).
+    /**
+     * @brief Get the generated key of the last update (ie for a serial).
+     * It is the first column of the first returned row, when it is an integer, so the
+     * query must have a RETURNING clause, see returnGeneratedKey.
+     */
     virtual UInt64 getGeneratedKey() const;
 
+    /**
+     * @brief Append a RETURNING of a column to the query and prepare it again, so each
+     * update gives the value of this column as generated key, decoded in binary.
+     * The bound parameters are reset. Calling it again with the same column does nothing.
+     * The query must not return rows, nor end with a semicolon. If the new statement
+     * cannot be prepared the query stays unchanged.
+     */
+    void returnGeneratedKey(const CString &column = "id");
+
+    //! Max number of updates in flight in a batch, before reading their results.
+    static const UInt32 BATCH_SYNC_SIZE = 1024;
+
+    /**
+     * @brief Queue an update with the current bound parameters.
+     * Queued updates are pipelined, so a batch costs about one network round trip per
+     * BATCH_SYNC_SIZE updates. No other execution can be done on the connection until
+     * executeBatch.
+     */
+    void addBatch();
+
+    /**
+     * @brief Send the queued updates and read their results.
+     * On error the whole batch is terminated, updates after the failing one are not done.
+     * @return The total number of affected rows.
+     */
+    UInt64 executeBatch();
+
+    //! Generated keys of the last batch, one per update returning a row.
+    const std::vector<Int64>& getGeneratedKeys() const { return m_generatedKeys; }
+
     /**
      * @brief fetch Fetch the results.
      * Can be called in a while for each entry of the result.
@@ -157,6 +748,57 @@ public:
      */
     virtual Bool fetch();
 
+    /**
+     * @brief Decode the next rows column by column, instead of fetching them one by one.
+     * The columns are cleared, and setup from the result if necessary.
+     * @param maxRows Max number of rows to decode.
+     * @return Number of decoded rows, 0 at the end of the results.
+     */
+    UInt32 fetchBatch(PgSqlColumns &columns, UInt32 maxRows);
+
+    //! Decode every remaining row column by column. Returns the number of decoded rows.
+    UInt32 fetchColumns(PgSqlColumns &columns);
+
+    /**
+     * @brief Fetch the next row directly into C++ values, one per column in order,
+     * without the output variables. The column types are checked against the C++
+     * types once per result shape, then each value is decoded by its PgSqlValue.
+     * @return True until there is results row
+     * @code
+     * Int64 id; Double price; CString name;
+     * while (query->fetchInto(id, price, name)) { ... }
+     * @endcode
+     */
+    template <class... T>
+    Bool fetchInto(T&... values)
+    {
+        if (!nextRow()) {
+            return False;
+        }
+
+        const void *tag = &PgSqlRowTag<std::tuple<T...>>::tag;
+        if (m_rowTag != tag || m_rowShape != m_shapeId) {
+            const AcceptFunc accepts[] = { &PgSqlValue<T>::accept... };
+            checkRow(tag, accepts, sizeof...(T));
+        }
+
+        const Int32 row = m_currRow - 1;
+        Int32 col = 0;
+
+        // evaluated in order
+        const int unused[] = { (decodeValue(row, col++, values), 0)... };
+        (void)unused;
+
+        return True;
+    }
+
+    //! Fetch the next row into a tuple, as fetchInto with each element of the tuple.
+    template <class... T>
+    Bool fetchAs(std::tuple<T...> &row)
+    {
+        return fetchTuple(row, std::index_sequence_for<T...>());
+    }
+
     //! Get the row position when fetching.
     virtual UInt32 tellRow();
 
@@ -166,33 +808,188 @@ public:
     //! Unbind the current input attributes.
     virtual void unbind();
 
+    /**
+     * @brief Stream the results of the next executions instead of receiving them at once.
+     * Rows are received by chunks of chunkRows rows, or one by one when chunkRows is 1
+     * or if the chunked rows mode is not supported by libpq, so the memory usage is
+     * bounded by the chunk size. Rows can only be fetched forward, and the connection
+     * is busy until the last row is fetched or another query is executed on it.
+     */
+    void setStreaming(Bool streaming, UInt32 chunkRows = 1);
+
+    //! Is the results streaming enabled.
+    Bool isStreaming() const { return m_streaming; }
+
 protected:
 
 	//! Default ctor
     PgSqlQuery(
-        PGconn *pDb,
+        PgSqlDb *db,
 		const String &name,
         const CString &query);
 
-	//! Prepare the query. Can do nothing if not preparation is needed
+    /**
+     * @brief Query without connection, to decode results built by the caller, and to
+     * encode parameters, without server.
+     * @param outputs A result giving the output attributes.
+     * @param paramTypes Types of the parameters.
+     */
+    PgSqlQuery(const String &name, const PGresult *outputs, const Oid *paramTypes, UInt32 numParams);
+
+    //! Prepare the query server side and describe its inputs and outputs.
 	void prepareQuery();
 
+    //! Describe the inputs and outputs from a prepared statement description.
+    void describeStatement(const PGresult *res);
+
+    //! Setup the parameters arena and the output variables.
+    void describe(const PGresult *outputs, const Oid *paramTypes, UInt32 numParams);
+
     String m_name;
     CString m_query;
+    CString m_keyColumn;     //!< Column appended by returnGeneratedKey
+    CString m_stmtName;      //!< Server side prepared statement name
+    std::string m_stmtKey;   //!< Statement cache key
 
     UInt32 m_numParam;
     UInt32 m_numRow;
     UInt32 m_currRow;
+    UInt32 m_numAffected;    //!< Affected rows of the last command
+    Int64 m_generatedKey;
+
+    Bool m_updateBatch;        //!< The connection is in pipeline mode for a batch of updates
+    UInt32 m_batchCount;       //!< Updates sent since the last sync point
+    UInt64 m_batchAffected;
+    std::vector<Int64> m_generatedKeys;
+
+    PgSqlStats *m_stats;       //!< Statistics of the query name, or nullptr if disabled
+    UInt64 m_resultTime;       //!< Reception time of the result being fetched, 0 if none
+    UInt64 m_decodeNs;         //!< Decoding time of the result being fetched
 
-    std::map<CString, UInt32> m_outputNames;
+    Bool m_streaming;
+    Bool m_streamActive;   //!< Results are pending on the connection
+    UInt32 m_chunkRows;
+    UInt32 m_rowOffset;    //!< Number of rows of the previous chunks
+
+    PgSqlNameIndex m_outputNames;
 
-    TemplateArray<DbVariable*> m_inputs;
     TemplateArray<DbVariable*> m_outputs;
 
+    TemplateArray<Oid> m_paramTypes;   //!< Parameters types as deduced by the backend
+
+    /**
+     * @brief Parameters arena, allocated at prepare and reused by each execute.
+     * Fixed size values are encoded in place into their own slot of fixed, variable
+     * size values into a per parameter buffer that only grows.
+     */
+    struct Params
+    {
+        std::vector<const char*> values;
+        std::vector<int> lengths;
+        std::vector<int> formats;
+        std::vector<UInt8> fixed;
+        std::vector<std::vector<UInt8>> buffers;
+    };
+
+    Params m_params;
+
+    PgSqlDb *m_db;
     PGconn *m_pDB;
     PGresult *m_pRes;
 
-    Bool m_needBind;
+    //! Decode a binary value into an output variable.
+    typedef void (*DecodeFunc)(DbVariable &var, const char *value, Int32 len);
+
+    struct Decoder
+    {
+        DecodeFunc decode;
+        DbVariable *var;
+        UInt8 *isNull;
+        Int32 col;
+        Bool pending;                  //!< Lazy decoder whose value is not copied yet
+    };
+
+    std::vector<Decoder> m_decoders;   //!< Decoding plan of a row, built once per row description
+    mutable std::vector<Decoder> m_lazyDecoders;  //!< Array attributes, copied by getOut only
+    std::vector<Oid> m_decoderTypes;   //!< Row description the plan is built for
+    std::vector<Bool> m_noDecode;      //!< Output attributes excluded from the plan
+
+    UInt32 m_shapeId;                  //!< Incremented when the row description changes
+    const void *m_rowTag;              //!< C++ row type checked by fetchInto
+    UInt32 m_rowShape;                 //!< Shape id checked by fetchInto
+
+    typedef Bool (*AcceptFunc)(Oid type);
+
+    //! Advance to the next row without decoding it, fetching the next chunk if necessary.
+    Bool nextRow();
+
+    //! Start the measure of the fetch of a new result.
+    void startFetchStats(const PGresult *res);
+
+    //! Record the decode and fetch times once the result is fully fetched.
+    void endFetchStats();
+
+    //! Check the column types of the result against the C++ types of a row.
+    void checkRow(const void *tag, const AcceptFunc *accepts, UInt32 count);
+
+    template <class T>
+    void decodeValue(Int32 row, Int32 col, T &out) const
+    {
+        if (PQgetisnull(m_pRes, row, col)) {
+            out = T();
+        } else {
+            PgSqlValue<T>::decode(PQftype(m_pRes, col),
+                                  PQgetvalue(m_pRes, row, col),
+                                  PQgetlength(m_pRes, row, col),
+                                  out);
+        }
+    }
+
+    template <class Tuple, size_t... I>
+    Bool fetchTuple(Tuple &row, std::index_sequence<I...>)
+    {
+        return fetchInto(std::get<I>(row)...);
+    }
+
+    //! Build the decoding plan of a result, unless its row description is unchanged.
+    void buildDecoders(const PGresult *res);
+
+    //! Get the decoder of a column type into a variable, or nullptr if not supported.
+    static DecodeFunc decoderOf(Oid type, DbVariable::IntType intType);
+
+    //! Take the ownership of a result and reset the fetch position.
+    void setResult(PGresult *res);
+
+    //! Execute the prepared statement, executed again after a reconnection if retry.
+    PGresult* execPrepared(Bool retry);
+
+    //! Sync the queued updates and read their results, optionally without error.
+    void readUpdates(Bool raise);
+
+    //! Receive the next chunk of a streamed result. Returns False at the end of the results.
+    Bool nextChunk();
+
+    //! Terminate a streamed result, cancelling the remaining rows if necessary.
+    void endStream(Bool cancel);
+
+    //! Check the input attribute id and returns its fixed size slot.
+    UInt8* fixedParam(UInt32 attr);
+    //! Check the input attribute id and returns its buffer, grown to at least len+1 bytes.
+    UInt8* variableParam(UInt32 attr, UInt32 len);
+
+    void bindParam(UInt32 attr, const UInt8 *data, UInt32 len, Int32 format);
+    void bindInteger(UInt32 attr, Int64 v, Bool isUnsigned);
+    void bindReal(UInt32 attr, Double v, Bool isFloat);
+    void bindBytes(UInt32 attr, const UInt8 *v, UInt32 len, Int32 format);
+
+    //! Check that an input attribute is an array and returns its element type.
+    Oid arrayParam(UInt32 attr) const;
+
+    template <class T>
+    void bindNumberArray(UInt32 attr, const T *v, UInt32 n);
+
+    //! Parse the array output attribute of the last fetched row. Returns False if NULL.
+    Bool arrayValue(UInt32 attr, binary::ArrayHeader &header) const;
 
     void unmapType(
             Oid pgsqltype,
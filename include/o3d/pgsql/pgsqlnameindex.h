@@ -0,0 +1,73 @@
+/**
+ * @file pgsqlnameindex.h
+ * @brief Flat hashed index of result column names.
+ * @author Frederic SCHERMA (frederic.scherma@dreamoverflow.org)
+ * @date 2019-03-09
+ * @copyright Copyright (c) 2001-2019 Dream Overflow. All rights reserved.
+ * @details
+ */
+
+#ifndef _O3D_PGSQLNAMEINDEX_H
+#define _O3D_PGSQLNAMEINDEX_H
+
+#include "pgsql.h"
+
+#include <o3d/core/base.h>
+
+#include <string.h>
+#include <vector>
+
+namespace o3d {
+namespace pgsql {
+
+/**
+ * @brief PgSqlNameIndex maps the column names to their index, with an open addressing
+ * hash table and the names packed in a single buffer. Only two allocations, and a
+ * lookup is a hash plus generally a single compare.
+ * When a name is inserted twice, the first index is kept.
+ * @author Frederic SCHERMA (frederic.scherma@dreamoverflow.org)
+ * @date 2019-03-09
+ */
+class O3D_PGSQL_API PgSqlNameIndex
+{
+public:
+
+    PgSqlNameIndex();
+
+    void clear();
+
+    //! Insert a null terminated name.
+    void insert(const Char *name, UInt32 id);
+
+    //! Find a name, returns its index or -1 if unknown.
+    Int32 find(const Char *name, size_t len) const;
+
+    Int32 find(const Char *name) const { return find(name, strlen(name)); }
+
+    //! Number of indexed names.
+    UInt32 getSize() const { return m_size; }
+
+private:
+
+    struct Slot
+    {
+        UInt32 hash;
+        UInt32 id;
+        UInt32 offset;   //!< Position of the name in the names buffer
+        UInt32 len;      //!< 0 for an empty slot, or the length + 1
+    };
+
+    UInt32 m_size;
+
+    std::vector<Slot> m_slots;   //!< Power of two size, at most half filled
+    std::vector<Char> m_names;
+
+    static UInt32 hash(const Char *name, size_t len);
+
+    void grow();
+};
+
+} // namespace pgsql
+} // namespace o3d
+
+#endif // _O3D_PGSQLNAMEINDEX_H
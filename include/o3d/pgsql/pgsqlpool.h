@@ -0,0 +1,171 @@
+/**
+ * @file pgsqlpool.h
+ * @brief Thread-safe pool of PgSql connections.
+ * @author Frederic SCHERMA (frederic.scherma@dreamoverflow.org)
+ * @date 2019-03-09
+ * @copyright Copyright (c) 2001-2019 Dream Overflow. All rights reserved.
+ * @details
+ */
+
+#ifndef _O3D_PGSQLPOOL_H
+#define _O3D_PGSQLPOOL_H
+
+#include "pgsqldb.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace o3d {
+namespace pgsql {
+
+/**
+ * @brief PgSqlPool owns a set of connections to the same database, checked out by the
+ * threads for the time of their work. A connection is used by a single thread at a time.
+ * Queries registered on the pool are prepared on each connection.
+ * @author Frederic SCHERMA (frederic.scherma@dreamoverflow.org)
+ * @date 2019-03-09
+ */
+class O3D_PGSQL_API PgSqlPool
+{
+public:
+
+    struct Entry;
+
+    /**
+     * @brief Checked out connection, returned to the pool at destruction or release.
+     */
+    class O3D_PGSQL_API Handle
+    {
+        friend class PgSqlPool;
+
+    public:
+
+        //! Invalid handle.
+        Handle();
+
+        Handle(Handle &&dup);
+        Handle& operator= (Handle &&dup);
+
+        Handle(const Handle&) = delete;
+        Handle& operator= (const Handle&) = delete;
+
+        //! Return the connection to the pool, see release.
+        ~Handle();
+
+        //! Is the handle owning a connection.
+        Bool isValid() const { return m_entry != nullptr; }
+
+        //! The checked out connection.
+        PgSqlDb* get() const;
+
+        PgSqlDb* operator-> () const { return get(); }
+
+        //! Get a query registered on the pool, prepared on this connection.
+        PgSqlQuery* getQuery(const String &name) const;
+
+        /**
+         * @brief Return the connection to the pool before the destruction of the handle.
+         * Pending work is discarded and an open transaction rolled back. A connection
+         * that cannot be cleaned is closed.
+         */
+        void release();
+
+    private:
+
+        Handle(PgSqlPool *pool, Entry *entry);
+
+        PgSqlPool *m_pool;
+        Entry *m_entry;
+    };
+
+    /**
+     * @brief Create a pool, and establish its minimal number of connections.
+     * @param minSize Number of connections kept open.
+     * @param maxSize Maximal number of connections.
+     */
+    PgSqlPool(
+            const String &host,
+            UInt32 port,
+            const String &database,
+            const String &user,
+            const String &password,
+            UInt32 minSize,
+            UInt32 maxSize);
+
+    //! Close every connection. Each handle must be released before.
+    ~PgSqlPool();
+
+    //! Register a query prepared on each connection of the pool.
+    void registerQuery(const String &name, const CString &query);
+
+    /**
+     * @brief Check out a connection, opening a new one if every connection is in use
+     * and the max size is not reached, or waiting for one to be released.
+     * @param timeout Max waiting time in milliseconds.
+     * @return A valid handle, or an invalid one on timeout.
+     */
+    Handle acquire(UInt32 timeout = 5000);
+
+    //! Check out a connection if one is idle or can be opened, without waiting.
+    Handle tryAcquire();
+
+    //! Close the connections idle since more than idleTime milliseconds, down to the min size.
+    UInt32 trimIdle(UInt32 idleTime);
+
+    //! Number of open connections.
+    UInt32 getSize() const;
+
+    //! Number of idle connections.
+    UInt32 getNumIdle() const;
+
+    UInt32 getMinSize() const { return m_minSize; }
+    UInt32 getMaxSize() const { return m_maxSize; }
+
+    typedef std::chrono::steady_clock Clock;
+
+    struct Entry
+    {
+        PgSqlDb *db;
+        std::map<String, PgSqlQuery*> queries;
+        size_t numQueries;         //!< Number of pool queries registered on this connection
+        Clock::time_point lastUse;
+    };
+
+private:
+
+    String m_host;
+    UInt32 m_port;
+    String m_database;
+    String m_user;
+    String m_password;
+
+    UInt32 m_minSize;
+    UInt32 m_maxSize;
+    UInt32 m_size;               //!< Open or opening connections
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cond;
+
+    std::vector<Entry*> m_entries;
+    std::vector<Entry*> m_idle;  //!< Last released is reused first
+
+    std::vector<std::pair<String, CString>> m_queries;
+
+    Handle checkout(Bool wait, UInt32 timeout);
+    //! Return a connection cleaned to the idle ones, or close it. Never throws.
+    void checkin(Entry *entry);
+
+    Entry* createEntry();
+    void deleteEntry(Entry *entry);
+
+    //! Prepare the pool queries not already registered on a connection.
+    void syncQueries(Entry *entry);
+};
+
+} // namespace pgsql
+} // namespace o3d
+
+#endif // _O3D_PGSQLPOOL_H
@@ -0,0 +1,167 @@
+/**
+ * @file pgsqlstats.h
+ * @brief Per query latency and throughput counters.
+ * @author Frederic SCHERMA (frederic.scherma@dreamoverflow.org)
+ * @date 2019-03-09
+ * @copyright Copyright (c) 2001-2019 Dream Overflow. All rights reserved.
+ * @details
+ */
+
+#ifndef _O3D_PGSQLSTATS_H
+#define _O3D_PGSQLSTATS_H
+
+#include "pgsql.h"
+
+#include <o3d/core/base.h>
+#include <o3d/core/string.h>
+
+#include <atomic>
+#include <chrono>
+
+namespace o3d {
+namespace pgsql {
+
+//! Monotonic time in nanoseconds.
+inline UInt64 statsClock()
+{
+    return (UInt64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief PgSqlHistogram of durations, with power of two microseconds buckets.
+ * Bucket 0 counts the durations under 1us, bucket i those in [2^(i-1), 2^i[ us.
+ * Recording is lock-free, a snapshot taken during recording can be off by the
+ * in flight values only.
+ */
+class O3D_PGSQL_API PgSqlHistogram
+{
+public:
+
+    static const UInt32 NUM_BUCKETS = 32;
+
+    //! Plain copy of a histogram.
+    struct Snapshot
+    {
+        UInt64 count;
+        UInt64 totalNs;
+        UInt64 buckets[NUM_BUCKETS];
+
+        /**
+         * @brief Estimated percentile, as the upper bound of its bucket.
+         * @param p Percentile in [0..100].
+         * @return Duration in nanoseconds, 0 if empty.
+         */
+        UInt64 percentile(Double p) const;
+
+        //! Mean duration in nanoseconds, 0 if empty.
+        UInt64 mean() const { return count ? totalNs / count : 0; }
+    };
+
+    PgSqlHistogram();
+
+    void record(UInt64 ns)
+    {
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_totalNs.fetch_add(ns, std::memory_order_relaxed);
+        m_buckets[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void snapshot(Snapshot &out) const;
+
+    void reset();
+
+    static UInt32 bucketOf(UInt64 ns)
+    {
+        UInt64 us = ns / 1000;
+        UInt32 bucket = 0;
+
+        while (us && bucket < NUM_BUCKETS - 1) {
+            us >>= 1;
+            ++bucket;
+        }
+
+        return bucket;
+    }
+
+private:
+
+    std::atomic<UInt64> m_count;
+    std::atomic<UInt64> m_totalNs;
+    std::atomic<UInt64> m_buckets[NUM_BUCKETS];
+};
+
+/**
+ * @brief PgSqlStats counters of the executions of the queries of a name.
+ * Three phases are measured:
+ * - wait, the network round trip of an execution or of a streamed chunk,
+ * - decode, the decoding of the rows by fetch or fetchBatch,
+ * - fetch, from the result reception to the end of its iteration, including the
+ *   processing of the rows by the caller.
+ * Recording is lock-free, so a query can be executed in a thread while another one
+ * takes a snapshot.
+ */
+class O3D_PGSQL_API PgSqlStats
+{
+public:
+
+    //! Plain copy of the counters.
+    struct Snapshot
+    {
+        String name;
+
+        UInt64 executions;
+        UInt64 errors;
+        UInt64 rows;        //!< Result or affected rows
+        UInt64 bytes;       //!< Memory size of the received results
+
+        PgSqlHistogram::Snapshot wait;
+        PgSqlHistogram::Snapshot decode;
+        PgSqlHistogram::Snapshot fetch;
+    };
+
+    PgSqlStats(const String &name);
+
+    const String& getName() const { return m_name; }
+
+    void addExecution(UInt64 rows, UInt64 bytes)
+    {
+        m_executions.fetch_add(1, std::memory_order_relaxed);
+        m_rows.fetch_add(rows, std::memory_order_relaxed);
+        m_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    void addRows(UInt64 rows, UInt64 bytes)
+    {
+        m_rows.fetch_add(rows, std::memory_order_relaxed);
+        m_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    void addError() { m_errors.fetch_add(1, std::memory_order_relaxed); }
+
+    void recordWait(UInt64 ns) { m_wait.record(ns); }
+    void recordDecode(UInt64 ns) { m_decode.record(ns); }
+    void recordFetch(UInt64 ns) { m_fetch.record(ns); }
+
+    void snapshot(Snapshot &out) const;
+
+    void reset();
+
+private:
+
+    String m_name;
+
+    std::atomic<UInt64> m_executions;
+    std::atomic<UInt64> m_errors;
+    std::atomic<UInt64> m_rows;
+    std::atomic<UInt64> m_bytes;
+
+    PgSqlHistogram m_wait;
+    PgSqlHistogram m_decode;
+    PgSqlHistogram m_fetch;
+};
+
+} // namespace pgsql
+} // namespace o3d
+
+#endif // _O3D_PGSQLSTATS_H
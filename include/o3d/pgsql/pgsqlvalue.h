@@ -0,0 +1,231 @@
+/**
+ * @file pgsqlvalue.h
+ * @brief Decoding of binary result values into C++ types.
+ * @author Frederic SCHERMA (frederic.scherma@dreamoverflow.org)
+ * @date 2019-03-09
+ * @copyright Copyright (c) 2001-2019 Dream Overflow. All rights reserved.
+ * @details
+ */
+
+#ifndef _O3D_PGSQLVALUE_H
+#define _O3D_PGSQLVALUE_H
+
+#include "pgsqlbinary.h"
+
+#include <o3d/core/string.h>
+#include <o3d/core/error.h>
+
+#include <limits>
+
+namespace o3d {
+namespace pgsql {
+
+/**
+ * @brief PgSqlValue traits of a C++ type fetched from a binary result.
+ * accept() tells if a column type can be decoded into the C++ type, and is checked
+ * once per result shape. decode() is then called without any other check for each
+ * non NULL value, with the column type. NULL values are set to T().
+ * Specialize it to fetch other types.
+ */
+template <class T>
+struct PgSqlValue;
+
+template <>
+struct PgSqlValue<Bool>
+{
+    static Bool accept(Oid type) { return type == binary::QBOOLOID; }
+    static void decode(Oid type, const char *value, Int32 len, Bool &out) { out = value[0] != 0; }
+};
+
+template <>
+struct PgSqlValue<Int16>
+{
+    static Bool accept(Oid type) { return type == binary::QINT2OID; }
+
+    static void decode(Oid type, const char *value, Int32 len, Int16 &out)
+    {
+        out = binary::readInt16((const UInt8*)value);
+    }
+};
+
+template <>
+struct PgSqlValue<Int32>
+{
+    static Bool accept(Oid type) { return type == binary::QINT2OID || type == binary::QINT4OID; }
+
+    static void decode(Oid type, const char *value, Int32 len, Int32 &out)
+    {
+        out = len == 4 ? binary::readInt32((const UInt8*)value) : binary::readInt16((const UInt8*)value);
+    }
+};
+
+template <>
+struct PgSqlValue<Int64>
+{
+    static Bool accept(Oid type)
+    {
+        return type == binary::QINT2OID || type == binary::QINT4OID || type == binary::QINT8OID;
+    }
+
+    static void decode(Oid type, const char *value, Int32 len, Int64 &out)
+    {
+        if (len == 8) {
+            out = binary::readInt64((const UInt8*)value);
+        } else if (len == 4) {
+            out = binary::readInt32((const UInt8*)value);
+        } else {
+            out = binary::readInt16((const UInt8*)value);
+        }
+    }
+};
+
+template <>
+struct PgSqlValue<Float>
+{
+    static Bool accept(Oid type) { return type == binary::QFLOAT4OID; }
+
+    static void decode(Oid type, const char *value, Int32 len, Float &out)
+    {
+        out = binary::readFloat((const UInt8*)value);
+    }
+};
+
+template <>
+struct PgSqlValue<Double>
+{
+    static Bool accept(Oid type)
+    {
+        return type == binary::QFLOAT4OID || type == binary::QFLOAT8OID || type == binary::QNUMERICOID;
+    }
+
+    static void decode(Oid type, const char *value, Int32 len, Double &out)
+    {
+        if (type == binary::QFLOAT8OID) {
+            out = binary::readDouble((const UInt8*)value);
+        } else if (type == binary::QFLOAT4OID) {
+            out = binary::readFloat((const UInt8*)value);
+        } else {
+            out = binary::decodeNumeric((const UInt8*)value, len);
+        }
+    }
+};
+
+/**
+ * @brief PgSqlFixed fixed-point decimal, the value multiplied by 10^Scale, to fetch
+ * a numeric (ie a price) exactly, rounded half away from zero to the scale.
+ * @code
+ * PgSqlFixed<2> price;   // price.value of 1234 for 12.34
+ * @endcode
+ */
+template <UInt32 Scale>
+struct PgSqlFixed
+{
+    static_assert(Scale <= 18, "The scale of a fixed-point Int64 is at most 18");
+
+    static const UInt32 SCALE = Scale;
+
+    PgSqlFixed() : value(0) {}
+    explicit PgSqlFixed(Int64 v) : value(v) {}
+
+    Int64 value;
+};
+
+template <UInt32 Scale>
+struct PgSqlValue<PgSqlFixed<Scale>>
+{
+    static Bool accept(Oid type)
+    {
+        return type == binary::QNUMERICOID || type == binary::QINT2OID ||
+               type == binary::QINT4OID || type == binary::QINT8OID;
+    }
+
+    static void decode(Oid type, const char *value, Int32 len, PgSqlFixed<Scale> &out)
+    {
+        if (type == binary::QNUMERICOID) {
+            if (!binary::decodeNumeric((const UInt8*)value, len, Scale, out.value)) {
+                O3D_ERROR(E_InvalidResult("Numeric out of the fixed-point range"));
+            }
+            return;
+        }
+
+        Int64 v;
+        PgSqlValue<Int64>::decode(type, value, len, v);
+
+        Int64 unit = 1;
+        for (UInt32 i = 0; i < Scale; ++i) {
+            unit *= 10;
+        }
+
+        if (v > std::numeric_limits<Int64>::max() / unit || v < std::numeric_limits<Int64>::min() / unit) {
+            O3D_ERROR(E_InvalidResult("Integer out of the fixed-point range"));
+        }
+
+        out.value = v * unit;
+    }
+};
+
+template <>
+struct PgSqlValue<CString>
+{
+    static Bool accept(Oid type) { return binary::isTextual(type) || type == binary::QBYTEAOID; }
+    static void decode(Oid type, const char *value, Int32 len, CString &out) { out = CString(value, len); }
+};
+
+template <>
+struct PgSqlValue<String>
+{
+    static Bool accept(Oid type) { return binary::isTextual(type); }
+    static void decode(Oid type, const char *value, Int32 len, String &out) { out.fromUtf8(value); }
+};
+
+template <>
+struct PgSqlValue<Date>
+{
+    static Bool accept(Oid type)
+    {
+        return type == binary::QDATEOID || type == binary::QTIMESTAMPOID || type == binary::QTIMESTAMPTZOID;
+    }
+
+    static void decode(Oid type, const char *value, Int32 len, Date &out)
+    {
+        if (len == 4) {
+            binary::toDate(binary::readInt32((const UInt8*)value), out);
+        } else {
+            binary::toDate(binary::readInt64((const UInt8*)value), out);
+        }
+    }
+};
+
+template <>
+struct PgSqlValue<DateTime>
+{
+    static Bool accept(Oid type)
+    {
+        return type == binary::QDATEOID || type == binary::QTIMEOID ||
+               type == binary::QTIMESTAMPOID || type == binary::QTIMESTAMPTZOID;
+    }
+
+    static void decode(Oid type, const char *value, Int32 len, DateTime &out)
+    {
+        if (len == 4) {
+            binary::toDateTime(binary::readInt32((const UInt8*)value) * binary::USECS_PER_DAY, out);
+        } else {
+            binary::toDateTime(binary::readInt64((const UInt8*)value), out);
+        }
+    }
+};
+
+//! Unique address per C++ row type, identifying the type checked for a result shape.
+template <class Row>
+struct PgSqlRowTag
+{
+    static const char tag;
+};
+
+template <class Row>
+const char PgSqlRowTag<Row>::tag = 0;
+
+} // namespace pgsql
+} // namespace o3d
+
+#endif // _O3D_PGSQLVALUE_H
@@ -0,0 +1,523 @@
+/**
+ * @file pgsqlbinary.cpp
+ * @brief
+ * @author Frederic SCHERMA (frederic.scherma@dreamoverflow.org)
+ * @date 2019-03-09
+ * @copyright Copyright (c) 2001-2019 Dream Overflow. All rights reserved.
+ * @details
+ */
+
+#include "o3d/pgsql/pgsqlbinary.h"
+
+#include <cmath>
+#include <limits>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define O3D_PGSQL_SWAP_X86
+    #include <immintrin.h>
+#endif
+
+using namespace o3d;
+using namespace o3d::pgsql;
+
+static void swap32Scalar(const UInt8 *src, UInt32 *dst, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] = binary::readUInt32(src + i*4);
+    }
+}
+
+static void swap64Scalar(const UInt8 *src, UInt64 *dst, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] = binary::readUInt64(src + i*8);
+    }
+}
+
+#ifdef O3D_PGSQL_SWAP_X86
+
+// unaligned loads and stores, the tail is done by the scalar version
+
+__attribute__((target("ssse3")))
+static void swap32SSSE3(const UInt8 *src, UInt32 *dst, size_t n)
+{
+    const __m128i mask = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i*4));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_shuffle_epi8(v, mask));
+    }
+
+    swap32Scalar(src + i*4, dst + i, n - i);
+}
+
+__attribute__((target("ssse3")))
+static void swap64SSSE3(const UInt8 *src, UInt64 *dst, size_t n)
+{
+    const __m128i mask = _mm_set_epi8(8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i*8));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_shuffle_epi8(v, mask));
+    }
+
+    swap64Scalar(src + i*8, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void swap32AVX2(const UInt8 *src, UInt32 *dst, size_t n)
+{
+    // the shuffle is done per 128 bits lane
+    const __m256i mask = _mm256_set_epi8(
+                12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+                12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i*4));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_shuffle_epi8(v, mask));
+    }
+
+    swap32Scalar(src + i*4, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void swap64AVX2(const UInt8 *src, UInt64 *dst, size_t n)
+{
+    const __m256i mask = _mm256_set_epi8(
+                8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7,
+                8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i*8));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_shuffle_epi8(v, mask));
+    }
+
+    swap64Scalar(src + i*8, dst + i, n - i);
+}
+
+#endif // O3D_PGSQL_SWAP_X86
+
+typedef void (*Swap32Func)(const UInt8*, UInt32*, size_t);
+typedef void (*Swap64Func)(const UInt8*, UInt64*, size_t);
+
+// selected once, at the first use
+static Swap32Func selectSwap32()
+{
+#ifdef O3D_PGSQL_SWAP_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return swap32AVX2;
+    } else if (__builtin_cpu_supports("ssse3")) {
+        return swap32SSSE3;
+    }
+#endif
+    return swap32Scalar;
+}
+
+static Swap64Func selectSwap64()
+{
+#ifdef O3D_PGSQL_SWAP_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return swap64AVX2;
+    } else if (__builtin_cpu_supports("ssse3")) {
+        return swap64SSSE3;
+    }
+#endif
+    return swap64Scalar;
+}
+
+void binary::swap32(const UInt8 *src, UInt32 *dst, size_t n)
+{
+    static const Swap32Func func = selectSwap32();
+    func(src, dst, n);
+}
+
+void binary::swap64(const UInt8 *src, UInt64 *dst, size_t n)
+{
+    static const Swap64Func func = selectSwap64();
+    func(src, dst, n);
+}
+
+Bool binary::decodeColumn32(const PGresult *res, Int32 col, Int32 first, UInt32 count, UInt32 *dst)
+{
+    if (PQfformat(res, col) != 1) {
+        return False;
+    }
+
+    // gather the values contiguously, then convert all of them at once
+    for (UInt32 i = 0; i < count; ++i) {
+        if (PQgetisnull(res, first + i, col)) {
+            dst[i] = 0;
+        } else if (PQgetlength(res, first + i, col) == 4) {
+            memcpy(dst + i, PQgetvalue(res, first + i, col), 4);
+        } else {
+            return False;
+        }
+    }
+
+    swap32((const UInt8*)dst, dst, count);
+    return True;
+}
+
+Bool binary::decodeColumn64(const PGresult *res, Int32 col, Int32 first, UInt32 count, UInt64 *dst)
+{
+    if (PQfformat(res, col) != 1) {
+        return False;
+    }
+
+    for (UInt32 i = 0; i < count; ++i) {
+        if (PQgetisnull(res, first + i, col)) {
+            dst[i] = 0;
+        } else if (PQgetlength(res, first + i, col) == 8) {
+            memcpy(dst + i, PQgetvalue(res, first + i, col), 8);
+        } else {
+            return False;
+        }
+    }
+
+    swap64((const UInt8*)dst, dst, count);
+    return True;
+}
+
+Bool binary::readArrayHeader(const UInt8 *data, UInt32 len, ArrayHeader &header)
+{
+    if (len < 12) {
+        return False;
+    }
+
+    const UInt8 *end = data + len;
+
+    Int32 ndim = readInt32(data);
+    if (ndim < 0 || len < 12 + (UInt32)ndim * 8) {
+        return False;
+    }
+
+    header.hasNull = readInt32(data + 4) != 0;
+    header.elementType = readUInt32(data + 8);
+    header.count = ndim > 0 ? 1 : 0;
+    header.end = end;
+
+    data += 12;
+
+    for (Int32 i = 0; i < ndim; ++i) {
+        Int32 size = readInt32(data);
+        if (size < 0) {
+            return False;
+        }
+
+        header.count *= (UInt32)size;
+        data += 8;  // size and lower bound
+    }
+
+    header.elements = data;
+    return True;
+}
+
+Bool binary::decodeArrayElements(const ArrayHeader &header, UInt32 size, void *out)
+{
+    const UInt8 *data = header.elements;
+    UInt8 *dst = (UInt8*)out;
+
+    // gather the values contiguously, then convert all of them at once
+    for (UInt32 i = 0; i < header.count; ++i) {
+        if (data + 4 > header.end) {
+            return False;
+        }
+
+        Int32 len = readInt32(data);
+        data += 4;
+
+        if (len < 0) {
+            memset(dst, 0, size);
+        } else if ((UInt32)len != size || data + len > header.end) {
+            return False;
+        } else {
+            memcpy(dst, data, size);
+            data += len;
+        }
+
+        dst += size;
+    }
+
+    // NULL are zero in any byte order
+    if (size == 4) {
+        swap32((const UInt8*)out, (UInt32*)out, header.count);
+    } else if (size == 8) {
+        swap64((const UInt8*)out, (UInt64*)out, header.count);
+    } else {
+        return False;
+    }
+
+    return True;
+}
+
+// binary numeric sign
+static const UInt16 NUMERIC_POS = 0x0000;
+static const UInt16 NUMERIC_NEG = 0x4000;
+static const UInt16 NUMERIC_NAN = 0xC000;
+static const UInt16 NUMERIC_PINF = 0xD000;
+static const UInt16 NUMERIC_NINF = 0xF000;
+
+static const Int64 POW10[19] = {
+    1LL, 10LL, 100LL, 1000LL, 10000LL, 100000LL, 1000000LL, 10000000LL, 100000000LL,
+    1000000000LL, 10000000000LL, 100000000000LL, 1000000000000LL, 10000000000000LL,
+    100000000000000LL, 1000000000000000LL, 10000000000000000LL, 100000000000000000LL,
+    1000000000000000000LL
+};
+
+Bool binary::decodeNumeric(const UInt8 *data, UInt32 len, UInt32 scale, Int64 &out)
+{
+    if (len < 8 || scale > 18) {
+        return False;
+    }
+
+    const Int32 ndigits = readInt16(data);
+    const Int32 weight = readInt16(data + 2);
+    const UInt16 sign = readUInt16(data + 4);
+
+    if ((sign != NUMERIC_POS && sign != NUMERIC_NEG) || ndigits < 0 || len < 8 + (UInt32)ndigits * 2) {
+        return False;
+    }
+
+    const UInt8 *digits = data + 8;
+
+    // each base 10000 digit i has a value of digit * 10^(4*(weight-i)), the result
+    // is accumulated multiplied by 10^scale, then rounded with the first dropped digit
+    UInt64 acc = 0;
+    Int32 round = 0;
+
+    for (Int32 i = 0; i < ndigits; ++i) {
+        const Int32 digit = readInt16(digits + i*2);
+        const Int32 exp = 4 * (weight - i) + (Int32)scale;   // power of 10 of the digit
+
+        if (exp >= 0) {
+            if (exp > 18) {
+                if (digit != 0) {
+                    return False;
+                }
+                continue;
+            }
+
+            const UInt64 v = (UInt64)digit * (UInt64)POW10[exp];
+            if (v / (UInt64)POW10[exp] != (UInt64)digit || v > 0x7fffffffffffffffULL - acc) {
+                return False;
+            }
+
+            acc += v;
+        } else if (exp > -4) {
+            // digit partially below the scale
+            acc += digit / POW10[-exp];
+            round = (digit / POW10[-exp - 1]) % 10;
+            break;
+        } else {
+            if (exp == -4) {
+                round = digit / 1000;
+            }
+            break;
+        }
+    }
+
+    if (round >= 5) {
+        if (acc == 0x7fffffffffffffffULL) {
+            return False;
+        }
+        ++acc;
+    }
+
+    out = sign == NUMERIC_NEG ? -(Int64)acc : (Int64)acc;
+    return True;
+}
+
+Double binary::decodeNumeric(const UInt8 *data, UInt32 len)
+{
+    if (len < 8) {
+        return 0.0;
+    }
+
+    const Int32 ndigits = readInt16(data);
+    const Int32 weight = readInt16(data + 2);
+    const UInt16 sign = readUInt16(data + 4);
+
+    if (sign == NUMERIC_NAN) {
+        return std::numeric_limits<Double>::quiet_NaN();
+    } else if (sign == NUMERIC_PINF) {
+        return std::numeric_limits<Double>::infinity();
+    } else if (sign == NUMERIC_NINF) {
+        return -std::numeric_limits<Double>::infinity();
+    }
+
+    if (ndigits <= 0 || len < 8 + (UInt32)ndigits * 2) {
+        return 0.0;
+    }
+
+    const UInt8 *digits = data + 8;
+
+    // the trailing zero digits are not significant
+    Int32 n = ndigits;
+    while (n > 0 && readInt16(digits + (n-1)*2) == 0) {
+        --n;
+    }
+
+    if (n == 0) {
+        return sign == NUMERIC_NEG ? -0.0 : 0.0;
+    }
+
+    // value of acc * 10^exp
+    Int32 exp = 4 * (weight - n + 1);
+
+    // up to 4 base 10000 digits are exact in an integer. If it is also exact in a
+    // double, as the power of 10, there is a single rounding at the multiply or divide
+    if (n <= 4) {
+        UInt64 acc = 0;
+        for (Int32 i = 0; i < n; ++i) {
+            acc = acc * 10000 + readInt16(digits + i*2);
+        }
+
+        while (acc % 10 == 0) {
+            acc /= 10;
+            ++exp;
+        }
+
+        static const Double EXACT_POW10[23] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+
+        if (acc <= (1ULL << 53) && exp >= -22 && exp <= 22) {
+            const Double v = exp >= 0 ? (Double)acc * EXACT_POW10[exp] : (Double)acc / EXACT_POW10[-exp];
+            return sign == NUMERIC_NEG ? -v : v;
+        }
+    }
+
+    // else the correctly rounded conversion of the decimal digits
+    std::string text;
+    text.reserve(n * 4 + 16);
+
+    if (sign == NUMERIC_NEG) {
+        text += '-';
+    }
+
+    char group[16];
+    for (Int32 i = 0; i < n; ++i) {
+        snprintf(group, sizeof(group), "%04d", (Int32)readInt16(digits + i*2));
+        text += group;
+    }
+
+    snprintf(group, sizeof(group), "e%d", 4 * (weight - n + 1));
+    text += group;
+
+    return strtod(text.c_str(), nullptr);
+}
+
+UInt32 binary::encodeNumeric(Int64 v, UInt32 scale, UInt8 *out)
+{
+    if (scale > 18) {
+        scale = 18;
+    }
+
+    UInt64 abs = v < 0 ? (UInt64)0 - (UInt64)v : (UInt64)v;
+
+    // decimal digits, least significant first, with the decimal point at scale
+    UInt8 dec[40] = {0};
+    Int32 numDec = 0;
+
+    while (abs > 0) {
+        dec[numDec++] = abs % 10;
+        abs /= 10;
+    }
+
+    // base 10000 digits are aligned on the decimal point: group g covers the decimal
+    // digits of power 4*g to 4*g+3, relative to the point
+    const Int32 lowGroup = -(((Int32)scale + 3) / 4);
+    const Int32 highGroup = numDec > (Int32)scale ? (numDec - (Int32)scale - 1) / 4 : -1;
+
+    Int16 groups[12];
+    Int32 numGroups = 0;
+
+    for (Int32 g = highGroup; g >= lowGroup; --g) {
+        Int32 digit = 0;
+        for (Int32 k = 3; k >= 0; --k) {
+            Int32 pos = 4 * g + k + (Int32)scale;  // index in dec
+            digit = digit * 10 + (pos >= 0 && pos < numDec ? dec[pos] : 0);
+        }
+        groups[numGroups++] = (Int16)digit;
+    }
+
+    // strip the leading and trailing zero digits
+    Int32 first = 0;
+    while (first < numGroups && groups[first] == 0) {
+        ++first;
+    }
+
+    Int32 last = numGroups;
+    while (last > first && groups[last-1] == 0) {
+        --last;
+    }
+
+    const Int32 ndigits = last - first;
+    const Int32 weight = ndigits > 0 ? highGroup - first : 0;
+
+    writeInt16(out, (Int16)ndigits);
+    writeInt16(out + 2, (Int16)weight);
+    writeUInt16(out + 4, v < 0 && ndigits > 0 ? NUMERIC_NEG : NUMERIC_POS);
+    writeInt16(out + 6, (Int16)scale);
+
+    for (Int32 i = 0; i < ndigits; ++i) {
+        writeInt16(out + 8 + i*2, groups[first + i]);
+    }
+
+    return 8 + ndigits * 2;
+}
+
+UInt32 binary::encodeNumeric(Double v, UInt8 *out)
+{
+    if (v != v || v == std::numeric_limits<Double>::infinity() || v == -std::numeric_limits<Double>::infinity()) {
+        writeInt16(out, 0);
+        writeInt16(out + 2, 0);
+        writeUInt16(out + 4, v != v ? NUMERIC_NAN : (v > 0 ? NUMERIC_PINF : NUMERIC_NINF));
+        writeInt16(out + 6, 0);
+
+        return 8;
+    }
+
+    // the smallest scale whose decimal value reads back as the same double
+    for (UInt32 scale = 0; scale <= 18; ++scale) {
+        const Double t = v * (Double)POW10[scale];
+        if (t >= 9.2e18 || t <= -9.2e18) {
+            break;
+        }
+
+        const Int64 fixed = std::llround(t);
+        if ((Double)fixed / (Double)POW10[scale] == v) {
+            return encodeNumeric(fixed, scale, out);
+        }
+    }
+
+    return 0;
+}
+
+UInt32 binary::formatNumeric(Int64 v, UInt32 scale, Char *out, UInt32 size)
+{
+    if (scale > 18) {
+        scale = 18;
+    }
+
+    const UInt64 abs = v < 0 ? (UInt64)0 - (UInt64)v : (UInt64)v;
+    const UInt64 unit = (UInt64)POW10[scale];
+
+    Int32 len;
+    if (scale > 0) {
+        len = snprintf(out, size, "%s%llu.%0*llu", v < 0 ? "-" : "",
+                       (unsigned long long)(abs / unit), (int)scale, (unsigned long long)(abs % unit));
+    } else {
+        len = snprintf(out, size, "%s%llu", v < 0 ? "-" : "", (unsigned long long)abs);
+    }
+
+    return len > 0 ? ((UInt32)len < size ? (UInt32)len : size - 1) : 0;
+}
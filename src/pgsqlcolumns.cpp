@@ -0,0 +1,266 @@
+/**
+ * @file pgsqlcolumns.cpp
+ * @brief
+ * @author Frederic SCHERMA (frederic.scherma@dreamoverflow.org)
+ * @date 2019-03-09
+ * @copyright Copyright (c) 2001-2019 Dream Overflow. All rights reserved.
+ * @details
+ */
+
+#include "o3d/pgsql/pgsqlcolumns.h"
+#include "o3d/pgsql/pgsqlbinary.h"
+
+#include <o3d/core/error.h>
+
+using namespace o3d;
+using namespace o3d::pgsql;
+
+PgSqlColumns::PgSqlColumns() :
+    m_numRows(0)
+{
+
+}
+
+void PgSqlColumns::clear()
+{
+    for (Column &c : m_columns) {
+        c.numNulls = 0;
+
+        c.nulls.clear();
+        c.int32s.clear();
+        c.int64s.clear();
+        c.doubles.clear();
+        c.bytes.clear();
+
+        c.offsets.clear();
+        c.offsets.push_back(0);
+    }
+
+    m_numRows = 0;
+}
+
+const PgSqlColumns::Column &PgSqlColumns::column(UInt32 col) const
+{
+    if (col >= m_columns.size()) {
+        O3D_ERROR(E_IndexOutOfRange("Column id"));
+    }
+
+    return m_columns[col];
+}
+
+const PgSqlColumns::Column &PgSqlColumns::column(UInt32 col, Storage storage) const
+{
+    const Column &c = column(col);
+    if (c.storage != storage) {
+        O3D_ERROR(E_InvalidParameter("Column storage mismatch"));
+    }
+
+    return c;
+}
+
+const Int32 *PgSqlColumns::getInt32s(UInt32 col) const
+{
+    return column(col, STORAGE_INT32).int32s.data();
+}
+
+const Int64 *PgSqlColumns::getInt64s(UInt32 col) const
+{
+    return column(col, STORAGE_INT64).int64s.data();
+}
+
+const Double *PgSqlColumns::getDoubles(UInt32 col) const
+{
+    return column(col, STORAGE_DOUBLE).doubles.data();
+}
+
+const UInt32 *PgSqlColumns::getOffsets(UInt32 col) const
+{
+    return column(col, STORAGE_BYTES).offsets.data();
+}
+
+const UInt8 *PgSqlColumns::getBytes(UInt32 col) const
+{
+    return column(col, STORAGE_BYTES).bytes.data();
+}
+
+const UInt8 *PgSqlColumns::getBytes(UInt32 col, UInt32 row, UInt32 &len) const
+{
+    const Column &c = column(col, STORAGE_BYTES);
+    if (row >= m_numRows) {
+        O3D_ERROR(E_IndexOutOfRange("Row number"));
+    }
+
+    len = c.offsets[row+1] - c.offsets[row];
+    return c.bytes.data() + c.offsets[row];
+}
+
+PgSqlColumns::Storage PgSqlColumns::storageOf(Oid type)
+{
+    switch (type) {
+    case binary::QBOOLOID:
+    case binary::QINT2OID:
+    case binary::QINT4OID:
+    case binary::QDATEOID:
+        return STORAGE_INT32;
+    case binary::QINT8OID:
+    case binary::QTIMEOID:
+    case binary::QTIMESTAMPOID:
+    case binary::QTIMESTAMPTZOID:
+        return STORAGE_INT64;
+    case binary::QFLOAT4OID:
+    case binary::QFLOAT8OID:
+    case binary::QNUMERICOID:
+        return STORAGE_DOUBLE;
+    default:
+        return STORAGE_BYTES;
+    }
+}
+
+Bool PgSqlColumns::setup(const PGresult *res)
+{
+    UInt32 numCols = PQnfields(res);
+
+    if (numCols == m_columns.size()) {
+        UInt32 i = 0;
+        while (i < numCols && m_columns[i].type == PQftype(res, i) &&
+               m_columns[i].name == CString(PQfname(res, i))) {
+            ++i;
+        }
+
+        if (i == numCols) {
+            return False;
+        }
+    }
+
+    m_columns.resize(numCols);
+
+    for (UInt32 i = 0; i < numCols; ++i) {
+        Column &c = m_columns[i];
+        c.name = PQfname(res, i);
+        c.type = PQftype(res, i);
+        c.storage = storageOf(c.type);
+    }
+
+    clear();
+    return True;
+}
+
+void PgSqlColumns::append(const PGresult *res, UInt32 first, UInt32 count)
+{
+    if ((UInt32)PQnfields(res) != m_columns.size()) {
+        O3D_ERROR(E_InvalidParameter("Result fields don't match the columns"));
+    }
+
+    const UInt32 numRows = m_numRows + count;
+    const UInt32 last = first + count;
+
+    // column by column, each output array is written sequentially
+    for (UInt32 i = 0; i < m_columns.size(); ++i) {
+        Column &c = m_columns[i];
+
+        c.nulls.resize((numRows + 7) >> 3, 0);
+        UInt32 out = m_numRows;
+
+        for (UInt32 row = first; row < last; ++row, ++out) {
+            if (PQgetisnull(res, row, i)) {
+                c.nulls[out >> 3] |= 1 << (out & 7);
+                ++c.numNulls;
+            }
+        }
+
+        out = m_numRows;
+
+        // the typed storages decode the binary format only
+        if (c.storage != STORAGE_BYTES && PQfformat(res, i) != 1) {
+            O3D_ERROR(E_InvalidFormat("Column of a text format result"));
+        }
+
+        switch (c.storage) {
+        case STORAGE_INT32:
+            c.int32s.resize(numRows);
+
+            if (c.type == binary::QINT4OID || c.type == binary::QDATEOID) {
+                if (!binary::decodeColumn32(res, i, first, count, (UInt32*)c.int32s.data() + out)) {
+                    O3D_ERROR(E_InvalidFormat("Invalid binary 32 bits value"));
+                }
+            } else {
+                Int32 *values = c.int32s.data();
+                const Int32 size = c.type == binary::QBOOLOID ? 1 : 2;
+
+                for (UInt32 row = first; row < last; ++row, ++out) {
+                    const UInt8 *data = (const UInt8*)PQgetvalue(res, row, i);
+
+                    if (PQgetisnull(res, row, i)) {
+                        values[out] = 0;
+                    } else if (PQgetlength(res, row, i) != size) {
+                        O3D_ERROR(E_InvalidFormat("Invalid binary bool or 16 bits value"));
+                    } else if (c.type == binary::QBOOLOID) {
+                        values[out] = data[0];
+                    } else {
+                        values[out] = binary::readInt16(data);
+                    }
+                }
+            }
+            break;
+        case STORAGE_INT64:
+            c.int64s.resize(numRows);
+
+            if (!binary::decodeColumn64(res, i, first, count, (UInt64*)c.int64s.data() + out)) {
+                O3D_ERROR(E_InvalidFormat("Invalid binary 64 bits value"));
+            }
+            break;
+        case STORAGE_DOUBLE:
+            c.doubles.resize(numRows);
+
+            if (c.type == binary::QFLOAT8OID) {
+                if (!binary::decodeColumn64(res, i, first, count, (UInt64*)c.doubles.data() + out)) {
+                    O3D_ERROR(E_InvalidFormat("Invalid binary 64 bits value"));
+                }
+            } else {
+                Double *values = c.doubles.data();
+
+                for (UInt32 row = first; row < last; ++row, ++out) {
+                    const UInt8 *data = (const UInt8*)PQgetvalue(res, row, i);
+
+                    if (PQgetisnull(res, row, i)) {
+                        values[out] = 0;
+                    } else if (c.type == binary::QNUMERICOID) {
+                        values[out] = binary::decodeNumeric(data, PQgetlength(res, row, i));
+                    } else if (PQgetlength(res, row, i) != 4) {
+                        O3D_ERROR(E_InvalidFormat("Invalid binary 32 bits value"));
+                    } else {
+                        values[out] = binary::readFloat(data);
+                    }
+                }
+            }
+            break;
+        case STORAGE_BYTES:
+        {
+            // size the data buffer once for the whole range
+            size_t size = c.bytes.size();
+            for (UInt32 row = first; row < last; ++row) {
+                size += PQgetlength(res, row, i);
+            }
+
+            size_t pos = c.bytes.size();
+            c.bytes.resize(size);
+            c.offsets.resize(numRows + 1);
+
+            for (UInt32 row = first; row < last; ++row, ++out) {
+                if (!PQgetisnull(res, row, i)) {
+                    UInt32 len = PQgetlength(res, row, i);
+                    memcpy(c.bytes.data() + pos, PQgetvalue(res, row, i), len);
+                    pos += len;
+                }
+
+                c.offsets[out+1] = (UInt32)pos;
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    m_numRows = numRows;
+}
@@ -0,0 +1,368 @@
+/**
+ * @file pgsqlcopyreader.cpp
+ * @brief
+ * @author Frederic SCHERMA (frederic.scherma@dreamoverflow.org)
+ * @date 2019-03-09
+ * @copyright Copyright (c) 2001-2019 Dream Overflow. All rights reserved.
+ * @details
+ */
+
+#include "o3d/pgsql/pgsqlcopyreader.h"
+#include "o3d/pgsql/pgsqldb.h"
+#include "o3d/pgsql/pgsqlexception.h"
+#include "o3d/pgsql/pgsqlbinary.h"
+
+using namespace o3d;
+using namespace o3d::pgsql;
+
+// binary copy signature length, followed by the flags and header extension length
+static const Int32 COPY_SIGNATURE_SIZE = 11;
+
+PgSqlCopyReader::PgSqlCopyReader(PgSqlDb *db, const CString &query) :
+    m_db(db),
+    m_pDB(db->m_pDB),
+    m_numCols(0),
+    m_numRows(0),
+    m_active(False),
+    m_header(False),
+    m_pData(nullptr)
+{
+    // describe the query with the unnamed statement to get the columns
+    PGresult *res = PQprepare(m_pDB, "", query.getData(), 0, nullptr);
+
+    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+        PQclear(res);
+        throwError();
+    }
+
+    PQclear(res);
+
+    res = PQdescribePrepared(m_pDB, "");
+
+    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+        PQclear(res);
+        throwError();
+    }
+
+    m_numCols = PQnfields(res);
+    m_types.resize(m_numCols);
+
+    for (UInt32 i = 0; i < m_numCols; ++i) {
+        m_types[i] = PQftype(res, i);
+
+        char *fname = PQfname(res, i);
+        if (fname) {
+            m_outputNames.insert(fname, i);
+        }
+    }
+
+    PQclear(res);
+
+    m_values.assign(m_numCols, nullptr);
+    m_lengths.assign(m_numCols, -1);
+
+    std::string sql = std::string("COPY (") + query.getData() + ") TO STDOUT (FORMAT binary)";
+    res = PQexec(m_pDB, sql.c_str());
+
+    if (PQresultStatus(res) != PGRES_COPY_OUT) {
+        PQclear(res);
+        throwError();
+    }
+
+    PQclear(res);
+    m_active = True;
+
+    // refuse the other executions on the connection until the end
+    m_db->m_copyReader = this;
+}
+
+PgSqlCopyReader::~PgSqlCopyReader()
+{
+    cancel();
+}
+
+void PgSqlCopyReader::cancel()
+{
+    if (m_pData) {
+        PQfreemem(m_pData);
+        m_pData = nullptr;
+    }
+
+    if (m_active && m_pDB) {
+        // don't receive the remaining rows
+        PGcancel *pCancel = PQgetCancel(m_pDB);
+        if (pCancel) {
+            char errbuf[256];
+            PQcancel(pCancel, errbuf, sizeof(errbuf));
+            PQfreeCancel(pCancel);
+        }
+
+        char *data = nullptr;
+        while (PQgetCopyData(m_pDB, &data, 0) > 0) {
+            PQfreemem(data);
+        }
+
+        PGresult *res;
+        while ((res = PQgetResult(m_pDB)) != nullptr) {
+            PQclear(res);
+        }
+
+        release();
+    }
+}
+
+void PgSqlCopyReader::release()
+{
+    m_active = False;
+
+    if (m_db && m_db->m_copyReader == this) {
+        m_db->m_copyReader = nullptr;
+    }
+}
+
+Bool PgSqlCopyReader::fetch()
+{
+    while (m_active) {
+        if (m_pData) {
+            PQfreemem(m_pData);
+            m_pData = nullptr;
+        }
+
+        // one row per copy data
+        Int32 size = PQgetCopyData(m_pDB, &m_pData, 0);
+
+        if (size == -1) {
+            finish();
+            return False;
+        } else if (size < 0) {
+            release();
+            throwError();
+        }
+
+        const UInt8 *data = (const UInt8*)m_pData;
+        const UInt8 *end = data + size;
+
+        // the header is sent with the first row
+        if (!m_header) {
+            if (size < COPY_SIGNATURE_SIZE + 8) {
+                O3D_ERROR(E_InvalidFormat("Invalid binary copy header"));
+            }
+
+            data += COPY_SIGNATURE_SIZE + 4;
+            data += 4 + binary::readUInt32(data);
+
+            m_header = True;
+        }
+
+        if (data + 2 > end) {
+            O3D_ERROR(E_InvalidFormat("Truncated binary copy row"));
+        }
+
+        Int16 numFields = binary::readInt16(data);
+        data += 2;
+
+        // trailer
+        if (numFields == -1) {
+            continue;
+        }
+
+        if ((UInt32)numFields != m_numCols) {
+            O3D_ERROR(E_InvalidFormat("Unexpected number of columns in binary copy row"));
+        }
+
+        for (UInt32 i = 0; i < m_numCols; ++i) {
+            if (data + 4 > end) {
+                O3D_ERROR(E_InvalidFormat("Truncated binary copy row"));
+            }
+
+            Int32 len = binary::readInt32(data);
+            data += 4;
+
+            m_lengths[i] = len;
+
+            if (len >= 0) {
+                if (data + len > end) {
+                    O3D_ERROR(E_InvalidFormat("Truncated binary copy row"));
+                }
+
+                m_values[i] = data;
+                data += len;
+            } else {
+                m_values[i] = nullptr;
+            }
+        }
+
+        ++m_numRows;
+        return True;
+    }
+
+    return False;
+}
+
+UInt32 PgSqlCopyReader::getOutAttr(const CString &name) const
+{
+    Int32 attr = m_outputNames.find(name.getData(), name.length());
+    if (attr >= 0) {
+        return (UInt32)attr;
+    } else {
+        O3D_ERROR(E_InvalidParameter(o3d::String("Unknown output attribute name ") + name));
+    }
+}
+
+Oid PgSqlCopyReader::getType(UInt32 attr) const
+{
+    if (attr >= m_numCols) {
+        O3D_ERROR(E_IndexOutOfRange("Output attribute is out of range"));
+    }
+
+    return m_types[attr];
+}
+
+Bool PgSqlCopyReader::isNull(UInt32 attr) const
+{
+    if (attr >= m_numCols) {
+        O3D_ERROR(E_IndexOutOfRange("Output attribute is out of range"));
+    }
+
+    return m_lengths[attr] < 0;
+}
+
+const UInt8 *PgSqlCopyReader::getData(UInt32 attr, UInt32 &len) const
+{
+    if (attr >= m_numCols) {
+        O3D_ERROR(E_IndexOutOfRange("Output attribute is out of range"));
+    }
+
+    len = m_lengths[attr] > 0 ? (UInt32)m_lengths[attr] : 0;
+    return m_values[attr];
+}
+
+const UInt8 *PgSqlCopyReader::value(UInt32 attr) const
+{
+    if (attr >= m_numCols) {
+        O3D_ERROR(E_IndexOutOfRange("Output attribute is out of range"));
+    }
+
+    if (m_lengths[attr] < 0) {
+        O3D_ERROR(E_InvalidOperation("Output attribute is NULL"));
+    }
+
+    return m_values[attr];
+}
+
+Bool PgSqlCopyReader::asBool(UInt32 attr) const
+{
+    return asInt64(attr) != 0;
+}
+
+Int32 PgSqlCopyReader::asInt32(UInt32 attr) const
+{
+    return (Int32)asInt64(attr);
+}
+
+Int64 PgSqlCopyReader::asInt64(UInt32 attr) const
+{
+    const UInt8 *data = value(attr);
+
+    switch (m_types[attr]) {
+    case binary::QBOOLOID:
+        return data[0];
+    case binary::QINT2OID:
+        return binary::readInt16(data);
+    case binary::QINT4OID:
+    case binary::QDATEOID:
+        return binary::readInt32(data);
+    case binary::QINT8OID:
+    case binary::QTIMESTAMPOID:
+    case binary::QTIMESTAMPTZOID:
+        return binary::readInt64(data);
+    case binary::QFLOAT4OID:
+        return (Int64)binary::readFloat(data);
+    case binary::QFLOAT8OID:
+        return (Int64)binary::readDouble(data);
+    default:
+        O3D_ERROR(E_InvalidParameter("Output attribute is not an integer"));
+    }
+}
+
+Float PgSqlCopyReader::asFloat(UInt32 attr) const
+{
+    return (Float)asDouble(attr);
+}
+
+Double PgSqlCopyReader::asDouble(UInt32 attr) const
+{
+    const UInt8 *data = value(attr);
+
+    switch (m_types[attr]) {
+    case binary::QFLOAT4OID:
+        return binary::readFloat(data);
+    case binary::QFLOAT8OID:
+        return binary::readDouble(data);
+    case binary::QNUMERICOID:
+        return binary::decodeNumeric(data, m_lengths[attr]);
+    default:
+        return (Double)asInt64(attr);
+    }
+}
+
+CString PgSqlCopyReader::asCString(UInt32 attr) const
+{
+    const UInt8 *data = value(attr);
+    return CString((const Char*)data, m_lengths[attr]);
+}
+
+Date PgSqlCopyReader::asDate(UInt32 attr) const
+{
+    Int64 usecs;
+    if (!binary::decodeTimestamp(m_types[attr], value(attr), usecs)) {
+        O3D_ERROR(E_InvalidParameter("Output attribute is not a date or a time"));
+    }
+
+    Date date;
+    binary::toDate(usecs, date);
+    return date;
+}
+
+DateTime PgSqlCopyReader::asDateTime(UInt32 attr) const
+{
+    Int64 usecs;
+    if (!binary::decodeTimestamp(m_types[attr], value(attr), usecs)) {
+        O3D_ERROR(E_InvalidParameter("Output attribute is not a date or a time"));
+    }
+
+    DateTime date;
+    binary::toDateTime(usecs, date);
+    return date;
+}
+
+void PgSqlCopyReader::finish()
+{
+    release();
+
+    PGresult *res = PQgetResult(m_pDB);
+    ExecStatusType status = PQresultStatus(res);
+
+    o3d::String msg;
+    if (status != PGRES_COMMAND_OK) {
+        msg.fromUtf8(PQresultErrorMessage(res));
+    }
+
+    PQclear(res);
+
+    while ((res = PQgetResult(m_pDB)) != nullptr) {
+        PQclear(res);
+    }
+
+    if (status != PGRES_COMMAND_OK) {
+        O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
+    }
+}
+
+void PgSqlCopyReader::throwError()
+{
+    o3d::String msg;
+    msg.fromUtf8(PQerrorMessage(m_pDB));
+
+    O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
+}
@@ -0,0 +1,426 @@
+/**
+ * @file pgsqlcopywriter.cpp
+ * @brief
+ * @author Frederic SCHERMA (frederic.scherma@dreamoverflow.org)
+ * @date 2019-03-09
+ * @copyright Copyright (c) 2001-2019 Dream Overflow. All rights reserved.
+ * @details
+ */
+
+#include "o3d/pgsql/pgsqlcopywriter.h"
+#include "o3d/pgsql/pgsqldb.h"
+#include "o3d/pgsql/pgsqlexception.h"
+#include "o3d/pgsql/pgsqlbinary.h"
+
+#include <cmath>
+#include <stdio.h>
+
+using namespace o3d;
+using namespace o3d::pgsql;
+
+// binary copy signature, flags and header extension length
+static const UInt8 COPY_HEADER[19] = {
+    'P', 'G', 'C', 'O', 'P', 'Y', '\n', 0xff, '\r', '\n', 0,
+    0, 0, 0, 0,
+    0, 0, 0, 0
+};
+
+// max size of a number formatted as text
+static const UInt32 TEXT_NUMBER_SIZE = 32;
+
+PgSqlCopyWriter::PgSqlCopyWriter(
+        PgSqlDb *db,
+        const CString &table,
+        const std::vector<CString> &columns,
+        UInt32 bufferSize) :
+    m_db(db),
+    m_pDB(db->m_pDB),
+    m_numCols((UInt32)columns.size()),
+    m_numRows(0),
+    m_bufferSize(bufferSize > 0 ? bufferSize : DEFAULT_BUFFER_SIZE),
+    m_active(False)
+{
+    if (columns.empty()) {
+        O3D_ERROR(E_InvalidParameter("At least one column must be copied"));
+    }
+
+    std::string cols;
+    for (size_t i = 0; i < columns.size(); ++i) {
+        if (i > 0) {
+            cols += ',';
+        }
+        cols += columns[i].getData();
+    }
+
+    // the columns types are needed to encode the values
+    std::string sql = std::string("SELECT ") + cols + " FROM " + table.getData() + " WHERE false";
+    PGresult *res = PQexecParams(m_pDB, sql.c_str(), 0, nullptr, nullptr, nullptr, nullptr, 1);
+
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        PQclear(res);
+        throwError();
+    }
+
+    m_types.resize(m_numCols);
+    for (UInt32 i = 0; i < m_numCols; ++i) {
+        m_types[i] = PQftype(res, i);
+    }
+
+    PQclear(res);
+
+    sql = std::string("COPY ") + table.getData() + " (" + cols + ") FROM STDIN (FORMAT binary)";
+    res = PQexec(m_pDB, sql.c_str());
+
+    if (PQresultStatus(res) != PGRES_COPY_IN) {
+        PQclear(res);
+        throwError();
+    }
+
+    PQclear(res);
+    m_active = True;
+
+    // refuse the other executions on the connection until the end
+    m_db->m_copyWriter = this;
+
+    m_lengths.assign(m_numCols, -1);
+    m_fields.resize(m_numCols);
+
+    m_buffer.reserve(m_bufferSize + 1024);
+    m_buffer.insert(m_buffer.end(), COPY_HEADER, COPY_HEADER + sizeof(COPY_HEADER));
+}
+
+PgSqlCopyWriter::~PgSqlCopyWriter()
+{
+    if (m_active && m_pDB) {
+        PQputCopyEnd(m_pDB, "Copy writer deleted before its end");
+
+        PGresult *res;
+        while ((res = PQgetResult(m_pDB)) != nullptr) {
+            PQclear(res);
+        }
+
+        release();
+    }
+}
+
+void PgSqlCopyWriter::release()
+{
+    m_active = False;
+
+    if (m_db && m_db->m_copyWriter == this) {
+        m_db->m_copyWriter = nullptr;
+    }
+}
+
+UInt8 *PgSqlCopyWriter::field(UInt32 attr, UInt32 len)
+{
+    if (attr >= m_numCols) {
+        O3D_ERROR(E_IndexOutOfRange("Column id"));
+    }
+
+    // only grow, the capacity is kept for the next rows
+    std::vector<UInt8> &field = m_fields[attr];
+    if (field.size() < len) {
+        field.resize(len);
+    }
+
+    m_lengths[attr] = (Int32)len;
+    return field.data();
+}
+
+void PgSqlCopyWriter::setNull(UInt32 attr)
+{
+    if (attr >= m_numCols) {
+        O3D_ERROR(E_IndexOutOfRange("Column id"));
+    }
+
+    m_lengths[attr] = -1;
+}
+
+// Column types encoded from an integer or a real
+static Bool isNumber(Oid type)
+{
+    switch (type) {
+    case binary::QBOOLOID:
+    case binary::QINT2OID:
+    case binary::QINT4OID:
+    case binary::QOIDOID:
+    case binary::QINT8OID:
+    case binary::QNUMERICOID:
+    case binary::QFLOAT4OID:
+    case binary::QFLOAT8OID:
+        return True;
+    default:
+        return False;
+    }
+}
+
+void PgSqlCopyWriter::setInteger(UInt32 attr, Int64 v, Bool isUnsigned)
+{
+    UInt8 *data = field(attr, TEXT_NUMBER_SIZE);
+    UInt32 len = binary::encodeInteger(m_types[attr], v, data, isUnsigned);
+
+    // a binary copy is not checked by the server, a value out of range is refused here
+    if (!len) {
+        if (isNumber(m_types[attr])) {
+            O3D_ERROR(E_InvalidParameter("Integer out of the range of the column type"));
+        } else if (!binary::isTextual(m_types[attr])) {
+            O3D_ERROR(E_InvalidParameter("Unsupported column type for an integer"));
+        }
+
+        if (isUnsigned) {
+            len = snprintf((Char*)data, TEXT_NUMBER_SIZE, "%llu", (unsigned long long)v);
+        } else {
+            len = snprintf((Char*)data, TEXT_NUMBER_SIZE, "%lli", (long long)v);
+        }
+    }
+
+    m_lengths[attr] = (Int32)len;
+}
+
+void PgSqlCopyWriter::setReal(UInt32 attr, Double v, Bool isFloat)
+{
+    UInt8 *data = field(attr, TEXT_NUMBER_SIZE);
+    UInt32 len = binary::encodeReal(m_types[attr], v, data);
+
+    if (!len) {
+        if (m_types[attr] == binary::QNUMERICOID) {
+            O3D_ERROR(E_InvalidParameter("Real out of the range of a fixed point numeric"));
+        } else if (isNumber(m_types[attr])) {
+            O3D_ERROR(E_InvalidParameter("Real out of the range of the column type, or not integral"));
+        } else if (!binary::isTextual(m_types[attr])) {
+            O3D_ERROR(E_InvalidParameter("Unsupported column type for a real"));
+        }
+
+        len = snprintf((Char*)data, TEXT_NUMBER_SIZE, isFloat ? "%.9g" : "%.17g", v);
+    }
+
+    m_lengths[attr] = (Int32)len;
+}
+
+void PgSqlCopyWriter::setNumeric(UInt32 attr, Int64 v, UInt32 scale)
+{
+    if (scale > 18) {
+        O3D_ERROR(E_InvalidParameter("Numeric scale must be at most 18"));
+    }
+
+    UInt8 *data = field(attr, TEXT_NUMBER_SIZE);
+    const Oid type = m_types[attr];
+    UInt32 len;
+
+    if (type == binary::QNUMERICOID) {
+        len = binary::encodeNumeric(v, scale, data);
+    } else if (binary::isTextual(type)) {
+        len = binary::formatNumeric(v, scale, (Char*)data, TEXT_NUMBER_SIZE);
+    } else if (type == binary::QFLOAT4OID || type == binary::QFLOAT8OID) {
+        len = binary::encodeReal(type, (Double)v / std::pow(10.0, (Double)scale), data);
+        if (!len) {
+            O3D_ERROR(E_InvalidParameter("Numeric out of the range of the column type"));
+        }
+    } else {
+        O3D_ERROR(E_InvalidParameter("Unsupported column type for a numeric"));
+    }
+
+    m_lengths[attr] = (Int32)len;
+}
+
+void PgSqlCopyWriter::setBytes(UInt32 attr, const UInt8 *v, UInt32 len)
+{
+    UInt8 *data = field(attr, len);
+    memcpy(data, v, len);
+}
+
+void PgSqlCopyWriter::setTime(UInt32 attr, Int64 usecs)
+{
+    UInt8 *data = field(attr, 8);
+    UInt32 len = binary::encodeTimestamp(m_types[attr], usecs, data);
+
+    if (!len) {
+        O3D_ERROR(E_InvalidParameter("Unsupported column type for a date"));
+    }
+
+    m_lengths[attr] = (Int32)len;
+}
+
+void PgSqlCopyWriter::setArrayUInt8(UInt32 attr, const ArrayUInt8 &v)
+{
+    setBytes(attr, v.getData(), v.getSize());
+}
+
+void PgSqlCopyWriter::setSmartArrayUInt8(UInt32 attr, const SmartArrayUInt8 &v)
+{
+    setBytes(attr, v.getData(), v.getSizeInBytes());
+}
+
+void PgSqlCopyWriter::setBool(UInt32 attr, Bool v)
+{
+    setInteger(attr, v ? 1 : 0, False);
+}
+
+void PgSqlCopyWriter::setInt32(UInt32 attr, Int32 v)
+{
+    setInteger(attr, v, False);
+}
+
+void PgSqlCopyWriter::setUInt32(UInt32 attr, UInt32 v)
+{
+    setInteger(attr, v, True);
+}
+
+void PgSqlCopyWriter::setInt64(UInt32 attr, Int64 v)
+{
+    setInteger(attr, v, False);
+}
+
+void PgSqlCopyWriter::setUInt64(UInt32 attr, UInt64 v)
+{
+    setInteger(attr, (Int64)v, True);
+}
+
+void PgSqlCopyWriter::setFloat(UInt32 attr, Float v)
+{
+    setReal(attr, v, True);
+}
+
+void PgSqlCopyWriter::setDouble(UInt32 attr, Double v)
+{
+    setReal(attr, v, False);
+}
+
+void PgSqlCopyWriter::setCString(UInt32 attr, const CString &v)
+{
+    // text and bytea binary formats are the raw bytes
+    if (attr < m_numCols && !binary::isTextual(m_types[attr]) && m_types[attr] != binary::QBYTEAOID) {
+        O3D_ERROR(E_InvalidParameter("Unsupported column type for a string"));
+    }
+
+    setBytes(attr, (const UInt8*)v.getData(), v.length());
+}
+
+void PgSqlCopyWriter::setDate(UInt32 attr, const Date &date)
+{
+    setTime(attr, binary::fromDate(date));
+}
+
+void PgSqlCopyWriter::setTimestamp(UInt32 attr, const DateTime &date)
+{
+    setTime(attr, binary::fromDateTime(date));
+}
+
+void PgSqlCopyWriter::writeRow()
+{
+    if (!m_active) {
+        O3D_ERROR(E_InvalidOperation("The copy is terminated"));
+    }
+
+    UInt32 rowSize = 2 + m_numCols * 4;
+    for (UInt32 i = 0; i < m_numCols; ++i) {
+        if (m_lengths[i] > 0) {
+            rowSize += m_lengths[i];
+        }
+    }
+
+    size_t pos = m_buffer.size();
+    m_buffer.resize(pos + rowSize);
+
+    UInt8 *out = m_buffer.data() + pos;
+
+    binary::writeInt16(out, (Int16)m_numCols);
+    out += 2;
+
+    for (UInt32 i = 0; i < m_numCols; ++i) {
+        binary::writeInt32(out, m_lengths[i]);
+        out += 4;
+
+        if (m_lengths[i] > 0) {
+            memcpy(out, m_fields[i].data(), m_lengths[i]);
+            out += m_lengths[i];
+        }
+
+        m_lengths[i] = -1;
+    }
+
+    ++m_numRows;
+
+    if (m_buffer.size() >= m_bufferSize) {
+        flush();
+    }
+}
+
+void PgSqlCopyWriter::flush()
+{
+    if (m_active && !m_buffer.empty()) {
+        putData(m_buffer.data(), (UInt32)m_buffer.size());
+        m_buffer.clear();
+    }
+}
+
+UInt64 PgSqlCopyWriter::end()
+{
+    if (!m_active) {
+        O3D_ERROR(E_InvalidOperation("The copy is terminated"));
+    }
+
+    // file trailer
+    UInt8 trailer[2];
+    binary::writeInt16(trailer, -1);
+    m_buffer.insert(m_buffer.end(), trailer, trailer + 2);
+
+    flush();
+
+    release();
+
+    if (PQputCopyEnd(m_pDB, nullptr) != 1) {
+        throwError();
+    }
+
+    PGresult *res = PQgetResult(m_pDB);
+    ExecStatusType status = PQresultStatus(res);
+
+    o3d::String msg;
+    if (status != PGRES_COMMAND_OK) {
+        msg.fromUtf8(PQresultErrorMessage(res));
+    }
+
+    PQclear(res);
+
+    while ((res = PQgetResult(m_pDB)) != nullptr) {
+        PQclear(res);
+    }
+
+    if (status != PGRES_COMMAND_OK) {
+        O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
+    }
+
+    return m_numRows;
+}
+
+void PgSqlCopyWriter::abort()
+{
+    if (m_active) {
+        release();
+        m_buffer.clear();
+
+        PQputCopyEnd(m_pDB, "Copy aborted by the client");
+
+        PGresult *res;
+        while ((res = PQgetResult(m_pDB)) != nullptr) {
+            PQclear(res);
+        }
+    }
+}
+
+void PgSqlCopyWriter::putData(const UInt8 *data, UInt32 len)
+{
+    if (PQputCopyData(m_pDB, (const char*)data, (int)len) != 1) {
+        throwError();
+    }
+}
+
+void PgSqlCopyWriter::throwError()
+{
+    o3d::String msg;
+    msg.fromUtf8(PQerrorMessage(m_pDB));
+
+    O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
+}
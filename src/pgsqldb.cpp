@@ -10,74 +10,36 @@
 #include "o3d/pgsql/pgsqldb.h"
 #include "o3d/pgsql/pgsqlexception.h"
 #include "o3d/pgsql/pgsqldbvariable.h"
+#include "o3d/pgsql/pgsqlbinary.h"
+#include "o3d/pgsql/pgsqlcopywriter.h"
+#include "o3d/pgsql/pgsqlcopyreader.h"
+#include "o3d/pgsql/pgsqlcolumns.h"
 
 #include <o3d/core/application.h>
 #include <o3d/core/objects.h>
 
+#include <ctype.h>
 #include <stdio.h>
-#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#ifdef O3D_WINDOWS
+    #include <winsock2.h>
+#else
+    #include <sys/select.h>
+#endif
 
 using namespace o3d;
 using namespace o3d::pgsql;
 
-static UInt32 ms_pgSqlLibRefCount = 0;
+// connections are created and deleted by the threads of a pool
+static std::atomic<UInt32> ms_pgSqlLibRefCount(0);
 static Bool ms_pgSqlLibState = False;
 
-// workaround for postgres defining their OIDs in a private header file
-#define QBOOLOID 16
-#define QINT8OID 20
-#define QINT2OID 21
-#define QINT4OID 23
-#define QNUMERICOID 1700
-#define QFLOAT4OID 700
-#define QFLOAT8OID 701
-#define QABSTIMEOID 702
-#define QRELTIMEOID 703
-#define QDATEOID 1082
-#define QTIMEOID 1083
-#define QTIMETZOID 1266
-#define QTIMESTAMPOID 1114
-#define QTIMESTAMPTZOID 1184
-#define QOIDOID 2278
-#define QBYTEAOID 17
-#define QREGPROCOID 24
-#define QXIDOID 28
-#define QCIDOID 29
-
-#define QBITOID 1560
-#define QVARBITOID 1562
-
-// add json
-
-#define SMJSONOID 114
-#define SMJSONBOID 3802
-
-// add arrays
-
-#define SMBOOL_ARRAYOID 1000
-#define SMINT8_ARRAYOID 1016
-#define SMINT2_ARRAYOID 1005
-#define SMINT4_ARRAYOID 1007
-#define SMNUMERIC_ARRAYOID 1231
-#define SMFLOAT4_ARRAYOID 1021
-#define SMFLOAT8_ARRAYOID 1022
-#define SMABSTIME_ARRAYOID 1023
-#define SMRELTIME_ARRAYOID 1024
-#define SMDATE_ARRAYOID 1182
-#define SMTIME_ARRAYOID 1183
-#define SMTIMETZ_ARRAYOID 1270
-#define SMTIMESTAMP_ARRAYOID 1115
-#define SMTIMESTAMPTZ_ARRAYOID 1185
-#define SMBYTEA_ARRAYOID 1001
-#define SMREGPROC_ARRAYOID 1008
-#define SMXID_ARRAYOID 1011
-#define SMCID_ARRAYOID 1012
-#define SMJSON_ARRAYOID 199
-#define SMJSONB_ARRAYOID 3807
-
-#define SMVARCHAR_ARRAYOID 1015
-#define SMTEXT_ARRAYOID 1009
-
 // STMT https://www.postgresql.org/docs/9.3/sql-prepare.html
 
 void PgSql::init()
@@ -104,7 +66,30 @@ void PgSql::quit()
 //! Default ctor
 PgSqlDb::PgSqlDb() :
     Database(),
-    m_pDB(nullptr)
+    m_pDB(nullptr),
+    m_stmtCounter(0),
+    m_reconnectRetries(5),
+    m_reconnectDelay(100),
+    m_reconnectMaxDelay(5000),
+    m_numReconnects(0),
+    m_stmtMaxCount(256),
+    m_stmtMaxSize(1024*1024),
+    m_stmtUnused(0),
+    m_stmtUnusedSize(0),
+    m_stmtHits(0),
+    m_stmtMisses(0),
+    m_stmtUnprepared(0),
+    m_statsEnabled(False),
+    m_streamQuery(nullptr),
+    m_copyWriter(nullptr),
+    m_copyReader(nullptr),
+    m_batch(False),
+    m_batchNext(0),
+    m_batchSynced(0),
+    m_asyncId(0),
+    m_asyncDone(0),
+    m_asyncPipeline(False),
+    m_writePending(False)
 {
     if (!ms_pgSqlLibState) {
         O3D_ERROR(E_InvalidPrecondition("PgSql::init() must be called before"));
@@ -116,6 +101,21 @@ PgSqlDb::PgSqlDb() :
 PgSqlDb::~PgSqlDb()
 {
     disconnect();
+
+    // queries are deleted by the Database
+    for (PgSqlQuery *query : m_queries) {
+        query->m_db = nullptr;
+        query->m_pDB = nullptr;
+        query->m_stats = nullptr;
+    }
+
+    m_queries.clear();
+
+    for (auto &it : m_stats) {
+        deletePtr(it.second);
+    }
+
+    m_stats.clear();
     --ms_pgSqlLibRefCount;
 }
 
@@ -127,6 +127,34 @@ Bool PgSqlDb::connect(
         const String &user,
         const String &password,
         Bool keepPassord)
+{
+    String connInfo = connectionInfo(host, port, database, user, password, keepPassord);
+
+    m_pDB = PQconnectdb(connInfo.toUtf8().getData());
+    O3D_ASSERT(m_pDB != nullptr);
+
+    if (PQstatus(m_pDB) != CONNECTION_OK) {
+        const char* err = PQerrorMessage(m_pDB);
+        o3d::String msg;
+        msg.fromUtf8(err);
+
+        O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
+    }
+
+    // O3D_MESSAGE("Successfully connected to the PgSql database");
+
+    m_isConnected = True;
+
+    return True;
+}
+
+String PgSqlDb::connectionInfo(
+        const String &host,
+        UInt32 port,
+        const String &database,
+        const String &user,
+        const String &password,
+        Bool keepPassord)
 {
     Int32 pos;
 
@@ -147,25 +175,55 @@ Bool PgSqlDb::connect(
         port = host.sub(pos+1).toUInt32();
     }
 
-    String connInfo = String("hostaddr={0} port={1} dbname={2} user={3} password={4} keepalives=1")
-                           .arg(host).arg(port).arg(database).arg(user).arg(password);
-    // PGresult *res;
-    m_pDB = PQconnectdb(connInfo.toUtf8().getData());
-    O3D_ASSERT(m_pDB != nullptr);
+    return String("hostaddr={0} port={1} dbname={2} user={3} password={4} keepalives=1")
+                  .arg(m_host).arg(port).arg(database).arg(user).arg(password);
+}
 
-    if (PQstatus(m_pDB) != CONNECTION_OK) {
-        const char* err = PQerrorMessage(m_pDB);
+void PgSqlDb::connectAsync(
+        const String &host,
+        UInt32 port,
+        const String &database,
+        const String &user,
+        const String &password,
+        Bool keepPassord)
+{
+    String connInfo = connectionInfo(host, port, database, user, password, keepPassord);
+
+    m_pDB = PQconnectStart(connInfo.toUtf8().getData());
+    if (m_pDB == nullptr) {
+        O3D_ERROR(E_InvalidAllocation("PgSql connection"));
+    }
+
+    if (PQstatus(m_pDB) == CONNECTION_BAD) {
         o3d::String msg;
-        msg.fromUtf8(err);
+        msg.fromUtf8(PQerrorMessage(m_pDB));
 
         O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
     }
+}
 
-    // O3D_MESSAGE("Successfully connected to the PgSql database");
+PgSqlDb::ConnectState PgSqlDb::pollConnect()
+{
+    if (m_pDB == nullptr) {
+        O3D_ERROR(E_InvalidOperation("No connection in progress"));
+    }
 
-    m_isConnected = True;
+    switch (PQconnectPoll(m_pDB)) {
+    case PGRES_POLLING_READING:
+        return CONNECT_READING;
+    case PGRES_POLLING_WRITING:
+        return CONNECT_WRITING;
+    case PGRES_POLLING_OK:
+        m_isConnected = True;
+        return CONNECT_OK;
+    default:
+    {
+        o3d::String msg;
+        msg.fromUtf8(PQerrorMessage(m_pDB));
 
-    return True;
+        O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
+    }
+    }
 }
 
 // Disconnect from the database server
@@ -175,794 +233,3099 @@ void PgSqlDb::disconnect()
         m_isConnected = False;
     }
 
+    resetState();
+
+    // prepared statements are lost with the connection
+    for (auto &it : m_statements) {
+        PQclear(it.second.desc);
+    }
+
+    m_statements.clear();
+    m_stmtLru.clear();
+    m_stmtUnused = 0;
+    m_stmtUnusedSize = 0;
+    m_stmtUnprepared = 0;
+
     if (m_pDB) {
         PQfinish(m_pDB);
         m_pDB = nullptr;
     }
 }
 
-// Try to maintain the connection established
-void PgSqlDb::pingConnection()
+void PgSqlDb::resetState()
 {
-    if (m_pDB) {
-        // mysql_ping(m_pDB);
+    // pending results are lost with the connection
+    m_batch = False;
+    m_batchQueue.clear();
+    m_batchNext = m_batchSynced = 0;
+
+    // pending asynchronous executions are considered done
+    m_async.clear();
+    m_asyncDone = m_asyncId;
+    m_asyncPipeline = False;
+    m_writePending = False;
+
+    if (m_streamQuery) {
+        m_streamQuery->m_streamActive = False;
+        m_streamQuery = nullptr;
+    }
+
+    if (m_copyWriter) {
+        m_copyWriter->m_active = False;
+        m_copyWriter = nullptr;
+    }
+
+    if (m_copyReader) {
+        m_copyReader->m_active = False;
+        m_copyReader = nullptr;
+    }
+
+    for (PgSqlQuery *query : m_queries) {
+        query->m_updateBatch = False;
+        query->m_batchCount = 0;
     }
 }
 
-// Instanciate a new DbQuery object
-DbQuery* PgSqlDb::newDbQuery(const String &name, const CString &query)
+// Wait until a socket is ready, returns False on timeout or error
+static Bool waitSocket(Int32 sock, Bool write, UInt32 timeoutMs)
 {
-    return new PgSqlQuery(m_pDB, name, query);
+    if (sock < 0) {
+        return False;
+    }
+
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(sock, &fds);
+
+    struct timeval timeout;
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_usec = (timeoutMs % 1000) * 1000;
+
+    return select(sock + 1, write ? nullptr : &fds, write ? &fds : nullptr, nullptr, &timeout) > 0;
 }
 
-// Virtual destructor
-PgSqlQuery::~PgSqlQuery()
+Bool PgSqlDb::resetConnection()
 {
-    for (Int32 i = 0; i < m_inputs.getSize(); ++i) {
-        deletePtr(m_inputs[i]);
+    if (!PQresetStart(m_pDB)) {
+        return False;
     }
 
-    for (Int32 i = 0; i < m_outputs.getSize(); ++i) {
-        deletePtr(m_outputs[i]);
+    // as for PQconnectPoll, starts as if the socket was ready to write
+    PostgresPollingStatusType status = PGRES_POLLING_WRITING;
+
+    for (;;) {
+        if (status == PGRES_POLLING_OK) {
+            return True;
+        } else if (status == PGRES_POLLING_FAILED) {
+            return False;
+        }
+
+        if (!waitSocket(PQsocket(m_pDB), status == PGRES_POLLING_WRITING, RECONNECT_TIMEOUT_MS)) {
+            return False;
+        }
+
+        status = PQresetPoll(m_pDB);
     }
+}
 
-    if (m_pRes) {
-        PQclear(m_pRes);
-        m_pRes = nullptr;
+void PgSqlDb::prepareStatements()
+{
+    // unused statements are forgotten, those in use keep their name
+    for (auto it = m_statements.begin(); it != m_statements.end();) {
+        if (it->second.refs == 0) {
+            PQclear(it->second.desc);
+            m_stmtLru.erase(it->second.lru);
+            it = m_statements.erase(it);
+        } else {
+            it->second.prepared = False;
+            ++it;
+        }
+    }
+
+    m_stmtUnused = 0;
+    m_stmtUnusedSize = 0;
+    m_stmtUnprepared = (UInt32)m_statements.size();
+
+    if (m_statements.empty()) {
+        return;
+    }
+
+#ifdef LIBPQ_HAS_PIPELINING
+    // every statement in a single round trip, with a sync point after each one so a
+    // failing statement (ie a dropped table) doesn't abort the next ones
+    std::vector<Statement*> sent;
+
+    if (PQenterPipelineMode(m_pDB)) {
+        for (auto &it : m_statements) {
+            if (!PQsendPrepare(m_pDB, it.second.name.getData(), it.second.sql.getData(), 0, nullptr) ||
+                !PQpipelineSync(m_pDB)) {
+                break;
+            }
+
+            sent.push_back(&it.second);
+        }
+
+        for (Statement *stmt : sent) {
+            PGresult *res = PQgetResult(m_pDB);
+            if (!res) {
+                // connection lost
+                break;
+            }
+
+            if (PQresultStatus(res) == PGRES_COMMAND_OK) {
+                stmt->prepared = True;
+                --m_stmtUnprepared;
+            }
+
+            PQclear(res);
+
+            // the null ending the result, then the sync point
+            PQclear(PQgetResult(m_pDB));
+            PQclear(PQgetResult(m_pDB));
+        }
+
+        PQexitPipelineMode(m_pDB);
+    }
+#else
+    for (auto &it : m_statements) {
+        PGresult *res = PQprepare(m_pDB, it.second.name.getData(), it.second.sql.getData(), 0, nullptr);
+
+        if (PQresultStatus(res) == PGRES_COMMAND_OK) {
+            it.second.prepared = True;
+            --m_stmtUnprepared;
+        }
+
+        PQclear(res);
+    }
+#endif
+
+    // the failed statements are prepared again at their next execution
+    if (PQstatus(m_pDB) == CONNECTION_BAD) {
+        throwError();
     }
 }
 
-void PgSqlQuery::setArrayUInt8(UInt32 attr, const ArrayUInt8 &v)
+void PgSqlDb::retryStatement(const std::string &key)
 {
-    if (attr >= m_numParam) {
-        O3D_ERROR(E_IndexOutOfRange("Input attribute id"));
+    auto it = m_statements.find(key);
+    if (it == m_statements.end() || it->second.prepared) {
+        return;
     }
 
-    if (m_inputs[attr]) {
-        deletePtr(m_inputs[attr]);
+    if (m_batch) {
+        O3D_ERROR(E_InvalidOperation("A statement to prepare again cannot be executed during a batch"));
     }
 
-    if (v.getSize() < (1 << 8)) {
-        m_inputs[attr] = new PgSqlDbVariable(DbVariable::IT_ARRAY_UINT8, DbVariable::TINY_ARRAY, (UInt8*)&v);
-    } else if (v.getSize() < (1 << 16)) {
-        m_inputs[attr] = new PgSqlDbVariable(DbVariable::IT_ARRAY_UINT8, DbVariable::ARRAY, (UInt8*)&v);
-    } else if (v.getSize() < (1 << 24)) {
-        m_inputs[attr] = new PgSqlDbVariable(DbVariable::IT_ARRAY_UINT8, DbVariable::MEDIUM_ARRAY, (UInt8*)&v);
-    } else {
-        m_inputs[attr] = new PgSqlDbVariable(DbVariable::IT_ARRAY_UINT8, DbVariable::LONG_ARRAY, (UInt8*)&v);
+    checkCopy();
+
+    // out of the pipeline mode
+    if (!m_async.empty()) {
+        waitAsync();
+    }
+
+    PGresult *res = PQprepare(m_pDB, it->second.name.getData(), it->second.sql.getData(), 0, nullptr);
+
+    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+        o3d::String msg;
+        msg.fromUtf8(PQerrorMessage(m_pDB));
+        PQclear(res);
+
+        O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
     }
 
-   /* DbVariable &var = *m_inputs[attr];
+    PQclear(res);
+
+    it->second.prepared = True;
+    --m_stmtUnprepared;
+}
+
+void PgSqlDb::reconnect()
+{
+    if (!m_pDB) {
+        O3D_ERROR(E_InvalidOperation("No connection to reset"));
+    }
 
-    enum_field_types dbtype = (enum_field_types)0;
-    unsigned long dbsize = 0;
+    resetState();
 
-    mapType(var.getType(), dbtype, dbsize);
+    UInt32 delay = m_reconnectDelay;
 
-    memset(&m_param_bind[attr], 0, sizeof(MYSQL_BIND));
+    for (UInt32 retry = 0; !resetConnection(); ++retry) {
+        if (retry >= m_reconnectRetries) {
+            m_isConnected = False;
+            throwError();
+        }
 
-    m_param_bind[attr].buffer_type = (enum_field_types)dbtype;
-    m_param_bind[attr].buffer = (void*)var.getObjectPtr();
-    m_param_bind[attr].buffer_length = var.getObjectSize();
+        std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+        delay = delay * 2 < m_reconnectMaxDelay ? delay * 2 : m_reconnectMaxDelay;
+    }
 
-    m_param_bind[attr].is_null = 0;
+    m_isConnected = True;
+    ++m_numReconnects;
 
-    var.setLength(var.getObjectSize());
-    m_param_bind[attr].length = (unsigned long*)var.getLengthPtr();
-*/
-    m_needBind = True;
+    prepareStatements();
 }
 
-void PgSqlQuery::setSmartArrayUInt8(UInt32 attr, const SmartArrayUInt8 &v)
+void PgSqlDb::resetAsync()
 {
-    if (attr >= m_numParam) {
-        O3D_ERROR(E_IndexOutOfRange("Input attribute id"));
+    if (!m_pDB) {
+        O3D_ERROR(E_InvalidOperation("No connection to reset"));
     }
 
-    if (m_inputs[attr]) {
-        deletePtr(m_inputs[attr]);
+    resetState();
+
+    if (!PQresetStart(m_pDB)) {
+        m_isConnected = False;
+        throwError();
     }
+}
 
-    if (v.getSizeInBytes() < (1 << 8)) {
-        m_inputs[attr] = new PgSqlDbVariable(DbVariable::IT_SMART_ARRAY_UINT8, DbVariable::TINY_ARRAY, (UInt8*)&v);
-    } else if (v.getSizeInBytes() < (1 << 16)) {
-        m_inputs[attr] = new PgSqlDbVariable(DbVariable::IT_SMART_ARRAY_UINT8, DbVariable::ARRAY, (UInt8*)&v);
-    } else if (v.getSizeInBytes() < (1 << 24)) {
-        m_inputs[attr] = new PgSqlDbVariable(DbVariable::IT_SMART_ARRAY_UINT8, DbVariable::MEDIUM_ARRAY, (UInt8*)&v);
-    } else {
-        m_inputs[attr] = new PgSqlDbVariable(DbVariable::IT_SMART_ARRAY_UINT8, DbVariable::LONG_ARRAY, (UInt8*)&v);
+PgSqlDb::ConnectState PgSqlDb::pollReset()
+{
+    if (m_pDB == nullptr) {
+        O3D_ERROR(E_InvalidOperation("No connection in progress"));
     }
 
-    DbVariable &var = *m_inputs[attr];
-/*
-    enum_field_types dbtype = (enum_field_types)0;
-    unsigned long dbsize = 0;
+    switch (PQresetPoll(m_pDB)) {
+    case PGRES_POLLING_READING:
+        return CONNECT_READING;
+    case PGRES_POLLING_WRITING:
+        return CONNECT_WRITING;
+    case PGRES_POLLING_OK:
+        m_isConnected = True;
+        ++m_numReconnects;
+
+        prepareStatements();
+        return CONNECT_OK;
+    default:
+    {
+        m_isConnected = False;
 
-    mapType(var.getType(), dbtype, dbsize);
+        o3d::String msg;
+        msg.fromUtf8(PQerrorMessage(m_pDB));
 
-    memset(&m_param_bind[attr], 0, sizeof(MYSQL_BIND));
+        O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
+    }
+    }
+}
 
-    m_param_bind[attr].buffer_type = (enum_field_types)dbtype;
-    m_param_bind[attr].buffer = (void*)var.getObjectPtr();
-    m_param_bind[attr].buffer_length = var.getObjectSize();
+Bool PgSqlDb::recover()
+{
+    if (!m_pDB || m_reconnectRetries == 0 || PQstatus(m_pDB) != CONNECTION_BAD) {
+        return False;
+    }
 
-    m_param_bind[attr].is_null = 0;
+    reconnect();
+    return True;
+}
 
-    var.setLength(var.getObjectSize());
-    m_param_bind[attr].length = (unsigned long*)var.getLengthPtr();
-*/
-    m_needBind = True;
+void PgSqlDb::setReconnect(UInt32 maxRetries, UInt32 delayMs, UInt32 maxDelayMs)
+{
+    m_reconnectRetries = maxRetries;
+    m_reconnectDelay = delayMs;
+    m_reconnectMaxDelay = maxDelayMs;
 }
 
-void PgSqlQuery::setInStream(UInt32 attr, const InStream &v)
+// Try to maintain the connection established
+void PgSqlDb::pingConnection()
 {
-    O3D_ERROR(E_InvalidOperation("Not yet implemented"));
+    if (!m_pDB) {
+        return;
+    }
+
+    // an empty query is the cheapest round trip, only possible when idle, it would fail
+    // without any round trip in pipeline mode (batches of updates included), and abort
+    // a copy in progress
+    Bool idle = PQstatus(m_pDB) == CONNECTION_OK && !m_batch && m_async.empty() &&
+                !m_streamQuery && !m_copyWriter && !m_copyReader;
+
+    for (auto it = m_queries.begin(); idle && it != m_queries.end(); ++it) {
+        idle = !(*it)->m_updateBatch;
+    }
+
+#ifdef LIBPQ_HAS_PIPELINING
+    idle = idle && PQpipelineStatus(m_pDB) == PQ_PIPELINE_OFF;
+#endif
+
+    if (idle) {
+        PQclear(PQexec(m_pDB, ""));
+    }
+
+    if (PQstatus(m_pDB) == CONNECTION_BAD) {
+        reconnect();
+    }
 }
 
-void PgSqlQuery::setBool(UInt32 attr, Bool v)
+Bool PgSqlDb::makeIdle()
 {
-    if (attr >= m_numParam) {
-        O3D_ERROR(E_IndexOutOfRange("Input attribute id"));
+    if (!m_pDB || PQstatus(m_pDB) != CONNECTION_OK) {
+        return False;
+    }
+
+    try {
+        if (m_copyWriter) {
+            m_copyWriter->abort();
+        }
+
+        if (m_copyReader) {
+            m_copyReader->cancel();
+        }
+
+        endBatch();
+
+        // the results of the abandoned updates are dropped
+        for (PgSqlQuery *query : m_queries) {
+            if (query->m_updateBatch) {
+                query->readUpdates(False);
+                query->executeBatch();
+            }
+        }
+
+        makeAvailable();
+
+        // nobody is left to check them
+        m_asyncErrors.clear();
+
+        if (PQtransactionStatus(m_pDB) != PQTRANS_IDLE) {
+            command("ROLLBACK");
+        }
+    } catch (...) {
+        return False;
+    }
+
+    return PQstatus(m_pDB) == CONNECTION_OK && PQtransactionStatus(m_pDB) == PQTRANS_IDLE;
+}
+
+// Instanciate a new DbQuery object
+DbQuery* PgSqlDb::newDbQuery(const String &name, const CString &query)
+{
+    return new PgSqlQuery(this, name, query);
+}
+
+CString PgSqlDb::nextStatementName()
+{
+    Char stmtName[32];
+    snprintf(stmtName, sizeof(stmtName), "o3d_stmt_%u", ++m_stmtCounter);
+
+    return CString(stmtName);
+}
+
+std::string PgSqlDb::normalizeSql(const CString &sql)
+{
+    const Char *p = sql.getData();
+    const Char *end = p + sql.length();
+
+    std::string out;
+    out.reserve(sql.length());
+
+    Char quote = 0;
+    Bool space = False;
+
+    for (; p < end; ++p) {
+        const Char c = *p;
+
+        if (c == '\\') {
+            // escapes are not handled
+            return std::string(sql.getData(), sql.length());
+        } else if (quote) {
+            // a doubled quote is seen as the end then the start of a literal
+            if (c == quote) {
+                quote = 0;
+            }
+            out += c;
+        } else if ((c == '-' && p + 1 < end && p[1] == '-') || (c == '$' && p + 1 < end && !isdigit((UInt8)p[1]))) {
+            // a comment ends at a new line and dollar quoted strings keep their spaces
+            return std::string(sql.getData(), sql.length());
+        } else if (isspace((UInt8)c)) {
+            space = True;
+        } else {
+            if (space && !out.empty()) {
+                out += ' ';
+            }
+
+            space = False;
+            out += c;
+
+            if (c == '\'' || c == '"') {
+                quote = c;
+            }
+        }
+    }
+
+    return out;
+}
+
+const PGresult *PgSqlDb::acquireStatement(const CString &sql, CString &name, std::string &key)
+{
+    key = normalizeSql(sql);
+
+    auto it = m_statements.find(key);
+    if (it != m_statements.end()) {
+        Statement &stmt = it->second;
+
+        if (!stmt.prepared) {
+            retryStatement(key);
+        }
+
+        if (stmt.refs++ == 0) {
+            --m_stmtUnused;
+            m_stmtUnusedSize -= key.size();
+        }
+
+        m_stmtLru.splice(m_stmtLru.begin(), m_stmtLru, stmt.lru);
+        ++m_stmtHits;
+
+        name = stmt.name;
+        return stmt.desc;
     }
 
-    if (m_inputs[attr]) {
-        deletePtr(m_inputs[attr]);
+    ++m_stmtMisses;
+
+    makeAvailable();
+
+    // room for the statements released later
+    trimStatements(m_stmtMaxCount, m_stmtMaxSize);
+
+    name = nextStatementName();
+
+    // let the backend deduce the parameters types
+    PGresult *res = PQprepare(m_pDB, name.getData(), sql.getData(), 0, nullptr);
+
+    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+        o3d::String msg;
+        msg.fromUtf8(PQerrorMessage(m_pDB));
+        PQclear(res);
+
+        O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
     }
 
-    m_inputs[attr] = new PgSqlDbVariable(DbVariable::IT_BOOL, DbVariable::BOOLEAN, (UInt8*)&v);
-    DbVariable &var = *m_inputs[attr];
-/*
-    enum_field_types dbtype = (enum_field_types)0;
-    unsigned long dbsize = 0;
+    PQclear(res);
+
+    // described once, the description is shared by the queries of the statement
+    res = PQdescribePrepared(m_pDB, name.getData());
 
-    mapType(var.getType(), dbtype, dbsize);
+    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+        o3d::String msg;
+        msg.fromUtf8(PQerrorMessage(m_pDB));
+        PQclear(res);
 
-    memset(&m_param_bind[attr], 0, sizeof(MYSQL_BIND));
+        O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
+    }
 
-    m_param_bind[attr].buffer_type = (enum_field_types)dbtype;
-    m_param_bind[attr].buffer = (void*)var.getObjectPtr();
-    m_param_bind[attr].buffer_length = var.getObjectSize();
+    m_stmtLru.push_front(key);
 
-    m_param_bind[attr].is_null = 0;
+    Statement &stmt = m_statements[key];
+    stmt.name = name;
+    stmt.sql = sql;
+    stmt.desc = res;
+    stmt.refs = 1;
+    stmt.prepared = True;
+    stmt.lru = m_stmtLru.begin();
 
-    var.setLength(dbsize);
-    m_param_bind[attr].length = (unsigned long*)var.getLengthPtr();
-*/
-    m_needBind = True;
+    return res;
 }
 
-void PgSqlQuery::setInt32(UInt32 attr, Int32 v)
+void PgSqlDb::releaseStatement(const std::string &key)
 {
-    if (attr >= m_numParam) {
-        O3D_ERROR(E_IndexOutOfRange("Input attribute id"));
+    // could be lost with the connection
+    auto it = m_statements.find(key);
+    if (it == m_statements.end() || it->second.refs == 0) {
+        return;
+    }
+
+    if (--it->second.refs == 0) {
+        ++m_stmtUnused;
+        m_stmtUnusedSize += key.size();
     }
+}
 
-    if (m_inputs[attr]) {
-        deletePtr(m_inputs[attr]);
+void PgSqlDb::trimStatements(UInt32 maxCount, size_t maxSize)
+{
+    if (m_stmtUnused <= maxCount && m_stmtUnusedSize <= maxSize) {
+        return;
     }
 
-    m_inputs[attr] = new PgSqlDbVariable(DbVariable::IT_INT32, DbVariable::INT32, (UInt8*)&v);
-    DbVariable &var = *m_inputs[attr];
-/*
-    enum_field_types dbtype = (enum_field_types)0;
-    unsigned long dbsize = 0;
+    // deallocated in a single round trip
+    std::string sql;
+
+    auto lru = m_stmtLru.end();
+    while (lru != m_stmtLru.begin() && (m_stmtUnused > maxCount || m_stmtUnusedSize > maxSize)) {
+        --lru;
+
+        auto it = m_statements.find(*lru);
+        if (it->second.refs > 0) {
+            continue;
+        }
 
-    mapType(var.getType(), dbtype, dbsize);
+        // not existing server side
+        if (!it->second.prepared) {
+            --m_stmtUnprepared;
+        } else {
+            sql += "DEALLOCATE ";
+            sql += it->second.name.getData();
+            sql += ";";
+        }
 
-    memset(&m_param_bind[attr], 0, sizeof(MYSQL_BIND));
+        --m_stmtUnused;
+        m_stmtUnusedSize -= lru->size();
 
-    m_param_bind[attr].buffer_type = (enum_field_types)dbtype;
-    m_param_bind[attr].buffer = (void*)var.getObjectPtr();
-    m_param_bind[attr].buffer_length = var.getObjectSize();
+        PQclear(it->second.desc);
+        m_statements.erase(it);
 
-    //m_param_bind[attr].is_null_value = False; @see if we support null value
-    m_param_bind[attr].is_null = 0;
+        lru = m_stmtLru.erase(lru);
+    }
+
+    if (!sql.empty() && m_pDB) {
+        command(sql.c_str());
+    }
+}
+
+void PgSqlDb::setStatementCache(UInt32 maxCount, UInt32 maxSize)
+{
+    m_stmtMaxCount = maxCount;
+    m_stmtMaxSize = maxSize;
+
+    makeAvailable();
+    trimStatements(m_stmtMaxCount, m_stmtMaxSize);
+}
+
+void PgSqlDb::purgeStatements()
+{
+    makeAvailable();
+    trimStatements(0, 0);
+}
+
+PgSqlStats *PgSqlDb::statsOf(const String &name)
+{
+    std::lock_guard<std::mutex> lock(m_statsMutex);
+
+    PgSqlStats *&stats = m_stats[name];
+    if (!stats) {
+        stats = new PgSqlStats(name);
+    }
+
+    return stats;
+}
+
+void PgSqlDb::setStatsEnabled(Bool enable)
+{
+    m_statsEnabled = enable;
+
+    for (PgSqlQuery *query : m_queries) {
+        query->m_stats = enable ? statsOf(query->m_name) : nullptr;
+        query->m_resultTime = 0;
+    }
+}
+
+void PgSqlDb::getStats(std::vector<PgSqlStats::Snapshot> &stats, Bool reset)
+{
+    std::lock_guard<std::mutex> lock(m_statsMutex);
+
+    stats.resize(m_stats.size());
+
+    size_t i = 0;
+    for (auto &it : m_stats) {
+        it.second->snapshot(stats[i++]);
+
+        if (reset) {
+            it.second->reset();
+        }
+    }
+}
+
+void PgSqlDb::resetStats()
+{
+    std::lock_guard<std::mutex> lock(m_statsMutex);
+
+    for (auto &it : m_stats) {
+        it.second->reset();
+    }
+}
+
+void PgSqlDb::endStream()
+{
+    if (m_streamQuery) {
+        m_streamQuery->endStream(True);
+    }
+}
+
+void PgSqlDb::checkCopy() const
+{
+    if (m_copyWriter || m_copyReader) {
+        O3D_ERROR(E_InvalidOperation("A copy is in progress on the connection"));
+    }
+}
+
+void PgSqlDb::makeAvailable()
+{
+    checkCopy();
+
+    // known as lost by a previous execution
+    if (m_pDB && PQstatus(m_pDB) == CONNECTION_BAD) {
+        recover();
+    }
+
+    endStream();
+
+    if (!m_async.empty()) {
+        waitAsync();
+    }
+}
+
+Int32 PgSqlDb::getSocket() const
+{
+    return m_pDB ? PQsocket(m_pDB) : -1;
+}
+
+Bool PgSqlDb::consumeInput()
+{
+    return m_pDB && PQconsumeInput(m_pDB) == 1;
+}
+
+PgSqlAsync PgSqlDb::sendAsync(PgSqlQuery *query)
+{
+    if (m_batch) {
+        O3D_ERROR(E_InvalidOperation("Cannot execute asynchronously during a batch"));
+    }
+
+    checkCopy();
+    endStream();
+
+    // a statement to prepare again is prepared out of the pipeline
+    prepareStatement(query->m_stmtKey);
+
+    if (m_async.empty()) {
+        PQsetnonblocking(m_pDB, 1);
+#ifdef LIBPQ_HAS_PIPELINING
+        // pipeline mode allows many executions in flight
+        if (!m_asyncPipeline) {
+            if (!PQenterPipelineMode(m_pDB)) {
+                o3d::String msg;
+                msg.fromUtf8(PQerrorMessage(m_pDB));
+                O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
+            }
+
+            m_asyncPipeline = True;
+        }
+#endif
+    } else if (!m_asyncPipeline) {
+        O3D_ERROR(E_InvalidOperation("An asynchronous execution is already in flight"));
+    }
+
+    if (!PQsendQueryPrepared(m_pDB,
+                             query->m_stmtName.getData(),
+                             query->m_numParam,
+                             query->m_params.values.data(),
+                             query->m_params.lengths.data(),
+                             query->m_params.formats.data(),
+                             1)) {    // ask for binary results
+        o3d::String msg;
+        msg.fromUtf8(PQerrorMessage(m_pDB));
+        O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
+    }
+
+#ifdef LIBPQ_HAS_PIPELINING
+    // one sync point per execution, so a failure doesn't abort the next ones
+    if (!PQpipelineSync(m_pDB)) {
+        o3d::String msg;
+        msg.fromUtf8(PQerrorMessage(m_pDB));
+        O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
+    }
+#endif
+
+    m_writePending = PQflush(m_pDB) == 1;
+
+    AsyncOp op;
+    op.query = query;
+    op.id = ++m_asyncId;
+    op.step = 0;
+
+    m_async.push_back(op);
+
+    return PgSqlAsync(this, query, op.id);
+}
+
+UInt32 PgSqlDb::poll()
+{
+    if (!m_pDB) {
+        return 0;
+    }
+
+    if (m_writePending) {
+        m_writePending = PQflush(m_pDB) == 1;
+    }
+
+    if (!m_async.empty() && !PQconsumeInput(m_pDB)) {
+        o3d::String msg;
+        msg.fromUtf8(PQerrorMessage(m_pDB));
+        O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
+    }
+
+    return processAsync(False);
+}
+
+UInt32 PgSqlDb::processAsync(Bool block)
+{
+    UInt32 count = 0;
+
+    while (!m_async.empty()) {
+        if (!block && PQisBusy(m_pDB)) {
+            break;
+        }
+
+        AsyncOp &op = m_async.front();
+        PGresult *res = PQgetResult(m_pDB);
+
+        if (op.step == 0) {
+            ExecStatusType status = PQresultStatus(res);
+
+            if (!op.query) {
+                PQclear(res);
+            } else if (status == PGRES_TUPLES_OK || status == PGRES_COMMAND_OK) {
+                op.query->setResult(res);
+            } else {
+                o3d::String msg;
+                msg.fromUtf8(res ? PQresultErrorMessage(res) : PQerrorMessage(m_pDB));
+                m_asyncErrors[op.id] = msg;
+
+                PQclear(res);
+                op.query->setResult(nullptr);
+
+                if (op.query->m_stats) {
+                    op.query->m_stats->addError();
+                }
+            }
+
+            // a connection failure doesn't give the end of result
+            op.step = res ? 1 : 2;
+        } else {
+            PQclear(res);
+            ++op.step;
+        }
+
+#ifdef LIBPQ_HAS_PIPELINING
+        const UInt32 lastStep = 2;
+#else
+        const UInt32 lastStep = 1;
+#endif
+        if (op.step > lastStep || (op.step == 2 && !res)) {
+            m_asyncDone = op.id;
+            m_async.pop_front();
+            ++count;
+        }
+    }
+
+    if (m_async.empty() && (m_asyncPipeline || count > 0)) {
+#ifdef LIBPQ_HAS_PIPELINING
+        if (m_asyncPipeline) {
+            PQexitPipelineMode(m_pDB);
+            m_asyncPipeline = False;
+        }
+#endif
+        PQsetnonblocking(m_pDB, 0);
+    }
+
+    return count;
+}
+
+void PgSqlDb::waitAsync(UInt64 id)
+{
+    if (m_async.empty() || m_asyncDone >= id) {
+        return;
+    }
+
+    // flush and read in blocking mode
+    PQsetnonblocking(m_pDB, 0);
+
+    if (PQflush(m_pDB) != 0) {
+        o3d::String msg;
+        msg.fromUtf8(PQerrorMessage(m_pDB));
+        O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
+    }
+
+    m_writePending = False;
+
+    while (m_asyncDone < id && !m_async.empty()) {
+        processAsync(True);
+    }
+
+    if (!m_async.empty()) {
+        PQsetnonblocking(m_pDB, 1);
+    }
+}
+
+void PgSqlDb::waitAsync()
+{
+    waitAsync(m_asyncId);
+}
+
+Bool PgSqlAsync::isDone() const
+{
+    return m_db && m_db->m_asyncDone >= m_id;
+}
+
+void PgSqlAsync::wait()
+{
+    if (!m_db) {
+        O3D_ERROR(E_InvalidOperation("Invalid asynchronous execution handle"));
+    }
+
+    m_db->waitAsync(m_id);
+    check();
+}
+
+void PgSqlAsync::check() const
+{
+    if (!isDone()) {
+        O3D_ERROR(E_InvalidOperation("Asynchronous execution is in progress"));
+    }
+
+    auto it = m_db->m_asyncErrors.find(m_id);
+    if (it != m_db->m_asyncErrors.end()) {
+        o3d::String msg = it->second;
+        m_db->m_asyncErrors.erase(it);
+
+        O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
+    }
+}
+
+void PgSqlDb::throwError()
+{
+    o3d::String msg;
+    msg.fromUtf8(PQerrorMessage(m_pDB));
+
+    O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
+}
+
+void PgSqlDb::command(const Char *sql)
+{
+    PGresult *res = PQexec(m_pDB, sql);
+
+    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+        o3d::String msg;
+        msg.fromUtf8(PQresultErrorMessage(res));
+        PQclear(res);
+
+        O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
+    }
+
+    PQclear(res);
+}
+
+// large object descriptors are only valid inside a transaction
+#define INV_WRITE 0x00020000
+#define INV_READ 0x00040000
+
+Oid PgSqlDb::writeLargeObject(InStream &is, UInt32 chunkSize)
+{
+    makeAvailable();
+
+    const Bool implicit = PQtransactionStatus(m_pDB) == PQTRANS_IDLE;
+    if (implicit) {
+        command("BEGIN");
+    }
+
+    Oid oid = InvalidOid;
+
+    try {
+        oid = lo_creat(m_pDB, INV_READ | INV_WRITE);
+        if (oid == InvalidOid) {
+            throwError();
+        }
+
+        Int32 fd = lo_open(m_pDB, oid, INV_WRITE);
+        if (fd < 0) {
+            throwError();
+        }
+
+        std::vector<Char> chunk(chunkSize > 0 ? chunkSize : LO_CHUNK_SIZE);
+        UInt32 size;
+
+        while ((size = is.reader(chunk.data(), 1, (UInt32)chunk.size())) > 0) {
+            if (lo_write(m_pDB, fd, chunk.data(), size) != (Int32)size) {
+                throwError();
+            }
+        }
+
+        if (lo_close(m_pDB, fd) != 0) {
+            throwError();
+        }
+
+        if (implicit) {
+            command("COMMIT");
+        }
+    } catch (...) {
+        if (implicit) {
+            PQclear(PQexec(m_pDB, "ROLLBACK"));
+        }
+        throw;
+    }
+
+    return oid;
+}
+
+UInt64 PgSqlDb::readLargeObject(Oid oid, OutStream &os, UInt32 chunkSize)
+{
+    makeAvailable();
+
+    const Bool implicit = PQtransactionStatus(m_pDB) == PQTRANS_IDLE;
+    if (implicit) {
+        command("BEGIN");
+    }
+
+    UInt64 total = 0;
+
+    try {
+        Int32 fd = lo_open(m_pDB, oid, INV_READ);
+        if (fd < 0) {
+            throwError();
+        }
+
+        std::vector<Char> chunk(chunkSize > 0 ? chunkSize : LO_CHUNK_SIZE);
+        Int32 size;
+
+        while ((size = lo_read(m_pDB, fd, chunk.data(), chunk.size())) > 0) {
+            if (os.writer(chunk.data(), 1, (UInt32)size) != (UInt32)size) {
+                O3D_ERROR(E_InvalidResult("Large object output stream is full"));
+            }
+
+            total += size;
+        }
+
+        if (size < 0) {
+            throwError();
+        }
+
+        lo_close(m_pDB, fd);
+
+        if (implicit) {
+            command("COMMIT");
+        }
+    } catch (...) {
+        if (implicit) {
+            PQclear(PQexec(m_pDB, "ROLLBACK"));
+        }
+        throw;
+    }
+
+    return total;
+}
+
+void PgSqlDb::unlinkLargeObject(Oid oid)
+{
+    makeAvailable();
+
+    if (lo_unlink(m_pDB, oid) < 0) {
+        throwError();
+    }
+}
+
+void PgSqlDb::beginBatch()
+{
+#ifdef LIBPQ_HAS_PIPELINING
+    if (m_batch) {
+        O3D_ERROR(E_InvalidOperation("A batch is already in progress"));
+    }
+
+    makeAvailable();
+
+    // statements to prepare again cannot be prepared in the pipeline, a failing one is
+    // refused by queueBatch
+    if (m_stmtUnprepared > 0) {
+        for (auto &it : m_statements) {
+            if (!it.second.prepared) {
+                PGresult *res = PQprepare(m_pDB, it.second.name.getData(), it.second.sql.getData(), 0, nullptr);
+
+                if (PQresultStatus(res) == PGRES_COMMAND_OK) {
+                    it.second.prepared = True;
+                    --m_stmtUnprepared;
+                }
+
+                PQclear(res);
+            }
+        }
+    }
+
+    if (!PQenterPipelineMode(m_pDB)) {
+        o3d::String msg;
+        msg.fromUtf8(PQerrorMessage(m_pDB));
+        O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
+    }
+
+    m_batch = True;
+    m_batchQueue.clear();
+    m_batchNext = m_batchSynced = 0;
+#else
+    O3D_ERROR(E_InvalidOperation("Pipeline mode is not supported by this libpq"));
+#endif
+}
+
+void PgSqlDb::queueBatch(PgSqlQuery *query)
+{
+    if (!m_batch) {
+        O3D_ERROR(E_InvalidOperation("No batch in progress"));
+    }
+
+    if (!query || query->m_db != this) {
+        O3D_ERROR(E_InvalidParameter("The query must be created on this connection"));
+    }
+
+    prepareStatement(query->m_stmtKey);
+
+    // parameters are copied into the libpq output buffer
+    if (!PQsendQueryPrepared(m_pDB,
+                             query->m_stmtName.getData(),
+                             query->m_numParam,
+                             query->m_params.values.data(),
+                             query->m_params.lengths.data(),
+                             query->m_params.formats.data(),
+                             1)) {    // ask for binary results
+        o3d::String msg;
+        msg.fromUtf8(PQerrorMessage(m_pDB));
+        O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
+    }
+
+    m_batchQueue.push_back(query);
+}
+
+UInt32 PgSqlDb::syncBatch()
+{
+#ifdef LIBPQ_HAS_PIPELINING
+    if (!m_batch) {
+        O3D_ERROR(E_InvalidOperation("No batch in progress"));
+    }
+
+    if (!PQpipelineSync(m_pDB)) {
+        o3d::String msg;
+        msg.fromUtf8(PQerrorMessage(m_pDB));
+        O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
+    }
+
+    m_batchQueue.push_back(nullptr);
+    m_batchSynced = m_batchQueue.size();
+
+    UInt32 count = 0;
+    for (size_t i = m_batchNext; i < m_batchSynced; ++i) {
+        if (m_batchQueue[i]) {
+            ++count;
+        }
+    }
+
+    return count;
+#else
+    return 0;
+#endif
+}
+
+PgSqlCopyWriter *PgSqlDb::newCopyWriter(
+        const CString &table,
+        const std::vector<CString> &columns,
+        UInt32 bufferSize)
+{
+    if (m_batch) {
+        O3D_ERROR(E_InvalidOperation("Cannot copy during a batch"));
+    }
+
+    makeAvailable();
+
+    return new PgSqlCopyWriter(this, table, columns, bufferSize);
+}
+
+PgSqlCopyReader *PgSqlDb::newCopyReader(const CString &query)
+{
+    if (m_batch) {
+        O3D_ERROR(E_InvalidOperation("Cannot copy during a batch"));
+    }
+
+    makeAvailable();
+
+    return new PgSqlCopyReader(this, query);
+}
+
+PgSqlQuery *PgSqlDb::nextBatchResult()
+{
+#ifdef LIBPQ_HAS_PIPELINING
+    while (m_batchNext < m_batchSynced) {
+        PgSqlQuery *query = m_batchQueue[m_batchNext++];
+        PGresult *res = PQgetResult(m_pDB);
+
+        if (!query) {
+            // end of a synced group
+            PQclear(res);
+            continue;
+        }
+
+        // each query result is followed by a null
+        PGresult *end = PQgetResult(m_pDB);
+        PQclear(end);
+
+        ExecStatusType status = PQresultStatus(res);
+        if (status == PGRES_TUPLES_OK || status == PGRES_COMMAND_OK) {
+            query->setResult(res);
+            return query;
+        }
+
+        o3d::String msg;
+        if (status == PGRES_PIPELINE_ABORTED) {
+            msg = "Query aborted by a previous error in the batch";
+        } else {
+            msg.fromUtf8(PQresultErrorMessage(res));
+        }
+
+        PQclear(res);
+        O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
+    }
+
+    // every read results
+    if (m_batchNext == m_batchQueue.size()) {
+        m_batchQueue.clear();
+        m_batchNext = m_batchSynced = 0;
+    }
+#endif
+    return nullptr;
+}
+
+void PgSqlDb::endBatch()
+{
+#ifdef LIBPQ_HAS_PIPELINING
+    if (!m_batch) {
+        return;
+    }
+
+    if (m_batchSynced < m_batchQueue.size()) {
+        syncBatch();
+    }
+
+    // discard the unread results
+    while (m_batchNext < m_batchSynced) {
+        PgSqlQuery *query = m_batchQueue[m_batchNext++];
+        PQclear(PQgetResult(m_pDB));
+
+        if (query) {
+            PQclear(PQgetResult(m_pDB));
+        }
+    }
+
+    m_batch = False;
+    m_batchQueue.clear();
+    m_batchNext = m_batchSynced = 0;
+
+    if (!PQexitPipelineMode(m_pDB)) {
+        o3d::String msg;
+        msg.fromUtf8(PQerrorMessage(m_pDB));
+        O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
+    }
+#endif
+}
+
+// Max size of a fixed size parameter, binary or formatted as text
+static const UInt32 PARAM_FIXED_SIZE = 32;
+
+// Virtual destructor
+PgSqlQuery::~PgSqlQuery()
+{
+    if (m_db) {
+        if (m_db->m_streamQuery == this) {
+            endStream(True);
+        }
+
+        if (m_updateBatch) {
+            readUpdates(False);
+        }
+
+        // results of in flight executions are dropped
+        for (PgSqlDb::AsyncOp &op : m_db->m_async) {
+            if (op.query == this) {
+                op.query = nullptr;
+            }
+        }
+
+        m_db->releaseStatement(m_stmtKey);
+        m_db->m_queries.erase(this);
+    }
+
+    for (Int32 i = 0; i < m_outputs.getSize(); ++i) {
+        deletePtr(m_outputs[i]);
+    }
+
+    if (m_pRes) {
+        PQclear(m_pRes);
+        m_pRes = nullptr;
+    }
+}
+
+UInt8 *PgSqlQuery::fixedParam(UInt32 attr)
+{
+    if (attr >= m_numParam) {
+        O3D_ERROR(E_IndexOutOfRange("Input attribute id"));
+    }
+
+    return &m_params.fixed[attr * PARAM_FIXED_SIZE];
+}
+
+UInt8 *PgSqlQuery::variableParam(UInt32 attr, UInt32 len)
+{
+    if (attr >= m_numParam) {
+        O3D_ERROR(E_IndexOutOfRange("Input attribute id"));
+    }
+
+    // only grow, the capacity is kept for the next bindings
+    std::vector<UInt8> &buffer = m_params.buffers[attr];
+    if (buffer.size() < len + 1) {
+        buffer.resize(len + 1);
+    }
+
+    return buffer.data();
+}
+
+void PgSqlQuery::bindParam(UInt32 attr, const UInt8 *data, UInt32 len, Int32 format)
+{
+    m_params.values[attr] = (const char*)data;
+    m_params.lengths[attr] = (int)len;
+    m_params.formats[attr] = format;
+}
+
+void PgSqlQuery::bindInteger(UInt32 attr, Int64 v, Bool isUnsigned)
+{
+    UInt8 *data = fixedParam(attr);
+    UInt32 len = binary::encodeInteger(m_paramTypes[attr], v, data, isUnsigned);
+
+    // as text otherwise, the server converts it or reports the out of range value
+    if (len) {
+        bindParam(attr, data, len, 1);
+    } else {
+        if (isUnsigned) {
+            len = snprintf((Char*)data, PARAM_FIXED_SIZE, "%llu", (unsigned long long)v);
+        } else {
+            len = snprintf((Char*)data, PARAM_FIXED_SIZE, "%lli", (long long)v);
+        }
+        bindParam(attr, data, len, 0);
+    }
+}
+
+void PgSqlQuery::bindReal(UInt32 attr, Double v, Bool isFloat)
+{
+    UInt8 *data = fixedParam(attr);
+    UInt32 len = binary::encodeReal(m_paramTypes[attr], v, data);
+
+    // as text otherwise, the server converts it or reports the out of range value
+    if (len) {
+        bindParam(attr, data, len, 1);
+    } else {
+        len = snprintf((Char*)data, PARAM_FIXED_SIZE, isFloat ? "%.9g" : "%.17g", v);
+        bindParam(attr, data, len, 0);
+    }
+}
+
+void PgSqlQuery::bindBytes(UInt32 attr, const UInt8 *v, UInt32 len, Int32 format)
+{
+    UInt8 *data = variableParam(attr, len);
+
+    memcpy(data, v, len);
+    data[len] = 0;  // text format needs a terminal zero
+
+    bindParam(attr, data, len, format);
+}
+
+void PgSqlQuery::setArrayUInt8(UInt32 attr, const ArrayUInt8 &v)
+{
+    bindBytes(attr, v.getData(), v.getSize(), 1);
+}
+
+void PgSqlQuery::setSmartArrayUInt8(UInt32 attr, const SmartArrayUInt8 &v)
+{
+    bindBytes(attr, v.getData(), v.getSizeInBytes(), 1);
+}
+
+void PgSqlQuery::setInStream(UInt32 attr, const InStream &v)
+{
+    if (attr >= m_numParam) {
+        O3D_ERROR(E_IndexOutOfRange("Input attribute id"));
+    }
+
+    if (!m_db) {
+        O3D_ERROR(E_InvalidOperation("The query connection is deleted"));
+    }
+
+    // the stream is read, whatever the constness imposed by DbQuery
+    InStream &is = const_cast<InStream&>(v);
+    const Oid type = m_paramTypes[attr];
+
+    if (type == binary::QBYTEAOID || binary::isTextual(type)) {
+        // read directly into the parameter buffer, growing as needed
+        UInt32 size = 0;
+        UInt32 capacity = is.getAvailable() > 0 ? (UInt32)is.getAvailable() : PgSqlDb::LO_CHUNK_SIZE;
+        UInt8 *data = variableParam(attr, capacity);
+
+        for (;;) {
+            UInt32 n = is.reader(data + size, 1, capacity - size);
+            if (n == 0) {
+                break;
+            }
+
+            size += n;
+
+            if (size == capacity) {
+                // probe for the end of the stream into the spare byte before growing,
+                // an exactly reported size must not reallocate just to read the EOF
+                if (is.reader(data + size, 1, 1) == 0) {
+                    break;
+                }
+
+                ++size;
+                capacity *= 2;
+                data = variableParam(attr, capacity);
+            }
+        }
+
+        data[size] = 0;  // text format needs a terminal zero
+        bindParam(attr, data, size, type == binary::QBYTEAOID ? 1 : 0);
+    } else if (type == binary::QOIDOID || type == binary::QINT8OID) {
+        // store into a large object and bind its oid. It is created in the transaction
+        // of the statement, so it is removed with it if the statement fails, where an
+        // implicit transaction would have committed it before
+        m_db->makeAvailable();
+
+        if (PQtransactionStatus(m_pDB) != PQTRANS_INTRANS) {
+            O3D_ERROR(E_InvalidOperation("A large object stream needs a transaction in progress"));
+        }
+
+        const Oid oid = m_db->writeLargeObject(is);
+
+        UInt8 *data = fixedParam(attr);
+        UInt32 len = binary::encodeInteger(type, (Int64)oid, data);
+
+        bindParam(attr, data, len, 1);
+    } else {
+        // an oid is unsigned, it doesn't fit an int4
+        O3D_ERROR(E_InvalidParameter("Unsupported parameter type for a stream"));
+    }
+}
+
+void PgSqlQuery::setBool(UInt32 attr, Bool v)
+{
+    UInt8 *data = fixedParam(attr);
+    UInt32 len = binary::encodeInteger(m_paramTypes[attr], v ? 1 : 0, data);
+
+    if (len) {
+        bindParam(attr, data, len, 1);
+    } else {
+        len = snprintf((Char*)data, PARAM_FIXED_SIZE, "%s", v ? "t" : "f");
+        bindParam(attr, data, len, 0);
+    }
+}
+
+void PgSqlQuery::setInt32(UInt32 attr, Int32 v)
+{
+    bindInteger(attr, v, False);
+}
+
+void PgSqlQuery::setUInt32(UInt32 attr, UInt32 v)
+{
+    bindInteger(attr, v, True);
+}
+
+void o3d::pgsql::PgSqlQuery::setInt64(UInt32 attr, Int64 v)
+{
+    bindInteger(attr, v, False);
+}
+
+void o3d::pgsql::PgSqlQuery::setUInt64(UInt32 attr, UInt64 v)
+{
+    bindInteger(attr, (Int64)v, True);
+}
+
+void o3d::pgsql::PgSqlQuery::setFloat(UInt32 attr, Float v)
+{
+    bindReal(attr, v, True);
+}
+
+void o3d::pgsql::PgSqlQuery::setDouble(UInt32 attr, Double v)
+{
+    bindReal(attr, v, False);
+}
+
+void PgSqlQuery::setNumeric(UInt32 attr, Int64 v, UInt32 scale)
+{
+    if (scale > 18) {
+        O3D_ERROR(E_InvalidParameter("Numeric scale must be at most 18"));
+    }
+
+    UInt8 *data = fixedParam(attr);
+
+    if (attr < m_numParam && m_paramTypes[attr] == binary::QNUMERICOID) {
+        bindParam(attr, data, binary::encodeNumeric(v, scale, data), 1);
+        return;
+    }
+
+    // text format
+    bindParam(attr, data, binary::formatNumeric(v, scale, (Char*)data, PARAM_FIXED_SIZE), 0);
+}
+
+void PgSqlQuery::setCString(UInt32 attr, const CString &v)
+{
+    // text format is the same as binary for textual types
+    if (attr < m_numParam && m_paramTypes[attr] == binary::QBYTEAOID) {
+        bindBytes(attr, (const UInt8*)v.getData(), v.length(), 1);
+    } else {
+        bindBytes(attr, (const UInt8*)v.getData(), v.length(), 0);
+    }
+}
+
+void PgSqlQuery::setDate(UInt32 attr, const Date &v)
+{
+    UInt8 *data = fixedParam(attr);
+
+    UInt32 len = binary::encodeTimestamp(m_paramTypes[attr], binary::fromDate(v), data);
+
+    if (len) {
+        bindParam(attr, data, len, 1);
+    } else {
+        len = snprintf((Char*)data, PARAM_FIXED_SIZE, "%04i-%02u-%02u",
+                       (Int32)v.year, (UInt32)v.month + 1, (UInt32)v.mday + 1);
+        bindParam(attr, data, len, 0);
+    }
+}
+
+void PgSqlQuery::setTimestamp(UInt32 attr, const DateTime &v)
+{
+    UInt8 *data = fixedParam(attr);
+
+    UInt32 len = binary::encodeTimestamp(m_paramTypes[attr], binary::fromDateTime(v), data);
+
+    if (len) {
+        bindParam(attr, data, len, 1);
+    } else {
+        len = snprintf((Char*)data, PARAM_FIXED_SIZE, "%04i-%02u-%02u %02u:%02u:%02u",
+                       (Int32)v.year, (UInt32)v.month + 1, (UInt32)v.mday + 1,
+                       (UInt32)v.hour, (UInt32)v.minute, (UInt32)v.second);
+        bindParam(attr, data, len, 0);
+    }
+}
+
+Oid PgSqlQuery::arrayParam(UInt32 attr) const
+{
+    if (attr >= m_numParam) {
+        O3D_ERROR(E_IndexOutOfRange("Input attribute id"));
+    }
+
+    Oid elementType = binary::arrayElementType(m_paramTypes[attr]);
+    if (!elementType) {
+        O3D_ERROR(E_InvalidParameter("Input attribute is not an array"));
+    }
+
+    return elementType;
+}
+
+static inline UInt32 encodeNumber(Oid type, Int32 v, UInt8 *out) { return binary::encodeInteger(type, v, out); }
+static inline UInt32 encodeNumber(Oid type, Int64 v, UInt8 *out) { return binary::encodeInteger(type, v, out); }
+static inline UInt32 encodeNumber(Oid type, Double v, UInt8 *out) { return binary::encodeReal(type, v, out); }
+
+template <class T>
+void PgSqlQuery::bindNumberArray(UInt32 attr, const T *v, UInt32 n)
+{
+    const Oid elementType = arrayParam(attr);
+
+    // at most 8 bytes per element, or a numeric
+    const UInt32 size = elementType == binary::QNUMERICOID ? binary::NUMERIC_FIXED_SIZE : 8;
+    UInt8 *data = variableParam(attr, binary::ARRAY_HEADER_SIZE + n * (4 + size));
+    UInt8 *out = data + binary::writeArrayHeader(data, elementType, n);
+
+    for (UInt32 i = 0; i < n; ++i) {
+        UInt32 len = encodeNumber(elementType, v[i], out + 4);
+        if (!len) {
+            O3D_ERROR(E_InvalidParameter("Unsupported array element type, or number out of its range"));
+        }
+
+        binary::writeInt32(out, (Int32)len);
+        out += 4 + len;
+    }
+
+    bindParam(attr, data, (UInt32)(out - data), 1);
+}
+
+void PgSqlQuery::setArrayInt32(UInt32 attr, const Int32 *v, UInt32 n)
+{
+    bindNumberArray(attr, v, n);
+}
+
+void PgSqlQuery::setArrayInt64(UInt32 attr, const Int64 *v, UInt32 n)
+{
+    bindNumberArray(attr, v, n);
+}
+
+void PgSqlQuery::setArrayDouble(UInt32 attr, const Double *v, UInt32 n)
+{
+    bindNumberArray(attr, v, n);
+}
+
+void PgSqlQuery::setArrayCString(UInt32 attr, const TemplateArray<CString> &v)
+{
+    const Oid elementType = arrayParam(attr);
+    if (!binary::isTextual(elementType) && elementType != binary::QBYTEAOID) {
+        O3D_ERROR(E_InvalidParameter("Unsupported array element type for a string"));
+    }
+
+    const UInt32 n = v.getSize();
+
+    UInt32 size = binary::ARRAY_HEADER_SIZE;
+    for (UInt32 i = 0; i < n; ++i) {
+        size += 4 + v[i].length();
+    }
+
+    UInt8 *data = variableParam(attr, size);
+    UInt8 *out = data + binary::writeArrayHeader(data, elementType, n);
+
+    // text and bytea binary formats are the raw bytes
+    for (UInt32 i = 0; i < n; ++i) {
+        UInt32 len = v[i].length();
+
+        binary::writeInt32(out, (Int32)len);
+        memcpy(out + 4, v[i].getData(), len);
+        out += 4 + len;
+    }
+
+    bindParam(attr, data, (UInt32)(out - data), 1);
+}
+
+void PgSqlQuery::setArrayTimestamp(UInt32 attr, const TemplateArray<DateTime> &v)
+{
+    const Oid elementType = arrayParam(attr);
+    const UInt32 n = v.getSize();
+
+    UInt8 *data = variableParam(attr, binary::ARRAY_HEADER_SIZE + n * 12);
+    UInt8 *out = data + binary::writeArrayHeader(data, elementType, n);
+
+    for (UInt32 i = 0; i < n; ++i) {
+        UInt32 len = binary::encodeTimestamp(elementType, binary::fromDateTime(v[i]), out + 4);
+        if (!len) {
+            O3D_ERROR(E_InvalidParameter("Unsupported array element type for a timestamp"));
+        }
+
+        binary::writeInt32(out, (Int32)len);
+        out += 4 + len;
+    }
+
+    bindParam(attr, data, (UInt32)(out - data), 1);
+}
+
+UInt32 PgSqlQuery::getOutAttr(const CString &name)
+{
+    Int32 attr = m_outputNames.find(name.getData(), name.length());
+    if (attr >= 0) {
+        return (UInt32)attr;
+    } else {
+        O3D_ERROR(E_InvalidParameter(o3d::String("Unknown output attribute name ") + name));
+    }
+}
+
+const DbVariable &PgSqlQuery::getOut(const CString &name) const
+{
+    Int32 attr = m_outputNames.find(name.getData(), name.length());
+    if (attr >= 0) {
+        return getOut((UInt32)attr);
+    } else {
+        O3D_ERROR(E_InvalidParameter(o3d::String("Unknown output attribute name ") + name));
+    }
+}
+
+PgSqlOutHandle PgSqlQuery::getOutHandle(const CString &name) const
+{
+    Int32 attr = m_outputNames.find(name.getData(), name.length());
+    if (attr >= 0) {
+        return PgSqlOutHandle((UInt32)attr, m_outputs[attr]);
+    } else {
+        O3D_ERROR(E_InvalidParameter(o3d::String("Unknown output attribute name ") + name));
+    }
+}
+
+const DbVariable &PgSqlQuery::getOut(UInt32 attr) const
+{
+    if (attr < (UInt32)m_outputs.getSize()) {
+        // copy an array value of the current row on its first access
+        for (Decoder &lazy : m_lazyDecoders) {
+            if (lazy.col == (Int32)attr) {
+                if (lazy.pending && m_pRes && m_currRow > 0) {
+                    const Int32 row = m_currRow - 1;
+
+                    lazy.decode(*lazy.var,
+                                PQgetvalue(m_pRes, row, lazy.col),
+                                PQgetlength(m_pRes, row, lazy.col));
+                    lazy.pending = False;
+                }
+                break;
+            }
+        }
+
+        return *m_outputs[attr];
+    } else {
+        O3D_ERROR(E_IndexOutOfRange("Output attribute is out of range"));
+    }
+}
+
+const UInt8 *PgSqlQuery::getData(UInt32 attr, UInt32 &len) const
+{
+    if (attr >= (UInt32)m_outputs.getSize()) {
+        O3D_ERROR(E_IndexOutOfRange("Output attribute is out of range"));
+    }
+
+    if (!m_pRes || m_currRow == 0) {
+        O3D_ERROR(E_InvalidOperation("No fetched row"));
+    }
+
+    // the row is fetched in the current chunk
+    Int32 row = m_currRow - 1;
+
+    if (PQgetisnull(m_pRes, row, attr)) {
+        len = 0;
+        return nullptr;
+    }
+
+    len = PQgetlength(m_pRes, row, attr);
+    return (const UInt8*)PQgetvalue(m_pRes, row, attr);
+}
+
+Bool PgSqlQuery::getNumeric(UInt32 attr, UInt32 scale, Int64 &v) const
+{
+    UInt32 len;
+    const UInt8 *data = getData(attr, len);
+
+    if (!data) {
+        v = 0;
+        return False;
+    }
+
+    if (PQftype(m_pRes, attr) != binary::QNUMERICOID) {
+        O3D_ERROR(E_InvalidParameter("Output attribute is not a numeric"));
+    }
+
+    if (!binary::decodeNumeric(data, len, scale, v)) {
+        O3D_ERROR(E_InvalidFormat("Numeric is not finite or overflows the fixed point"));
+    }
+
+    return True;
+}
+
+Bool PgSqlQuery::getEpochUs(UInt32 attr, Int64 &v) const
+{
+    UInt32 len;
+    const UInt8 *data = getData(attr, len);
+
+    if (!data) {
+        v = 0;
+        return False;
+    }
+
+    if (!binary::decodeTimestamp(PQftype(m_pRes, attr), data, v)) {
+        O3D_ERROR(E_InvalidParameter("Output attribute is not a date or a time"));
+    }
+
+    v += binary::PG_EPOCH_USECS;
+    return True;
+}
+
+Bool PgSqlQuery::arrayValue(UInt32 attr, binary::ArrayHeader &header) const
+{
+    UInt32 len;
+    const UInt8 *data = getData(attr, len);
+
+    if (!data) {
+        return False;
+    }
+
+    if (!binary::readArrayHeader(data, len, header)) {
+        O3D_ERROR(E_InvalidFormat("Invalid binary array"));
+    }
+
+    return True;
+}
+
+// Call func(data, len) for each element, with data nullptr for a NULL element.
+template <class F>
+static void forEachElement(const binary::ArrayHeader &header, F func)
+{
+    const UInt8 *data = header.elements;
+
+    for (UInt32 i = 0; i < header.count; ++i) {
+        if (data + 4 > header.end) {
+            O3D_ERROR(E_InvalidFormat("Truncated binary array"));
+        }
+
+        Int32 len = binary::readInt32(data);
+        data += 4;
+
+        if (len < 0) {
+            func(i, nullptr, 0);
+        } else {
+            if (data + len > header.end) {
+                O3D_ERROR(E_InvalidFormat("Truncated binary array"));
+            }
+
+            func(i, data, (UInt32)len);
+            data += len;
+        }
+    }
+}
+
+static void decodeInt32s(const binary::ArrayHeader &header, Int32 *out)
+{
+    if (header.elementType == binary::QINT4OID) {
+        if (!binary::decodeArrayElements(header, 4, out)) {
+            O3D_ERROR(E_InvalidFormat("Invalid binary array"));
+        }
+    } else if (header.elementType == binary::QINT2OID) {
+        forEachElement(header, [out] (UInt32 i, const UInt8 *data, UInt32 len) {
+            out[i] = data ? binary::readInt16(data) : 0;
+        });
+    } else {
+        O3D_ERROR(E_InvalidParameter("Output attribute is not an int2[] or int4[] array"));
+    }
+}
+
+static void decodeInt64s(const binary::ArrayHeader &header, Int64 *out)
+{
+    if (header.elementType == binary::QINT8OID) {
+        if (!binary::decodeArrayElements(header, 8, out)) {
+            O3D_ERROR(E_InvalidFormat("Invalid binary array"));
+        }
+    } else if (header.elementType == binary::QINT4OID) {
+        forEachElement(header, [out] (UInt32 i, const UInt8 *data, UInt32 len) {
+            out[i] = data ? binary::readInt32(data) : 0;
+        });
+    } else if (header.elementType == binary::QINT2OID) {
+        forEachElement(header, [out] (UInt32 i, const UInt8 *data, UInt32 len) {
+            out[i] = data ? binary::readInt16(data) : 0;
+        });
+    } else {
+        O3D_ERROR(E_InvalidParameter("Output attribute is not an integer array"));
+    }
+}
+
+static void decodeDoubles(const binary::ArrayHeader &header, Double *out)
+{
+    if (header.elementType == binary::QFLOAT8OID) {
+        if (!binary::decodeArrayElements(header, 8, out)) {
+            O3D_ERROR(E_InvalidFormat("Invalid binary array"));
+        }
+    } else if (header.elementType == binary::QFLOAT4OID) {
+        forEachElement(header, [out] (UInt32 i, const UInt8 *data, UInt32 len) {
+            out[i] = data ? binary::readFloat(data) : 0;
+        });
+    } else {
+        O3D_ERROR(E_InvalidParameter("Output attribute is not a float4[] or float8[] array"));
+    }
+}
+
+UInt32 PgSqlQuery::getArrayInt32(UInt32 attr, ArrayInt32 &out) const
+{
+    binary::ArrayHeader header;
+    if (!arrayValue(attr, header)) {
+        out.setSize(0);
+        return 0;
+    }
+
+    out.setSize(header.count);
+    decodeInt32s(header, out.getData());
+
+    return header.count;
+}
+
+UInt32 PgSqlQuery::getArrayInt32(UInt32 attr, SmartArrayInt32 &out) const
+{
+    binary::ArrayHeader header;
+    if (!arrayValue(attr, header)) {
+        out = SmartArrayInt32();
+        return 0;
+    }
+
+    out = SmartArrayInt32(header.count);
+    decodeInt32s(header, out.getData());
+
+    return header.count;
+}
+
+UInt32 PgSqlQuery::getArrayInt64(UInt32 attr, ArrayInt64 &out) const
+{
+    binary::ArrayHeader header;
+    if (!arrayValue(attr, header)) {
+        out.setSize(0);
+        return 0;
+    }
+
+    out.setSize(header.count);
+    decodeInt64s(header, out.getData());
+
+    return header.count;
+}
+
+UInt32 PgSqlQuery::getArrayInt64(UInt32 attr, SmartArrayInt64 &out) const
+{
+    binary::ArrayHeader header;
+    if (!arrayValue(attr, header)) {
+        out = SmartArrayInt64();
+        return 0;
+    }
+
+    out = SmartArrayInt64(header.count);
+    decodeInt64s(header, out.getData());
+
+    return header.count;
+}
+
+UInt32 PgSqlQuery::getArrayDouble(UInt32 attr, ArrayDouble &out) const
+{
+    binary::ArrayHeader header;
+    if (!arrayValue(attr, header)) {
+        out.setSize(0);
+        return 0;
+    }
+
+    out.setSize(header.count);
+    decodeDoubles(header, out.getData());
+
+    return header.count;
+}
+
+UInt32 PgSqlQuery::getArrayDouble(UInt32 attr, SmartArrayDouble &out) const
+{
+    binary::ArrayHeader header;
+    if (!arrayValue(attr, header)) {
+        out = SmartArrayDouble();
+        return 0;
+    }
+
+    out = SmartArrayDouble(header.count);
+    decodeDoubles(header, out.getData());
+
+    return header.count;
+}
+
+UInt32 PgSqlQuery::getArrayCString(UInt32 attr, TemplateArray<CString> &out) const
+{
+    binary::ArrayHeader header;
+    if (!arrayValue(attr, header)) {
+        out.setSize(0);
+        return 0;
+    }
+
+    if (!binary::isTextual(header.elementType) && header.elementType != binary::QBYTEAOID) {
+        O3D_ERROR(E_InvalidParameter("Output attribute is not a string array"));
+    }
+
+    out.setSize(header.count);
+
+    forEachElement(header, [&out] (UInt32 i, const UInt8 *data, UInt32 len) {
+        out[i] = data ? CString((const Char*)data, len) : CString();
+    });
+
+    return header.count;
+}
+
+const Char *PgSqlQuery::getText(UInt32 attr, UInt32 &len) const
+{
+    return (const Char*)getData(attr, len);
+}
+
+void PgSqlQuery::setOutDecoding(UInt32 attr, Bool decode)
+{
+    if (attr >= (UInt32)m_outputs.getSize()) {
+        O3D_ERROR(E_IndexOutOfRange("Output attribute is out of range"));
+    }
+
+    if (m_noDecode.size() <= attr) {
+        m_noDecode.resize(m_outputs.getSize(), False);
+    }
+
+    m_noDecode[attr] = !decode;
+
+    // rebuild the plan at the next result
+    m_decoderTypes.clear();
+    if (m_pRes) {
+        buildDecoders(m_pRes);
+    }
+}
+
+PgSqlQuery::PgSqlQuery(PgSqlDb *db, const String &name, const CString &query) :
+    m_name(name),
+    m_query(query),
+    m_numParam(0),
+    m_numRow(0),
+    m_currRow(0),
+    m_numAffected(0),
+    m_generatedKey(0),
+    m_updateBatch(False),
+    m_batchCount(0),
+    m_batchAffected(0),
+    m_stats(nullptr),
+    m_resultTime(0),
+    m_decodeNs(0),
+    m_streaming(False),
+    m_streamActive(False),
+    m_chunkRows(1),
+    m_rowOffset(0),
+    m_db(db),
+    m_pDB(db->m_pDB),
+    m_pRes(nullptr),
+    m_shapeId(0),
+    m_rowTag(nullptr),
+    m_rowShape(0)
+{
+    prepareQuery();
+
+    if (db->m_statsEnabled) {
+        m_stats = db->statsOf(m_name);
+    }
+
+    db->m_queries.insert(this);
+}
+
+PgSqlQuery::PgSqlQuery(const String &name, const PGresult *outputs, const Oid *paramTypes, UInt32 numParams) :
+    m_name(name),
+    m_numParam(0),
+    m_numRow(0),
+    m_currRow(0),
+    m_numAffected(0),
+    m_generatedKey(0),
+    m_updateBatch(False),
+    m_batchCount(0),
+    m_batchAffected(0),
+    m_stats(nullptr),
+    m_resultTime(0),
+    m_decodeNs(0),
+    m_streaming(False),
+    m_streamActive(False),
+    m_chunkRows(1),
+    m_rowOffset(0),
+    m_db(nullptr),
+    m_pDB(nullptr),
+    m_pRes(nullptr),
+    m_shapeId(0),
+    m_rowTag(nullptr),
+    m_rowShape(0)
+{
+    describe(outputs, paramTypes, numParams);
+}
+
+// Prepare the query server side, then describe it once to build the inputs and outputs
+void PgSqlQuery::prepareQuery()
+{
+    O3D_ASSERT(m_pDB != nullptr);
+    if (m_pDB) {
+        // shared with the queries of the same SQL
+        const PGresult *res = m_db->acquireStatement(m_query, m_stmtName, m_stmtKey);
+        describeStatement(res);
+	}
+}
+
+void PgSqlQuery::describeStatement(const PGresult *res)
+{
+    std::vector<Oid> paramTypes(PQnparams(res));
+    for (UInt32 i = 0; i < paramTypes.size(); ++i) {
+        paramTypes[i] = PQparamtype(res, i);
+    }
+
+    describe(res, paramTypes.data(), (UInt32)paramTypes.size());
+}
+
+void PgSqlQuery::describe(const PGresult *outputs, const Oid *paramTypes, UInt32 numParams)
+{
+    // inputs, the arena is allocated once here, each parameter is NULL until bound
+    m_numParam = numParams;
+    m_paramTypes.setSize(m_numParam);
+
+    m_params.values.assign(m_numParam, nullptr);
+    m_params.lengths.assign(m_numParam, 0);
+    m_params.formats.assign(m_numParam, 1);
+    m_params.fixed.assign(m_numParam * PARAM_FIXED_SIZE, 0);
+    m_params.buffers.resize(m_numParam);
+
+    for (UInt32 i = 0; i < m_numParam; ++i) {
+        m_paramTypes[i] = paramTypes[i];
+    }
+
+    // bind output types
+    o3d::Int32 nCols = PQnfields(outputs);
+    m_outputs.setSize(nCols);
+
+    UInt32 maxSize;
+    DbVariable::IntType intType;
+    DbVariable::VarType varType;
+
+    for (o3d::Int32 col = 0; col < nCols; ++col) {
+        m_outputs[col] = nullptr;
+
+        char* fname = PQfname(outputs, col);
+        if (fname == nullptr) {
+            continue;
+        }
+
+        m_outputNames.insert(fname, col);
+
+        Oid pgsqltype = PQftype(outputs, col);
+
+        unmapType(pgsqltype, maxSize, intType, varType);
+        m_outputs[col] = new PgSqlDbVariable(intType, varType, maxSize);
+    }
+}
+
+// Unbind the current bound parameters, they are sent as NULL until bound again
+void PgSqlQuery::unbind()
+{
+    for (UInt32 i = 0; i < m_numParam; ++i) {
+        bindParam(i, nullptr, 0, 1);
+    }
+}
+
+void PgSqlQuery::setStreaming(Bool streaming, UInt32 chunkRows)
+{
+    m_streaming = streaming;
+    m_chunkRows = chunkRows > 0 ? chunkRows : 1;
+}
+
+// Memory size of a result, available since libpq 12, older than the pipeline mode
+static UInt64 resultBytes(const PGresult *res)
+{
+#ifdef LIBPQ_HAS_PIPELINING
+    return res ? PQresultMemorySize(res) : 0;
+#else
+    return 0;
+#endif
+}
+
+Bool PgSqlQuery::nextChunk()
+{
+    if (m_pRes) {
+        m_rowOffset += m_numRow;
+
+        PQclear(m_pRes);
+        m_pRes = nullptr;
+    }
+
+    m_currRow = 0;
+    m_numRow = 0;
+
+    if (!m_streamActive) {
+        return False;
+    }
+
+    const UInt64 start = m_stats ? statsClock() : 0;
+
+    PGresult *res = PQgetResult(m_pDB);
+    ExecStatusType status = res ? PQresultStatus(res) : PGRES_TUPLES_OK;
+
+    if (m_stats) {
+        m_stats->recordWait(statsClock() - start);
+    }
+
+    if (status == PGRES_SINGLE_TUPLE
+#ifdef LIBPQ_HAS_CHUNK_MODE
+            || status == PGRES_TUPLES_CHUNK
+#endif
+        ) {
+        m_pRes = res;
+        m_numRow = PQntuples(m_pRes);
+
+        buildDecoders(m_pRes);
+
+        if (m_stats) {
+            m_stats->addRows(m_numRow, resultBytes(m_pRes));
+        }
+
+        return True;
+    }
+
+    // last result is empty or an error
+    o3d::String msg;
+    if (status != PGRES_TUPLES_OK) {
+        msg.fromUtf8(PQresultErrorMessage(res));
+    }
+
+    PQclear(res);
+    endStream(False);
+
+    if (status != PGRES_TUPLES_OK) {
+        if (m_stats) {
+            m_stats->addError();
+        }
+
+        O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
+    }
+
+    return False;
+}
+
+void PgSqlQuery::endStream(Bool cancel)
+{
+    if (m_streamActive) {
+        if (cancel) {
+            // don't receive the remaining rows
+            PGcancel *pCancel = PQgetCancel(m_pDB);
+            if (pCancel) {
+                char errbuf[256];
+                PQcancel(pCancel, errbuf, sizeof(errbuf));
+                PQfreeCancel(pCancel);
+            }
+        }
+
+        PGresult *res;
+        while ((res = PQgetResult(m_pDB)) != nullptr) {
+            PQclear(res);
+        }
+
+        m_streamActive = False;
+    }
+
+    if (m_db && m_db->m_streamQuery == this) {
+        m_db->m_streamQuery = nullptr;
+    }
+}
+
+// Number of rows affected by a command
+static UInt32 affectedRows(const PGresult *res)
+{
+    const char *count = PQcmdTuples(const_cast<PGresult*>(res));
+    return count[0] ? (UInt32)strtoul(count, nullptr, 10) : 0;
+}
+
+// Integer value of the first column of the first row of a result
+static Bool generatedKey(const PGresult *res, Int64 &key)
+{
+    if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) == 0 ||
+        PQnfields(res) == 0 || PQgetisnull(res, 0, 0)) {
+        return False;
+    }
+
+    const UInt8 *data = (const UInt8*)PQgetvalue(res, 0, 0);
+
+    switch (PQftype(res, 0)) {
+    case binary::QINT2OID:
+        key = binary::readInt16(data);
+        return True;
+    case binary::QINT4OID:
+        key = binary::readInt32(data);
+        return True;
+    case binary::QOIDOID:
+        key = binary::readUInt32(data);
+        return True;
+    case binary::QINT8OID:
+        key = binary::readInt64(data);
+        return True;
+    case binary::QNUMERICOID:
+        return binary::decodeNumeric(data, PQgetlength(res, 0, 0), 0, key);
+    default:
+        return False;
+    }
+}
+
+void PgSqlQuery::startFetchStats(const PGresult *res)
+{
+    m_stats->addExecution(PQntuples(res), resultBytes(res));
+
+    m_resultTime = statsClock();
+    m_decodeNs = 0;
+}
+
+void PgSqlQuery::endFetchStats()
+{
+    if (m_stats && m_resultTime) {
+        m_stats->recordDecode(m_decodeNs);
+        m_stats->recordFetch(statsClock() - m_resultTime);
+
+        m_resultTime = 0;
+    }
+}
+
+PGresult *PgSqlQuery::execPrepared(Bool retry)
+{
+    // done again only if not in a transaction, lost with the connection
+    retry = retry && PQtransactionStatus(m_pDB) == PQTRANS_IDLE;
+
+    for (;;) {
+        PGresult *res = PQexecPrepared(m_pDB,
+                                       m_stmtName.getData(),
+                                       m_numParam,
+                                       m_params.values.data(),
+                                       m_params.lengths.data(),
+                                       m_params.formats.data(),
+                                       1);      // ask for binary results
+
+        if (PQstatus(m_pDB) != CONNECTION_BAD || !m_db) {
+            return res;
+        }
+
+        // keep the error message, the connection is reset
+        o3d::String msg;
+        msg.fromUtf8(res ? PQresultErrorMessage(res) : PQerrorMessage(m_pDB));
+        PQclear(res);
+
+        if (!m_db->recover() || !retry) {
+            O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
+        }
+
+        m_db->prepareStatement(m_stmtKey);
+        retry = False;
+    }
+}
+
+void PgSqlQuery::setResult(PGresult *res)
+{
+    if (m_pRes) {
+        PQclear(m_pRes);
+    }
+
+    m_pRes = res;
+
+    m_currRow = 0;
+    m_rowOffset = 0;
+    m_numRow = res ? PQntuples(res) : 0;
+    m_numAffected = res ? affectedRows(res) : 0;
+
+    if (res) {
+        buildDecoders(res);
+
+        if (m_stats) {
+            startFetchStats(res);
+        }
+    }
+}
+
+PgSqlAsync PgSqlQuery::executeAsync()
+{
+    if (!m_db) {
+        O3D_ERROR(E_InvalidOperation("The query connection is deleted"));
+    }
+
+    if (m_streaming) {
+        O3D_ERROR(E_InvalidOperation("Streamed results cannot be executed asynchronously"));
+    }
+
+    return m_db->sendAsync(this);
+}
+
+// Execute the query with the bound parameters
+void PgSqlQuery::execute()
+{
+    // the connection must be available
+    if (m_db) {
+        m_db->makeAvailable();
+        m_db->prepareStatement(m_stmtKey);
+    }
+
+    if (m_pRes) {
+        PQclear(m_pRes);
+        m_pRes = nullptr;
+    }
+
+    m_currRow = 0;
+    m_numRow = 0;
+    m_rowOffset = 0;
+
+    if (m_streaming) {
+        if (!PQsendQueryPrepared(m_pDB,
+                                 m_stmtName.getData(),
+                                 m_numParam,
+                                 m_params.values.data(),
+                                 m_params.lengths.data(),
+                                 m_params.formats.data(),
+                                 1)) {    // ask for binary results
+            o3d::String msg;
+            msg.fromUtf8(PQerrorMessage(m_pDB));
+            O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
+        }
+
+#ifdef LIBPQ_HAS_CHUNK_MODE
+        const Bool rowMode = m_chunkRows > 1 ?
+                                 PQsetChunkedRowsMode(m_pDB, m_chunkRows) != 0 :
+                                 PQsetSingleRowMode(m_pDB) != 0;
+#else
+        const Bool rowMode = PQsetSingleRowMode(m_pDB) != 0;
+#endif
+        m_streamActive = True;
+        if (m_db) {
+            m_db->m_streamQuery = this;
+        }
+
+        // the whole result would be received at once, don't leave it pending
+        if (!rowMode) {
+            endStream(True);
+            O3D_ERROR(E_InvalidResult("Unable to stream the rows of the result"));
+        }
+
+        // the rows are counted by chunk
+        if (m_stats) {
+            m_stats->addExecution(0, 0);
+
+            m_resultTime = statsClock();
+            m_decodeNs = 0;
+        }
+
+        // wait for the first rows
+        nextChunk();
+        return;
+    }
+
+    const UInt64 start = m_stats ? statsClock() : 0;
+
+    m_pRes = execPrepared(True);
+
+    if (m_stats) {
+        m_stats->recordWait(statsClock() - start);
+    }
+
+    if (PQresultStatus(m_pRes) != PGRES_TUPLES_OK) {
+        o3d::String msg;
+        msg.fromUtf8(PQerrorMessage(m_pDB));
+        PQclear(m_pRes);
+        m_pRes = nullptr;
+
+        if (m_stats) {
+            m_stats->addError();
+        }
+
+        O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
+    }
+
+    m_currRow = 0;
+    m_numRow = PQntuples(m_pRes);
+
+    buildDecoders(m_pRes);
+
+    if (m_stats) {
+        startFetchStats(m_pRes);
+    }
+}
+
+void PgSqlQuery::update()
+{
+    if (m_updateBatch) {
+        O3D_ERROR(E_InvalidOperation("A batch of updates is in progress"));
+    }
+
+    // the connection must be available
+    if (m_db) {
+        m_db->makeAvailable();
+        m_db->prepareStatement(m_stmtKey);
+    }
+
+    if (m_pRes) {
+        PQclear(m_pRes);
+        m_pRes = nullptr;
+    }
+
+    m_currRow = 0;
+    m_numRow = 0;
+    m_rowOffset = 0;
+    m_numAffected = 0;
+    m_generatedKey = 0;
+
+    const UInt64 start = m_stats ? statsClock() : 0;
+
+    m_pRes = execPrepared(False);
+
+    if (m_stats) {
+        m_stats->recordWait(statsClock() - start);
+    }
+
+    ExecStatusType status = PQresultStatus(m_pRes);
+    if (status != PGRES_COMMAND_OK && status != PGRES_TUPLES_OK) {
+        o3d::String msg;
+        msg.fromUtf8(PQerrorMessage(m_pDB));
+        PQclear(m_pRes);
+        m_pRes = nullptr;
+
+        if (m_stats) {
+            m_stats->addError();
+        }
+
+        O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
+    }
+
+    m_numAffected = affectedRows(m_pRes);
+
+    if (m_stats && status == PGRES_COMMAND_OK) {
+        m_stats->addExecution(m_numAffected, 0);
+    }
+
+    // returned rows can be fetched
+    if (status == PGRES_TUPLES_OK) {
+        m_numRow = PQntuples(m_pRes);
+        buildDecoders(m_pRes);
+
+        if (m_stats) {
+            startFetchStats(m_pRes);
+        }
+
+        generatedKey(m_pRes, m_generatedKey);
+    }
+}
+
+static inline Bool isIdentChar(char c)
+{
+    return isalnum((unsigned char)c) || c == '_' || c == '$';
+}
+
+// Search for a RETURNING keyword, outside of the literals, the quoted identifiers,
+// the comments and the dollar quoted strings
+static Bool hasReturning(const char *sql)
+{
+    static const char KEYWORD[] = "returning";
+    static const size_t KEYWORD_LEN = sizeof(KEYWORD) - 1;
+
+    const char *p = sql;
+    const char *word = nullptr;  // start of the current identifier
+
+    while (*p) {
+        const char c = *p;
+
+        if (c == '-' && p[1] == '-') {
+            // up to the end of the line
+            while (*p && *p != '\n') {
+                ++p;
+            }
+            word = nullptr;
+        } else if (c == '/' && p[1] == '*') {
+            // block comments can be nested
+            Int32 depth = 1;
+            p += 2;
+
+            while (*p && depth > 0) {
+                if (p[0] == '/' && p[1] == '*') {
+                    ++depth;
+                    p += 2;
+                } else if (p[0] == '*' && p[1] == '/') {
+                    --depth;
+                    p += 2;
+                } else {
+                    ++p;
+                }
+            }
+            word = nullptr;
+        } else if (c == '\'' || c == '"') {
+            // a backslash escapes a char in an E'' literal only, a doubled quote is
+            // seen as the end then the start of a literal
+            const Bool escapes = c == '\'' && word && p - word == 1 && (*word == 'e' || *word == 'E');
+
+            ++p;
+            while (*p && *p != c) {
+                if (escapes && *p == '\\' && p[1]) {
+                    ++p;
+                }
+                ++p;
+            }
+
+            if (*p) {
+                ++p;
+            }
+            word = nullptr;
+        } else if (c == '$' && !word && !isdigit((unsigned char)p[1])) {
+            // a $tag$ opens a dollar quoted string up to the same $tag$, a $n is a parameter
+            const char *t = p + 1;
+            while (isalnum((unsigned char)*t) || *t == '_') {
+                ++t;
+            }
+
+            if (*t == '$') {
+                const std::string tag(p, t + 1 - p);
+                const char *close = strstr(t + 1, tag.c_str());
+
+                p = close ? close + tag.size() : t + strlen(t);
+            } else {
+                word = p++;
+            }
+        } else if (isIdentChar(c)) {
+            if (!word) {
+                word = p;
+
+                size_t i = 0;
+                while (i < KEYWORD_LEN && tolower((unsigned char)p[i]) == KEYWORD[i]) {
+                    ++i;
+                }
+
+                if (i == KEYWORD_LEN && !isIdentChar(p[i])) {
+                    return True;
+                }
+            }
+            ++p;
+        } else {
+            word = nullptr;
+            ++p;
+        }
+    }
 
-    var.setLength(dbsize);
-    m_param_bind[attr].length = (unsigned long*)var.getLengthPtr();
-*/
-    m_needBind = True;
+    return False;
 }
 
-void PgSqlQuery::setUInt32(UInt32 attr, UInt32 v)
+void PgSqlQuery::returnGeneratedKey(const CString &column)
 {
-    if (attr >= m_numParam) {
-        O3D_ERROR(E_IndexOutOfRange("Input attribute id"));
+    if (m_updateBatch) {
+        O3D_ERROR(E_InvalidOperation("A batch of updates is in progress"));
     }
 
-    if (m_inputs[attr]) {
-        deletePtr(m_inputs[attr]);
+    if (!m_db) {
+        O3D_ERROR(E_InvalidOperation("The query connection is deleted"));
     }
 
-    m_inputs[attr] = new PgSqlDbVariable(DbVariable::IT_INT32, DbVariable::UINT32, (UInt8*)&v);
-    DbVariable &var = *m_inputs[attr];
-/*
-    enum_field_types dbtype = (enum_field_types)0;
-    unsigned long dbsize = 0;
-
-    mapType(var.getType(), dbtype, dbsize);
-
-    memset(&m_param_bind[attr], 0, sizeof(MYSQL_BIND));
-
-    m_param_bind[attr].buffer_type = (enum_field_types)dbtype;
+    if (column.isEmpty()) {
+        O3D_ERROR(E_InvalidParameter("The generated key column is empty"));
+    }
 
-    m_param_bind[attr].buffer = (void*)var.getObjectPtr();
-    m_param_bind[attr].buffer_length = var.getObjectSize();
+    if (!m_keyColumn.isEmpty()) {
+        if (m_keyColumn == column) {
+            // already returned
+            return;
+        }
 
-    m_param_bind[attr].is_null = 0;
-    m_param_bind[attr].is_unsigned = True;
+        O3D_ERROR(E_InvalidOperation("Another generated key column is already returned"));
+    }
 
-    var.setLength(dbsize);
-    m_param_bind[attr].length = (unsigned long*)var.getLengthPtr();
-*/
-    m_needBind = True;
-}
+    std::string query(m_query.getData());
 
-void o3d::pgsql::PgSqlQuery::setInt64(UInt32 attr, Int64 v)
-{
-    if (attr >= m_numParam) {
-        O3D_ERROR(E_IndexOutOfRange("Input attribute id"));
+    size_t end = query.find_last_not_of(" \t\r\n");
+    if (end != std::string::npos && query[end] == ';') {
+        O3D_ERROR(E_InvalidOperation("The query must not end with a semicolon"));
     }
 
-    if (m_inputs[attr]) {
-        deletePtr(m_inputs[attr]);
+    if (hasReturning(query.c_str()) || m_outputs.getSize() > 0) {
+        O3D_ERROR(E_InvalidOperation("The query already returns rows"));
     }
 
-    m_inputs[attr] = new PgSqlDbVariable(DbVariable::IT_INT64, DbVariable::INT64, (UInt8*)&v);
-    DbVariable &var = *m_inputs[attr];
-/*
-    enum_field_types dbtype = (enum_field_types)0;
-    unsigned long dbsize = 0;
+    query += " RETURNING ";
+    query += column.getData();
 
-    mapType(var.getType(), dbtype, dbsize);
+    m_db->makeAvailable();
 
-    memset(&m_param_bind[attr], 0, sizeof(MYSQL_BIND));
+    // the query stays unchanged if the new statement cannot be prepared
+    CString sql(query.c_str());
+    CString stmtName;
+    std::string stmtKey;
 
-    m_param_bind[attr].buffer_type = (enum_field_types)dbtype;
-    m_param_bind[attr].buffer = (void*)var.getObjectPtr();
-    m_param_bind[attr].buffer_length = var.getObjectSize();
+    const PGresult *res = m_db->acquireStatement(sql, stmtName, stmtKey);
 
-    //m_param_bind[attr].is_null_value = False; @see if we support null value
-    m_param_bind[attr].is_null = 0;
+    m_db->releaseStatement(m_stmtKey);
 
-    var.setLength(dbsize);
-    m_param_bind[attr].length = (unsigned long*)var.getLengthPtr();
-*/
-    m_needBind = True;
-}
-
-void o3d::pgsql::PgSqlQuery::setUInt64(UInt32 attr, UInt64 v)
-{
-    if (attr >= m_numParam) {
-        O3D_ERROR(E_IndexOutOfRange("Input attribute id"));
+    if (m_pRes) {
+        PQclear(m_pRes);
+        m_pRes = nullptr;
     }
 
-    if (m_inputs[attr]) {
-        deletePtr(m_inputs[attr]);
-    }
+    m_currRow = m_numRow = m_rowOffset = 0;
 
-    m_inputs[attr] = new PgSqlDbVariable(DbVariable::IT_UINT64, DbVariable::UINT64, (UInt8*)&v);
-    DbVariable &var = *m_inputs[attr];
-/*
-    enum_field_types dbtype = (enum_field_types)0;
-    unsigned long dbsize = 0;
+    // there was no output, only the key column is added
+    m_outputNames.clear();
+    m_decoders.clear();
+    m_lazyDecoders.clear();
+    m_decoderTypes.clear();
+    m_noDecode.clear();
 
-    mapType(var.getType(), dbtype, dbsize);
+    m_query = sql;
+    m_stmtName = stmtName;
+    m_stmtKey = stmtKey;
+    m_keyColumn = column;
 
-    memset(&m_param_bind[attr], 0, sizeof(MYSQL_BIND));
+    describeStatement(res);
+}
 
-    m_param_bind[attr].buffer_type = (enum_field_types)dbtype;
+void PgSqlQuery::addBatch()
+{
+    if (!m_db) {
+        O3D_ERROR(E_InvalidOperation("The query connection is deleted"));
+    }
 
-    m_param_bind[attr].buffer = (void*)var.getObjectPtr();
-    m_param_bind[attr].buffer_length = var.getObjectSize();
+#ifdef LIBPQ_HAS_PIPELINING
+    if (!m_updateBatch) {
+        if (m_db->m_batch) {
+            O3D_ERROR(E_InvalidOperation("A batch is in progress on the connection"));
+        }
 
-    m_param_bind[attr].is_null = 0;
-    m_param_bind[attr].is_unsigned = True;
+        m_db->makeAvailable();
+        m_db->prepareStatement(m_stmtKey);
 
-    var.setLength(dbsize);
-    m_param_bind[attr].length = (unsigned long*)var.getLengthPtr();
-*/
-    m_needBind = True;
-}
+        if (!PQenterPipelineMode(m_pDB)) {
+            o3d::String msg;
+            msg.fromUtf8(PQerrorMessage(m_pDB));
+            O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
+        }
 
-void o3d::pgsql::PgSqlQuery::setFloat(UInt32 attr, Float v)
-{
-    if (attr >= m_numParam) {
-        O3D_ERROR(E_IndexOutOfRange("Input attribute id"));
+        m_updateBatch = True;
+        m_batchCount = 0;
+        m_batchAffected = 0;
+        m_generatedKeys.clear();
     }
 
-    if (m_inputs[attr]) {
-        deletePtr(m_inputs[attr]);
+    // parameters are copied into the libpq output buffer
+    if (!PQsendQueryPrepared(m_pDB,
+                             m_stmtName.getData(),
+                             m_numParam,
+                             m_params.values.data(),
+                             m_params.lengths.data(),
+                             m_params.formats.data(),
+                             1)) {    // ask for binary results
+        o3d::String msg;
+        msg.fromUtf8(PQerrorMessage(m_pDB));
+        readUpdates(False);
+
+        O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
     }
 
-    m_inputs[attr] = new PgSqlDbVariable(DbVariable::IT_FLOAT, DbVariable::FLOAT32, (UInt8*)&v);
-    DbVariable &var = *m_inputs[attr];
+    // read the results from time to time, the server could otherwise block on writing
+    // them while we block on sending the next updates
+    if (++m_batchCount >= BATCH_SYNC_SIZE) {
+        readUpdates(True);
+    }
+#else
+    // without pipeline, each update is done immediately
+    if (!m_updateBatch) {
+        m_updateBatch = True;
+        m_batchAffected = 0;
+        m_generatedKeys.clear();
+    }
 
-    // @todo for STMT
+    m_updateBatch = False;
+    update();
+    m_updateBatch = True;
 
-    m_needBind = True;
+    m_batchAffected += m_numAffected;
+    if (m_pRes && PQntuples(m_pRes) > 0) {
+        m_generatedKeys.push_back(m_generatedKey);
+    }
+#endif
 }
 
-void o3d::pgsql::PgSqlQuery::setDouble(UInt32 attr, Double v)
+UInt64 PgSqlQuery::executeBatch()
 {
-    if (attr >= m_numParam) {
-        O3D_ERROR(E_IndexOutOfRange("Input attribute id"));
+    if (!m_updateBatch) {
+        return 0;
     }
 
-    if (m_inputs[attr]) {
-        deletePtr(m_inputs[attr]);
+#ifdef LIBPQ_HAS_PIPELINING
+    if (m_batchCount > 0) {
+        readUpdates(True);
     }
 
-    m_inputs[attr] = new PgSqlDbVariable(DbVariable::IT_DOUBLE, DbVariable::FLOAT64, (UInt8*)&v);
-    DbVariable &var = *m_inputs[attr];
+    m_updateBatch = False;
 
-    // @todo for STMT
+    if (!PQexitPipelineMode(m_pDB)) {
+        o3d::String msg;
+        msg.fromUtf8(PQerrorMessage(m_pDB));
+        O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
+    }
+#else
+    m_updateBatch = False;
+#endif
 
-    m_needBind = True;
+    return m_batchAffected;
 }
 
-void PgSqlQuery::setCString(UInt32 attr, const CString &v)
+void PgSqlQuery::readUpdates(Bool raise)
 {
-    if (attr >= m_numParam) {
-        O3D_ERROR(E_IndexOutOfRange("Input attribute id"));
-    }
+#ifdef LIBPQ_HAS_PIPELINING
+    const UInt64 start = m_stats ? statsClock() : 0;
 
-    if (m_inputs[attr]) {
-        deletePtr(m_inputs[attr]);
-    }
+    Bool failed = !PQpipelineSync(m_pDB);
 
-    m_inputs[attr] = new PgSqlDbVariable(DbVariable::IT_CSTRING, DbVariable::VARCHAR, (UInt8*)&v);
-    DbVariable &var = *m_inputs[attr];
+    o3d::String msg;
+    if (failed) {
+        msg.fromUtf8(PQerrorMessage(m_pDB));
+    }
 
-//    int dbtype = 0;
-//    unsigned long dbsize = 0;
+    for (UInt32 i = 0; i < m_batchCount && !failed; ++i) {
+        PGresult *res = PQgetResult(m_pDB);
+        ExecStatusType status = PQresultStatus(res);
 
-//    mapType(var.getType(), dbtype, dbsize);
+        if (status == PGRES_COMMAND_OK || status == PGRES_TUPLES_OK) {
+            m_batchAffected += affectedRows(res);
 
-//    memset(&m_param_bind[attr], 0, sizeof(MYSQL_BIND));
+            if (m_stats) {
+                m_stats->addExecution(affectedRows(res), 0);
+            }
 
-//    m_param_bind[attr].buffer_type = (enum_field_types)dbtype;
-//    m_param_bind[attr].buffer = (void*)var.getObjectPtr();
-//    m_param_bind[attr].buffer_length = var.getObjectSize()-1;
+            Int64 key;
+            if (generatedKey(res, key)) {
+                m_generatedKeys.push_back(key);
+            }
+        } else if (msg.isEmpty()) {
+            // the following updates are aborted
+            msg.fromUtf8(PQresultErrorMessage(res));
 
-//    m_param_bind[attr].is_null = 0;
+            if (m_stats) {
+                m_stats->addError();
+            }
+        }
 
-//    var.setLength(var.getObjectSize()-1);
-//    m_param_bind[attr].length = (unsigned long*)var.getLengthPtr();
+        PQclear(res);
 
-    m_needBind = True;
-}
+        // each query result is followed by a null
+        PQclear(PQgetResult(m_pDB));
+    }
 
-void PgSqlQuery::setDate(UInt32 attr, const Date &v)
-{
-    if (attr >= m_numParam) {
-        O3D_ERROR(E_IndexOutOfRange("Input attribute id"));
+    // the sync point
+    if (!failed) {
+        PQclear(PQgetResult(m_pDB));
     }
 
-    if (m_inputs[attr]) {
-        deletePtr(m_inputs[attr]);
+    // a single wait for the whole pipeline
+    if (m_stats) {
+        m_stats->recordWait(statsClock() - start);
     }
 
-    m_inputs[attr] = new PgSqlDbVariable(DbVariable::IT_DATE, DbVariable::TIMESTAMP, (UInt8*)&v);
-    DbVariable &var = *m_inputs[attr];
+    m_batchCount = 0;
 
-//    MYSQL_TIME *mysqlTime = (MYSQL_TIME*)var.getObjectPtr();
-//    memset(mysqlTime, 0, sizeof(MYSQL_TIME));
+    if (!msg.isEmpty()) {
+        m_updateBatch = False;
+        PQexitPipelineMode(m_pDB);
+
+        if (raise) {
+            O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
+        }
+    }
+#endif
+}
 
-//    mysqlTime->day = v.mday + 1;
-//    mysqlTime->hour = 0;
-//    mysqlTime->minute = 0;
-//    mysqlTime->month = v.month + 1;
-//    mysqlTime->second = 0;
-//    mysqlTime->time_type = MYSQL_TIMESTAMP_DATETIME;
-//    mysqlTime->year = v.year;
+UInt32 PgSqlQuery::getNumRows()
+{
+    // affected rows of a command without result rows
+    if (m_pRes && PQresultStatus(m_pRes) == PGRES_COMMAND_OK) {
+        return m_numAffected;
+    }
 
-//    enum_field_types dbtype = (enum_field_types)0;
-//    unsigned long dbsize = 0;
+    // for a streamed result, the number of rows received so far
+    return m_rowOffset + m_numRow;
+}
 
-//    mapType(var.getType(), dbtype, dbsize);
+UInt64 PgSqlQuery::getGeneratedKey() const
+{
+    return (UInt64)m_generatedKey;
+}
 
-//    memset(&m_param_bind[attr], 0, sizeof(MYSQL_BIND));
+// Fetch the results (outputs values) into the DbAttribute. Can be called in a while for each entry of the result.
+Bool PgSqlQuery::fetch()
+{
+    if (nextRow()) {
+        const Int32 row = m_currRow - 1;
+        const UInt64 start = m_stats ? statsClock() : 0;
+
+        // run the decoding plan, no dispatch on the variable type per value
+        const Decoder *decoder = m_decoders.data();
+        const Decoder *end = decoder + m_decoders.size();
+
+        for (; decoder != end; ++decoder) {
+            if (PQgetisnull(m_pRes, row, decoder->col)) {
+                *decoder->isNull = 1;
+            } else {
+                *decoder->isNull = 0;
+                decoder->decode(*decoder->var,
+                                PQgetvalue(m_pRes, row, decoder->col),
+                                PQgetlength(m_pRes, row, decoder->col));
+            }
+        }
 
-//    m_param_bind[attr].buffer_type = (enum_field_types)dbtype;
-//    m_param_bind[attr].buffer = (void*)var.getObjectPtr();
-//    m_param_bind[attr].buffer_length = dbsize;
+        for (Decoder &lazy : m_lazyDecoders) {
+            lazy.pending = !PQgetisnull(m_pRes, row, lazy.col);
+            *lazy.isNull = lazy.pending ? 0 : 1;
+        }
 
-//    m_param_bind[attr].is_null = 0;
+        if (m_stats) {
+            m_decodeNs += statsClock() - start;
+        }
 
-//    var.setLength(dbsize);
-//    m_param_bind[attr].length = (unsigned long*)var.getLengthPtr();
+        return True;
+    }
 
-//    m_needBind = True;
+    return False;
 }
 
-void PgSqlQuery::setTimestamp(UInt32 attr, const DateTime &v)
+Bool PgSqlQuery::nextRow()
 {
-    if (attr >= m_numParam) {
-        O3D_ERROR(E_IndexOutOfRange("Input attribute id"));
+    // next chunk of a streamed result
+    if (m_pRes && m_currRow >= m_numRow && m_streamActive) {
+        nextChunk();
     }
 
-    if (m_inputs[attr]) {
-        deletePtr(m_inputs[attr]);   
+    if (m_pRes && m_currRow < m_numRow) {
+        ++m_currRow;
+        return True;
     }
 
-    m_inputs[attr] = new PgSqlDbVariable(DbVariable::IT_DATETIME, DbVariable::TIMESTAMP, (UInt8*)&v);
-    DbVariable &var = *m_inputs[attr];
-
-//    MYSQL_TIME *mysqlTime = (MYSQL_TIME*)var.getObjectPtr();
-//    memset(mysqlTime, 0, sizeof(MYSQL_TIME));
-
-//    mysqlTime->day = v.mday + 1;
-//    mysqlTime->hour = v.hour;
-//    mysqlTime->minute = v.minute;
-//    mysqlTime->month = v.month + 1;
-//    mysqlTime->second = v.second;
-//    mysqlTime->time_type = MYSQL_TIMESTAMP_DATETIME;
-//    mysqlTime->year = v.year;
-
-//    enum_field_types dbtype = (enum_field_types)0;
-//    unsigned long dbsize = 0;
-
-//    mapType(var.getType(), dbtype, dbsize);
-
-//    memset(&m_param_bind[attr], 0, sizeof(MYSQL_BIND));
-
-//    m_param_bind[attr].buffer_type = (enum_field_types)dbtype;
-//    m_param_bind[attr].buffer = (void*)var.getObjectPtr();
-//    m_param_bind[attr].buffer_length = dbsize;
+    endFetchStats();
+    return False;
+}
 
-//    m_param_bind[attr].is_null = 0;
+void PgSqlQuery::checkRow(const void *tag, const AcceptFunc *accepts, UInt32 count)
+{
+    if (count > (UInt32)PQnfields(m_pRes)) {
+        O3D_ERROR(E_InvalidParameter("More row values than result columns"));
+    }
 
-//    var.setLength(dbsize);
-//    m_param_bind[attr].length = (unsigned long*)var.getLengthPtr();
+    for (UInt32 i = 0; i < count; ++i) {
+        if (!accepts[i](PQftype(m_pRes, i))) {
+            O3D_ERROR(E_InvalidParameter(o3d::String("Incompatible type for the result column ") +
+                                         CString(PQfname(m_pRes, i))));
+        }
+    }
 
-//    m_needBind = True;
+    m_rowTag = tag;
+    m_rowShape = m_shapeId;
 }
 
-UInt32 PgSqlQuery::getOutAttr(const CString &name)
+static void decodeBool(DbVariable &var, const char *value, Int32 len)
 {
-    auto it = m_outputNames.find(name);
-    if (it != m_outputNames.end()) {
-        return it->second;
-    } else {
-        O3D_ERROR(E_InvalidParameter(o3d::String("Unknown output attribute name ") + name));
-    }
+    var.setBool(value[0] != 0);
 }
 
-const DbVariable &PgSqlQuery::getOut(const CString &name) const
+static void decodeInt16(DbVariable &var, const char *value, Int32 len)
 {
-    auto it = m_outputNames.find(name);
-    if (it != m_outputNames.end()) {
-        return *m_outputs[it->second];
-    } else {
-        O3D_ERROR(E_InvalidParameter(o3d::String("Unknown output attribute name ") + name));
-    }
+    var.setInt32(binary::readInt16((const UInt8*)value));
 }
 
-const DbVariable &PgSqlQuery::getOut(UInt32 attr) const
+static void decodeInt32(DbVariable &var, const char *value, Int32 len)
 {
-    if (attr < (UInt32)m_outputs.getSize()) {
-        return *m_outputs[attr];
-    } else {
-        O3D_ERROR(E_IndexOutOfRange("Output attribute is out of range"));
-    }
+    var.setInt32(binary::readInt32((const UInt8*)value));
 }
 
-PgSqlQuery::PgSqlQuery(PGconn *pDb, const String &name, const CString &query) :
-    m_name(name),
-    m_query(query),
-    m_numParam(0),
-    m_numRow(0),
-    m_currRow(0),
-    m_pDB(pDb),
-    m_pRes(nullptr)
+static void decodeUInt32(DbVariable &var, const char *value, Int32 len)
 {
-    prepareQuery();
+    var.setUInt32(binary::readUInt32((const UInt8*)value));
 }
 
-// Prepare the query. Can do nothing if not preparation is needed
-void PgSqlQuery::prepareQuery()
+static void decodeInt64(DbVariable &var, const char *value, Int32 len)
 {
-    O3D_ASSERT(m_pDB != nullptr);
-    if (m_pDB) {
-        // @todo later stmt, but for no simple
-
-        // inputs
-        o3d::String str(m_query);
-
-        m_numParam = str.count('$');   // probably no sufficient
-        m_inputs.setSize(m_numParam);
-        // m_outputs
-        // m_outputNames
-
-        // https://docs.postgresql.fr/12/libpq-exec.html
-        // PGresult *PQprepare(PGconn *conn, const char *stmtName, const char *query, int nParams, const Oid *paramTypes);
-        // PGresult *PQdescribePrepared(PGconn *conn, const char *stmtName);
-
-        m_needBind = True;
-	}
+    var.setInt64(binary::readInt64((const UInt8*)value));
 }
 
-// Unbind the current bound DbAttribute
-void PgSqlQuery::unbind()
+static void decodeFloat4(DbVariable &var, const char *value, Int32 len)
 {
-
+    var.setDouble(binary::readFloat((const UInt8*)value));
 }
 
-// Execute the query on the current bound DbAttribute and store the result in the DbAttribute
-void PgSqlQuery::execute()
+static void decodeFloat8(DbVariable &var, const char *value, Int32 len)
 {
-    if (m_pRes) {
-        PQclear(m_pRes);
-        m_pRes = nullptr;
-    }
-
-    // const Oid *paramTypes;
-    char **paramValues = new char*[m_numParam];
-    Oid *paramTypes = nullptr;  // new Oid[m_numParam];    // let the backend deduce param type
-    int *paramLengths = nullptr;  // new int[m_numParam];  // if all texts no need
-    int *paramFormats = nullptr;  // default to all text params
-
-    for (o3d::Int32 i = 0; i < m_inputs.getSize(); ++i) {
-        if (m_inputs[i]->getIntType() == DbVariable::IT_CSTRING) {
-            CString v = m_inputs[i]->asCString();
-
-            // paramTypes[i] = 0;
-            paramValues[i] = new char[v.length()+1];
-            // paramLengths[i] = -1;
-            memcpy(paramValues[i], v.getData(), v.length()+1);
-
-        } else if (m_inputs[i]->getIntType() == DbVariable::IT_INT32) {
-            o3d::Int32 v = m_inputs[i]->asInt32();
-
-            o3d::Int32 l = snprintf(nullptr, 0, "%i", v);
-            Char *str = new Char[l+1];
-            sprintf(str, "%i", v);
+    var.setDouble(binary::readDouble((const UInt8*)value));
+}
 
-            // paramTypes[i] = 0;
-            paramValues[i] = str;
-            // paramLengths[i] = -1;
+static void decodeNumeric(DbVariable &var, const char *value, Int32 len)
+{
+    var.setDouble(binary::decodeNumeric((const UInt8*)value, len));
+}
 
-        } else if (m_inputs[i]->getIntType() == DbVariable::IT_INT64) {
-            o3d::Int64 v = m_inputs[i]->asInt64();
+static void decodeDate(DbVariable &var, const char *value, Int32 len)
+{
+    Date date;
+    binary::toDate(binary::readInt32((const UInt8*)value), date);
+    var.setDate(date);
+}
 
-            o3d::Int32 l = snprintf(nullptr, 0, "%lli", v);
-            Char *str = new Char[l+1];
-            sprintf(str, "%lli", v);
+static void decodeTimestampDate(DbVariable &var, const char *value, Int32 len)
+{
+    Date date;
+    binary::toDate(binary::readInt64((const UInt8*)value), date);
+    var.setDate(date);
+}
 
-            // paramTypes[i] = 0;
-            paramValues[i] = str;
-            // paramLengths[i] = -1;
+static void decodeDateTime(DbVariable &var, const char *value, Int32 len)
+{
+    DateTime date;
+    binary::toDateTime(binary::readInt32((const UInt8*)value) * binary::USECS_PER_DAY, date);
+    var.setDateTime(date);
+}
 
-        } else if (m_inputs[i]->getIntType() == DbVariable::IT_ARRAY_UINT8) {
+static void decodeTimestamp(DbVariable &var, const char *value, Int32 len)
+{
+    DateTime date;
+    binary::toDateTime(binary::readInt64((const UInt8*)value), date);
+    var.setDateTime(date);
+}
 
-            // @todo
+static void decodeTimeTz(DbVariable &var, const char *value, Int32 len)
+{
+    Int64 usecs;
+    binary::decodeTimestamp(binary::QTIMETZOID, (const UInt8*)value, usecs);
 
-        } else if (m_inputs[i]->getIntType() == DbVariable::IT_FLOAT) {
-            o3d::Float v = m_inputs[i]->asFloat();
+    DateTime date;
+    binary::toDateTime(usecs, date);
+    var.setDateTime(date);
+}
 
-            o3d::Int32 l = snprintf(nullptr, 0, "%g", v);
-            Char *str = new Char[l+1];
-            sprintf(str, "%g", v);
+static void decodeCString(DbVariable &var, const char *value, Int32 len)
+{
+    // libpq adds a terminal zero
+    var.setCString(value);
+}
 
-            // paramTypes[i] = 0;
-            paramValues[i] = str;
-            // paramLengths[i] = -1;
+static void decodeArrayChar(DbVariable &var, const char *value, Int32 len)
+{
+    ArrayChar *array = (ArrayChar*)var.getObject();
 
-        } else if (m_inputs[i]->getIntType() == DbVariable::IT_DOUBLE) {
-            o3d::Double v = m_inputs[i]->asDouble();
+    // add a terminal zero
+    array->setSize(len+1);
+    memcpy(array->getData(), value, len);
+    (*array)[array->getSize()-1] = 0;
+}
 
-            o3d::Int32 l = snprintf(nullptr, 0, "%g", v);
-            Char *str = new Char[l+1];
-            sprintf(str, "%g", v);
+static void decodeArrayUInt8(DbVariable &var, const char *value, Int32 len)
+{
+    ArrayUInt8 *array = (ArrayUInt8*)var.getObject();
 
-            // paramTypes[i] = 0;
-            paramValues[i] = str;
-            // paramLengths[i] = -1;
+    array->setSize(len);
+    memcpy(array->getData(), value, len);
+}
 
-        } else {
-            // @todo others ...
+PgSqlQuery::DecodeFunc PgSqlQuery::decoderOf(Oid type, DbVariable::IntType intType)
+{
+    switch (intType) {
+    case DbVariable::IT_BOOL:
+        return decodeBool;
+    case DbVariable::IT_INT32:
+        if (type == binary::QINT2OID) {
+            return decodeInt16;
+        }
+        return decodeInt32;
+    case DbVariable::IT_UINT32:
+        return decodeUInt32;
+    case DbVariable::IT_INT64:
+        return decodeInt64;
+    case DbVariable::IT_DOUBLE:
+        if (type == binary::QFLOAT4OID) {
+            return decodeFloat4;
+        } else if (type == binary::QFLOAT8OID) {
+            return decodeFloat8;
+        } else if (type == binary::QNUMERICOID) {
+            return decodeNumeric;
         }
+        return nullptr;
+    case DbVariable::IT_CSTRING:
+        return decodeCString;
+    case DbVariable::IT_ARRAY_CHAR:
+        return decodeArrayChar;
+    case DbVariable::IT_ARRAY_UINT8:
+        return decodeArrayUInt8;
+    case DbVariable::IT_DATE:
+        if (type == binary::QDATEOID) {
+            return decodeDate;
+        } else if (type == binary::QTIMESTAMPOID || type == binary::QTIMESTAMPTZOID) {
+            return decodeTimestampDate;
+        }
+        return nullptr;
+    case DbVariable::IT_DATETIME:
+        if (type == binary::QDATEOID) {
+            return decodeDateTime;
+        } else if (type == binary::QTIMEOID || type == binary::QTIMESTAMPOID || type == binary::QTIMESTAMPTZOID) {
+            return decodeTimestamp;
+        } else if (type == binary::QTIMETZOID) {
+            return decodeTimeTz;
+        }
+        return nullptr;
+    default:
+        return nullptr;
     }
+}
 
-    // PGresult *res = PQexecPrepared(...)
-    m_pRes = PQexecParams(m_pDB,
-                       m_query.getData(),
-                       m_numParam,
-                       paramTypes,
-                       paramValues,
-                       paramLengths,
-                       paramFormats,
-                       1);      // ask for binary results
+void PgSqlQuery::buildDecoders(const PGresult *res)
+{
+    const UInt32 numCols = PQnfields(res);
 
-    if (PQresultStatus(m_pRes) != PGRES_TUPLES_OK) {
-        o3d::String msg;
-        msg.fromUtf8(PQerrorMessage(m_pDB));
-        O3D_ERROR(o3d::pgsql::E_PgSqlError(msg));
-        PQclear(m_pRes);
-        m_pRes = nullptr;
-    }
+    // the plan is kept while the row description is the same
+    if (numCols == m_decoderTypes.size()) {
+        UInt32 i = 0;
+        while (i < numCols && m_decoderTypes[i] == PQftype(res, i)) {
+            ++i;
+        }
 
-    m_currRow = 0;
-    m_numRow = PQntuples(m_pRes);
+        if (i == numCols) {
+            return;
+        }
+    }
 
-    // bind output types
-    o3d::Int32 nCols = PQnfields(m_pRes);
+    m_decoders.clear();
+    m_lazyDecoders.clear();
+    m_decoderTypes.resize(numCols);
 
-    UInt32 maxSize;
-    DbVariable::IntType intType;
-    DbVariable::VarType varType;
+    ++m_shapeId;
 
-    o3d::Bool initial = m_outputNames.empty();
+    for (UInt32 i = 0; i < numCols; ++i) {
+        m_decoderTypes[i] = PQftype(res, i);
 
-    // int PQfnumber(const PGresult *res,const char *column_name); inverse de PQfname
-    for (o3d::Int32 col = 0; col < nCols; ++col) {
-        char* fname = PQfname(m_pRes, col);
-        if (fname == nullptr) {
+        if ((Int32)i >= m_outputs.getSize() || m_outputs[i] == nullptr) {
             continue;
         }
 
-        if (initial) {
-            m_outputNames.insert(std::make_pair(fname, col));
+        if (i < m_noDecode.size() && m_noDecode[i]) {
+            continue;
         }
 
-        Oid pgsqltype = PQftype(m_pRes, col);
-        int size = PQfsize(m_pRes, col);
-        int mod = PQfmod(m_pRes, col);
-
-        unmapType(pgsqltype, maxSize, intType, varType);
-        // printf("%s : %i = %i(%i) (%i %i)\n", fname, col, pgsqltype, intType, size, mod);
-
-        if (m_outputs[col] == nullptr) {
-            // only the first time
-            m_outputs[col] = new PgSqlDbVariable(intType, varType, maxSize);
+        DbVariable *var = m_outputs[i];
+        DecodeFunc decode = decoderOf(m_decoderTypes[i], var->getIntType());
+
+        if (decode) {
+            Decoder decoder;
+            decoder.decode = decode;
+            decoder.var = var;
+            decoder.isNull = var->getIsNullPtr();
+            decoder.col = (Int32)i;
+            decoder.pending = False;
+
+            // an array is only copied into its variable when accessed by getOut,
+            // the typed array getters decode it from the result
+            if (binary::arrayElementType(m_decoderTypes[i])) {
+                m_lazyDecoders.push_back(decoder);
+            } else {
+                m_decoders.push_back(decoder);
+            }
         }
     }
-
-    // free input parameters
-    for (o3d::UInt32 i = 0; i < m_numParam; ++i) {
-        deletePtr(paramValues[i]);
-    }
-
-    deletePtr(paramValues);
-}
-
-void PgSqlQuery::update()
-{
-//    O3D_ASSERT(m_stmt != nullptr);
-
-//    if (m_stmt) {
-//        m_numRow = 0;
-//        m_currRow = 0;
-
-//        // bind if necessary
-//        if (m_needBind) {
-//            if (mysql_stmt_bind_param(m_stmt, &m_param_bind[0]) != 0) {
-//                O3D_ERROR(E_MySqlError(mysql_stmt_error(m_stmt)));
-//            }
-
-//            m_needBind = False;
-//        }
-
-//        if (mysql_stmt_execute(m_stmt) != 0) {
-//            O3D_ERROR(E_MySqlError(mysql_stmt_error(m_stmt)));
-//        }
-
-//        m_numRow = mysql_stmt_affected_rows(m_stmt);
-//    }
 }
 
-UInt32 PgSqlQuery::getNumRows()
+UInt32 PgSqlQuery::fetchBatch(PgSqlColumns &columns, UInt32 maxRows)
 {
-    return m_numRow;
-}
+    if (!m_pRes) {
+        columns.clear();
+        return 0;
+    }
 
-UInt64 PgSqlQuery::getGeneratedKey() const
-{
-//    O3D_ASSERT(m_stmt != nullptr);
-//    if (m_stmt) {
-//        UInt64 id = mysql_stmt_insert_id(m_stmt);
-//        return id;
-//    }
+    if (!columns.setup(m_pRes)) {
+        columns.clear();
+    }
 
-    return 0;
-}
+    UInt32 count = 0;
 
-// Fetch the results (outputs values) into the DbAttribute. Can be called in a while for each entry of the result.
-Bool PgSqlQuery::fetch()
-{
-    if (m_pRes) {
+    while (count < maxRows) {
+        // next chunk of a streamed result
         if (m_currRow >= m_numRow) {
-            return False;
-        }
+            if (!m_streamActive || !nextChunk()) {
+                endFetchStats();
+                break;
+            }
 
-         // int PQfnumber(const PGresult *res,const char *column_name); inverse de PQfname
-        for (o3d::Int32 i = 0; i < m_outputs.getSize(); ++i) {
-            DbVariable &var = *m_outputs[i];
-            char* value = PQgetvalue(m_pRes, m_currRow, i);
-            int len = PQgetlength(m_pRes, m_currRow, i);
+            continue;
+        }
 
-            if (var.getIntType() == DbVariable::IT_INT32) {
-                // int32
-                var.setInt32(ntohl(*((int32_t *) value)));
-                // printf("int32 %i = %i\n", i, var.asInt32());
+        UInt32 n = m_numRow - m_currRow;
+        if (n > maxRows - count) {
+            n = maxRows - count;
+        }
 
-            } else if (var.getIntType() == DbVariable::IT_INT64) {
-                // int64
-                if (System::getNativeByteOrder() != System::ORDER_BIG_ENDIAN) {
-                    System::swapBytes8(value);
-                }
-                var.setInt64(*(o3d::Int64 *) value);
-                // printf("int64 %i %lli\n", i, var.asInt64());
+        const UInt64 start = m_stats ? statsClock() : 0;
 
-            } else if (var.getIntType() == DbVariable::IT_FLOAT) {
-                // double
-                if (System::getNativeByteOrder() != System::ORDER_BIG_ENDIAN) {
-                    System::swapBytes4(value);
-                }
-                var.setFloat(*(o3d::Float*) value);
-                // printf("float %i %f\n", i, var.asFloat());
+        columns.append(m_pRes, m_currRow, n);
 
-            } else if (var.getIntType() == DbVariable::IT_DOUBLE) {
-                // double
-                if (System::getNativeByteOrder() != System::ORDER_BIG_ENDIAN) {
-                    System::swapBytes8(value);
-                }
-                var.setDouble(*(o3d::Double *) value);
-                // printf("double %i %f\n", i, var.asDouble());
-
-            } else if (var.getIntType() == DbVariable::IT_ARRAY_CHAR) {
-                // string
-                ArrayChar *array = (ArrayChar*)var.getObject();
-                // printf("str %i %i %s\n", i, len, value);
-
-                // add a terminal zero
-                array->setSize(len+1);
-                memcpy(array->getData(), value, len);
-                (*array)[array->getSize()-1] = 0;
-
-            } else if (var.getIntType() == DbVariable::IT_CSTRING) {
-                // string
-                // printf("str %i %i %s\n", i, len, value);
-                var.setCString(value);
-            }
-            // array
-//            else if (var.getIntType() == DbVariable::IT_ARRAY_UINT8) {
-//                ArrayUInt8 *array = (ArrayUInt8*)var.getObject();
-//                array->setSize(var.getLength());
-//			}
-//            // date
-//            else if (var.getIntType() == DbVariable::IT_DATE) {
-//                Date *date = (Date*)var.getObject();
-//                MYSQL_TIME *mysqlTime = (MYSQL_TIME*)var.getObjectPtr();
-//                date->day = Day(mysqlTime->day - 1);
-//                date->month = Month(mysqlTime->month - 1);
-//                date->year = mysqlTime->year;
-//            }
-//            // datetime
-//            else if (var.getIntType() == DbVariable::IT_DATETIME) {
-//                DateTime *datetime = (DateTime*)var.getObject();
-//                MYSQL_TIME *mysqlTime = (MYSQL_TIME*)var.getObjectPtr();
-//                datetime->day = Day(mysqlTime->day - 1);
-//                datetime->hour = mysqlTime->hour;
-//                datetime->minute = mysqlTime->minute;
-//                datetime->month = Month(mysqlTime->month - 1);
-//                datetime->second = mysqlTime->second;
-//                datetime->year = mysqlTime->year;
-//            }
+        if (m_stats) {
+            m_decodeNs += statsClock() - start;
         }
 
-        ++m_currRow;
-        return True;
+        m_currRow += n;
+        count += n;
     }
 
-    return False;
+    return count;
+}
+
+UInt32 PgSqlQuery::fetchColumns(PgSqlColumns &columns)
+{
+    return fetchBatch(columns, 0xffffffff);
 }
 
 UInt32 PgSqlQuery::tellRow()
 {
     if (m_pRes) {
-        return m_currRow;
+        return m_rowOffset + m_currRow;
     } else {
         return 0;
     }
@@ -970,6 +3333,10 @@ UInt32 PgSqlQuery::tellRow()
 
 void PgSqlQuery::seekRow(UInt32 row)
 {
+    if (m_streaming) {
+        O3D_ERROR(E_InvalidOperation("Streamed results can only be fetched forward"));
+    }
+
     if (row >= m_numRow) {
         O3D_ERROR(E_IndexOutOfRange("Row number"));
     }
@@ -986,7 +3353,7 @@ void PgSqlQuery::unmapType(Oid pgsqltype,
         DbVariable::VarType &varType)
 {
     switch (pgsqltype) {
-    case QBOOLOID:
+    case binary::QBOOLOID:
         intType = DbVariable::IT_BOOL;
         varType = DbVariable::BOOLEAN;
         maxSize = 1;
@@ -1010,18 +3377,23 @@ void PgSqlQuery::unmapType(Oid pgsqltype,
 //        maxSize = 4;
 //        break;
 
-    case QINT2OID:
-    case QINT4OID:
-    case QOIDOID:
-    case QREGPROCOID:
-    case QXIDOID:
-    case QCIDOID:
+    case binary::QINT2OID:
+    case binary::QINT4OID:
         intType = DbVariable::IT_INT32;
         varType = DbVariable::INT32;
         maxSize = 4;
         break;
 
-    case QINT8OID:
+    case binary::QOIDOID:
+    case binary::QREGPROCOID:
+    case binary::QXIDOID:
+    case binary::QCIDOID:
+        intType = DbVariable::IT_UINT32;
+        varType = DbVariable::UINT32;
+        maxSize = 4;
+        break;
+
+    case binary::QINT8OID:
         intType = DbVariable::IT_INT64;
         varType = DbVariable::INT64;
         maxSize = 8;
@@ -1033,21 +3405,14 @@ void PgSqlQuery::unmapType(Oid pgsqltype,
 //        maxSize = 4;
 //        break;
 
-    case QNUMERICOID:
-    case QFLOAT4OID:
-    case QFLOAT8OID:
+    case binary::QNUMERICOID:
+    case binary::QFLOAT4OID:
+    case binary::QFLOAT8OID:
         intType = DbVariable::IT_DOUBLE;
         varType = DbVariable::FLOAT64;
         maxSize = 8;
         break;
 
-//    case SMVARCHAR_ARRAYOID:
-//    case SMTEXT_ARRAYOID:
-//        intType = DbVariable::IT_ARRAY_CHAR;
-//        varType = DbVariable::ARRAY;
-//        maxSize = 256;
-//        break;
-
 //    case MYSQL_TYPE_VAR_STRING:
 //        intType = DbVariable::IT_ARRAY_CHAR;
 //        varType = DbVariable::ARRAY;
@@ -1072,33 +3437,50 @@ void PgSqlQuery::unmapType(Oid pgsqltype,
 //        maxSize = 4096;
 //        break;
 
-    case QBYTEAOID:
+    case binary::QBYTEAOID:
         intType = DbVariable::IT_ARRAY_UINT8;
         varType = DbVariable::LONG_ARRAY;
         maxSize = 4096;
         break;
 
-//    case QABSTIMEOID:
-//    case QRELTIMEOID:
-//    case QDATEOID:
-//        intType = DbVariable::IT_DATE
-//        varType = DbVariable::TIMESTAMP;
-//        maxSize = xxx
-//        break;
+    // binary arrays, decoded with the getArray* methods
+    case binary::SMBOOL_ARRAYOID:
+    case binary::SMINT2_ARRAYOID:
+    case binary::SMINT4_ARRAYOID:
+    case binary::SMINT8_ARRAYOID:
+    case binary::SMNUMERIC_ARRAYOID:
+    case binary::SMFLOAT4_ARRAYOID:
+    case binary::SMFLOAT8_ARRAYOID:
+    case binary::SMDATE_ARRAYOID:
+    case binary::SMTIME_ARRAYOID:
+    case binary::SMTIMETZ_ARRAYOID:
+    case binary::SMTIMESTAMP_ARRAYOID:
+    case binary::SMTIMESTAMPTZ_ARRAYOID:
+    case binary::SMBYTEA_ARRAYOID:
+    case binary::SMJSON_ARRAYOID:
+    case binary::SMJSONB_ARRAYOID:
+    case binary::SMVARCHAR_ARRAYOID:
+    case binary::SMTEXT_ARRAYOID:
+        intType = DbVariable::IT_ARRAY_UINT8;
+        varType = DbVariable::LONG_ARRAY;
+        maxSize = 4096;
+        break;
 
-//    case QTIMEOID:
-//    case QTIMETZOID:
-//        intType = DbVariable::IT_DATETIME
-//        varType = DbVariable::TIMESTAMP;
-//        maxSize = xxx
-//        break;
+    case binary::QDATEOID:
+        intType = DbVariable::IT_DATE;
+        varType = DbVariable::TIMESTAMP;
+        maxSize = sizeof(Date);
+        break;
 
-//    case QTIMESTAMPOID:
-//    case QTIMESTAMPTZOID:
-//        intType = DbVariable::IT_DATE;
-//        varType = DbVariable::TIMESTAMP;
-//        maxSize = xxx
-//        break;
+    // a time is decoded as 2000-01-01 at this time
+    case binary::QTIMEOID:
+    case binary::QTIMETZOID:
+    case binary::QTIMESTAMPOID:
+    case binary::QTIMESTAMPTZOID:
+        intType = DbVariable::IT_DATETIME;
+        varType = DbVariable::TIMESTAMP;
+        maxSize = sizeof(DateTime);
+        break;
 
     case 1043:
     default:
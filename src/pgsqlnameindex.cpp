@@ -0,0 +1,108 @@
+/**
+ * @file pgsqlnameindex.cpp
+ * @brief
+ * @author Frederic SCHERMA (frederic.scherma@dreamoverflow.org)
+ * @date 2019-03-09
+ * @copyright Copyright (c) 2001-2019 Dream Overflow. All rights reserved.
+ * @details
+ */
+
+#include "o3d/pgsql/pgsqlnameindex.h"
+
+using namespace o3d;
+using namespace o3d::pgsql;
+
+PgSqlNameIndex::PgSqlNameIndex() :
+    m_size(0)
+{
+
+}
+
+void PgSqlNameIndex::clear()
+{
+    m_size = 0;
+    m_slots.clear();
+    m_names.clear();
+}
+
+UInt32 PgSqlNameIndex::hash(const Char *name, size_t len)
+{
+    // FNV-1a
+    UInt32 h = 2166136261u;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (UInt8)name[i];
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+void PgSqlNameIndex::grow()
+{
+    std::vector<Slot> slots(m_slots.empty() ? 16 : m_slots.size() * 2);
+    const UInt32 mask = (UInt32)slots.size() - 1;
+
+    for (const Slot &slot : m_slots) {
+        if (slot.len) {
+            UInt32 i = slot.hash & mask;
+            while (slots[i].len) {
+                i = (i + 1) & mask;
+            }
+
+            slots[i] = slot;
+        }
+    }
+
+    m_slots.swap(slots);
+}
+
+void PgSqlNameIndex::insert(const Char *name, UInt32 id)
+{
+    const size_t len = strlen(name);
+
+    // keep the first one
+    if (find(name, len) >= 0) {
+        return;
+    }
+
+    if ((m_size + 1) * 2 > m_slots.size()) {
+        grow();
+    }
+
+    Slot slot;
+    slot.hash = hash(name, len);
+    slot.id = id;
+    slot.offset = (UInt32)m_names.size();
+    slot.len = (UInt32)len + 1;
+
+    m_names.insert(m_names.end(), name, name + len);
+
+    const UInt32 mask = (UInt32)m_slots.size() - 1;
+    UInt32 i = slot.hash & mask;
+    while (m_slots[i].len) {
+        i = (i + 1) & mask;
+    }
+
+    m_slots[i] = slot;
+    ++m_size;
+}
+
+Int32 PgSqlNameIndex::find(const Char *name, size_t len) const
+{
+    if (m_slots.empty()) {
+        return -1;
+    }
+
+    const UInt32 h = hash(name, len);
+    const UInt32 mask = (UInt32)m_slots.size() - 1;
+
+    for (UInt32 i = h & mask; m_slots[i].len; i = (i + 1) & mask) {
+        const Slot &slot = m_slots[i];
+        if (slot.hash == h && slot.len == len + 1 &&
+            memcmp(m_names.data() + slot.offset, name, len) == 0) {
+            return (Int32)slot.id;
+        }
+    }
+
+    return -1;
+}
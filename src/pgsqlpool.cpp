@@ -0,0 +1,329 @@
+/**
+ * @file pgsqlpool.cpp
+ * @brief
+ * @author Frederic SCHERMA (frederic.scherma@dreamoverflow.org)
+ * @date 2019-03-09
+ * @copyright Copyright (c) 2001-2019 Dream Overflow. All rights reserved.
+ * @details
+ */
+
+#include "o3d/pgsql/pgsqlpool.h"
+#include "o3d/pgsql/pgsqlexception.h"
+
+using namespace o3d;
+using namespace o3d::pgsql;
+
+PgSqlPool::Handle::Handle() :
+    m_pool(nullptr),
+    m_entry(nullptr)
+{
+
+}
+
+PgSqlPool::Handle::Handle(PgSqlPool *pool, Entry *entry) :
+    m_pool(pool),
+    m_entry(entry)
+{
+
+}
+
+PgSqlPool::Handle::Handle(Handle &&dup) :
+    m_pool(dup.m_pool),
+    m_entry(dup.m_entry)
+{
+    dup.m_pool = nullptr;
+    dup.m_entry = nullptr;
+}
+
+PgSqlPool::Handle &PgSqlPool::Handle::operator=(Handle &&dup)
+{
+    if (this != &dup) {
+        release();
+
+        m_pool = dup.m_pool;
+        m_entry = dup.m_entry;
+
+        dup.m_pool = nullptr;
+        dup.m_entry = nullptr;
+    }
+
+    return *this;
+}
+
+PgSqlPool::Handle::~Handle()
+{
+    release();
+}
+
+PgSqlDb *PgSqlPool::Handle::get() const
+{
+    if (!m_entry) {
+        O3D_ERROR(E_InvalidOperation("Invalid connection handle"));
+    }
+
+    return m_entry->db;
+}
+
+PgSqlQuery *PgSqlPool::Handle::getQuery(const String &name) const
+{
+    if (!m_entry) {
+        O3D_ERROR(E_InvalidOperation("Invalid connection handle"));
+    }
+
+    auto it = m_entry->queries.find(name);
+    if (it != m_entry->queries.end()) {
+        return it->second;
+    } else {
+        O3D_ERROR(E_InvalidParameter("Unknown pool query name"));
+    }
+}
+
+void PgSqlPool::Handle::release()
+{
+    if (m_entry) {
+        m_pool->checkin(m_entry);
+
+        m_pool = nullptr;
+        m_entry = nullptr;
+    }
+}
+
+PgSqlPool::PgSqlPool(
+        const String &host,
+        UInt32 port,
+        const String &database,
+        const String &user,
+        const String &password,
+        UInt32 minSize,
+        UInt32 maxSize) :
+    m_host(host),
+    m_port(port),
+    m_database(database),
+    m_user(user),
+    m_password(password),
+    m_minSize(minSize),
+    m_maxSize(maxSize > 0 ? maxSize : 1),
+    m_size(0)
+{
+    if (m_minSize > m_maxSize) {
+        m_minSize = m_maxSize;
+    }
+
+    m_entries.reserve(m_maxSize);
+    m_idle.reserve(m_maxSize);
+
+    for (UInt32 i = 0; i < m_minSize; ++i) {
+        Entry *entry = createEntry();
+
+        m_entries.push_back(entry);
+        m_idle.push_back(entry);
+        ++m_size;
+    }
+}
+
+PgSqlPool::~PgSqlPool()
+{
+    if (m_idle.size() != m_entries.size()) {
+        O3D_WARNING("Some PgSql pool connections are not released");
+    }
+
+    for (Entry *entry : m_entries) {
+        deleteEntry(entry);
+    }
+
+    m_entries.clear();
+    m_idle.clear();
+}
+
+void PgSqlPool::registerQuery(const String &name, const CString &query)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_queries.push_back(std::make_pair(name, query));
+}
+
+PgSqlPool::Handle PgSqlPool::acquire(UInt32 timeout)
+{
+    return checkout(True, timeout);
+}
+
+PgSqlPool::Handle PgSqlPool::tryAcquire()
+{
+    return checkout(False, 0);
+}
+
+PgSqlPool::Handle PgSqlPool::checkout(Bool wait, UInt32 timeout)
+{
+    Entry *entry = nullptr;
+    Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeout);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (!entry) {
+        if (!m_idle.empty()) {
+            entry = m_idle.back();
+            m_idle.pop_back();
+        } else if (m_size < m_maxSize) {
+            // connect outside of the lock
+            ++m_size;
+            lock.unlock();
+
+            try {
+                entry = createEntry();
+            } catch (...) {
+                lock.lock();
+                --m_size;
+                m_cond.notify_one();
+                throw;
+            }
+
+            lock.lock();
+            m_entries.push_back(entry);
+        } else if (!wait || m_cond.wait_until(lock, deadline) == std::cv_status::timeout) {
+            if (m_idle.empty()) {
+                return Handle();
+            }
+        }
+    }
+
+    lock.unlock();
+
+    try {
+        syncQueries(entry);
+    } catch (...) {
+        checkin(entry);
+        throw;
+    }
+
+    return Handle(this, entry);
+}
+
+void PgSqlPool::checkin(Entry *entry)
+{
+    // a connection must be returned idle, out of any transaction, or closed
+    if (!entry->db->makeIdle()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+                if (*it == entry) {
+                    m_entries.erase(it);
+                    break;
+                }
+            }
+
+            --m_size;
+        }
+
+        // a new connection can be opened in place
+        m_cond.notify_one();
+
+        try {
+            deleteEntry(entry);
+        } catch (...) {
+            O3D_WARNING("Error while closing a PgSql pool connection");
+        }
+
+        return;
+    }
+
+    entry->lastUse = Clock::now();
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_idle.push_back(entry);
+    }
+
+    m_cond.notify_one();
+}
+
+UInt32 PgSqlPool::trimIdle(UInt32 idleTime)
+{
+    std::vector<Entry*> trimmed;
+    Clock::time_point limit = Clock::now() - std::chrono::milliseconds(idleTime);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // oldest released are at the front
+        auto it = m_idle.begin();
+        while (it != m_idle.end() && m_size > m_minSize) {
+            if ((*it)->lastUse < limit) {
+                trimmed.push_back(*it);
+                it = m_idle.erase(it);
+                --m_size;
+            } else {
+                ++it;
+            }
+        }
+
+        for (Entry *entry : trimmed) {
+            for (auto it2 = m_entries.begin(); it2 != m_entries.end(); ++it2) {
+                if (*it2 == entry) {
+                    m_entries.erase(it2);
+                    break;
+                }
+            }
+        }
+    }
+
+    for (Entry *entry : trimmed) {
+        deleteEntry(entry);
+    }
+
+    return (UInt32)trimmed.size();
+}
+
+UInt32 PgSqlPool::getSize() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_size;
+}
+
+UInt32 PgSqlPool::getNumIdle() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return (UInt32)m_idle.size();
+}
+
+PgSqlPool::Entry *PgSqlPool::createEntry()
+{
+    Entry *entry = new Entry;
+    entry->db = new PgSqlDb();
+    entry->numQueries = 0;
+    entry->lastUse = Clock::now();
+
+    try {
+        entry->db->connect(m_host, m_port, m_database, m_user, m_password);
+    } catch (...) {
+        deleteEntry(entry);
+        throw;
+    }
+
+    return entry;
+}
+
+void PgSqlPool::deleteEntry(Entry *entry)
+{
+    // queries are owned by the connection
+    entry->queries.clear();
+
+    deletePtr(entry->db);
+    deletePtr(entry);
+}
+
+void PgSqlPool::syncQueries(Entry *entry)
+{
+    std::vector<std::pair<String, CString>> missing;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (entry->numQueries < m_queries.size()) {
+            missing.assign(m_queries.begin() + entry->numQueries, m_queries.end());
+        }
+    }
+
+    for (const std::pair<String, CString> &query : missing) {
+        entry->queries[query.first] = static_cast<PgSqlQuery*>(entry->db->registerQuery(query.first, query.second));
+        ++entry->numQueries;
+    }
+}
@@ -0,0 +1,108 @@
+/**
+ * @file pgsqlstats.cpp
+ * @brief
+ * @author Frederic SCHERMA (frederic.scherma@dreamoverflow.org)
+ * @date 2019-03-09
+ * @copyright Copyright (c) 2001-2019 Dream Overflow. All rights reserved.
+ * @details
+ */
+
+#include "o3d/pgsql/pgsqlstats.h"
+
+using namespace o3d;
+using namespace o3d::pgsql;
+
+PgSqlHistogram::PgSqlHistogram() :
+    m_count(0),
+    m_totalNs(0)
+{
+    for (UInt32 i = 0; i < NUM_BUCKETS; ++i) {
+        m_buckets[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void PgSqlHistogram::snapshot(Snapshot &out) const
+{
+    out.count = m_count.load(std::memory_order_relaxed);
+    out.totalNs = m_totalNs.load(std::memory_order_relaxed);
+
+    for (UInt32 i = 0; i < NUM_BUCKETS; ++i) {
+        out.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+    }
+}
+
+void PgSqlHistogram::reset()
+{
+    m_count.store(0, std::memory_order_relaxed);
+    m_totalNs.store(0, std::memory_order_relaxed);
+
+    for (UInt32 i = 0; i < NUM_BUCKETS; ++i) {
+        m_buckets[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+UInt64 PgSqlHistogram::Snapshot::percentile(Double p) const
+{
+    // the buckets can be a bit ahead of the count during a recording
+    UInt64 total = 0;
+    for (UInt32 i = 0; i < NUM_BUCKETS; ++i) {
+        total += buckets[i];
+    }
+
+    if (total == 0) {
+        return 0;
+    }
+
+    UInt64 rank = (UInt64)(p / 100.0 * total + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    } else if (rank > total) {
+        rank = total;
+    }
+
+    UInt64 n = 0;
+    for (UInt32 i = 0; i < NUM_BUCKETS; ++i) {
+        n += buckets[i];
+        if (n >= rank) {
+            return (1ULL << i) * 1000;
+        }
+    }
+
+    return (1ULL << (NUM_BUCKETS - 1)) * 1000;
+}
+
+PgSqlStats::PgSqlStats(const String &name) :
+    m_name(name),
+    m_executions(0),
+    m_errors(0),
+    m_rows(0),
+    m_bytes(0)
+{
+
+}
+
+void PgSqlStats::snapshot(Snapshot &out) const
+{
+    out.name = m_name;
+
+    out.executions = m_executions.load(std::memory_order_relaxed);
+    out.errors = m_errors.load(std::memory_order_relaxed);
+    out.rows = m_rows.load(std::memory_order_relaxed);
+    out.bytes = m_bytes.load(std::memory_order_relaxed);
+
+    m_wait.snapshot(out.wait);
+    m_decode.snapshot(out.decode);
+    m_fetch.snapshot(out.fetch);
+}
+
+void PgSqlStats::reset()
+{
+    m_executions.store(0, std::memory_order_relaxed);
+    m_errors.store(0, std::memory_order_relaxed);
+    m_rows.store(0, std::memory_order_relaxed);
+    m_bytes.store(0, std::memory_order_relaxed);
+
+    m_wait.reset();
+    m_decode.reset();
+    m_fetch.reset();
+}
@@ -0,0 +1,360 @@
+/**
+ * @file codecs.cpp
+ * @brief Checks of the binary codecs of the pgsql module, without a server.
+ * @author Frederic SCHERMA (frederic.scherma@dreamoverflow.org)
+ * @date 2019-03-09
+ * @copyright Copyright (c) 2001-2019 Dream Overflow. All rights reserved.
+ * @details
+ */
+
+#include "codecs.h"
+
+#include <o3d/pgsql/pgsqlbinary.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+
+using namespace o3d;
+using namespace o3d::pgsql;
+using namespace o3d::pgsql::binary;
+
+static UInt32 ms_failures = 0;
+
+static void check(Bool ok, const char *what, Int32 line)
+{
+    if (!ok) {
+        fprintf(stderr, "codecs.cpp:%i: check failed: %s\n", line, what);
+        ++ms_failures;
+    }
+}
+
+#define CODEC_CHECK(cond) check((cond), #cond, __LINE__)
+
+//! Binary numeric of base 10000 digits.
+static std::vector<UInt8> makeNumeric(const std::vector<Int16> &digits, Int16 weight, Bool negative)
+{
+    std::vector<UInt8> out(8 + digits.size() * 2);
+
+    binary::writeInt16(out.data(), (Int16)digits.size());
+    binary::writeInt16(out.data() + 2, weight);
+    binary::writeUInt16(out.data() + 4, negative ? 0x4000 : 0x0000);
+    binary::writeInt16(out.data() + 6, 0);
+
+    for (size_t i = 0; i < digits.size(); ++i) {
+        binary::writeInt16(out.data() + 8 + i*2, digits[i]);
+    }
+
+    return out;
+}
+
+//! Fixed-point value encoded at a scale and decoded at another one.
+static Bool rescale(Int64 v, UInt32 scale, UInt32 toScale, Int64 &out)
+{
+    UInt8 data[binary::NUMERIC_FIXED_SIZE];
+    const UInt32 len = binary::encodeNumeric(v, scale, data);
+
+    return binary::decodeNumeric(data, len, toScale, out);
+}
+
+//! Fixed-point value encoded then decoded as a double.
+static Double toDouble(Int64 v, UInt32 scale)
+{
+    UInt8 data[binary::NUMERIC_FIXED_SIZE];
+    const UInt32 len = binary::encodeNumeric(v, scale, data);
+
+    return binary::decodeNumeric(data, len);
+}
+
+//! Correctly rounded double of v * 10^-scale.
+static Double nearest(Int64 v, UInt32 scale)
+{
+    char text[64];
+    snprintf(text, sizeof(text), "%llie-%u", (long long)v, scale);
+
+    return strtod(text, nullptr);
+}
+
+static void checkRanges()
+{
+    UInt8 data[binary::NUMERIC_FIXED_SIZE];
+
+    // integers, out of the range of the type
+    CODEC_CHECK(binary::encodeInteger(QBOOLOID, 1, data) == 1 && data[0] == 1);
+    CODEC_CHECK(binary::encodeInteger(QBOOLOID, 2, data) == 0);
+    CODEC_CHECK(binary::encodeInteger(QINT2OID, -32768, data) == 2 && binary::readInt16(data) == -32768);
+    CODEC_CHECK(binary::encodeInteger(QINT2OID, 32768, data) == 0);
+    CODEC_CHECK(binary::encodeInteger(QINT2OID, -32769, data) == 0);
+    CODEC_CHECK(binary::encodeInteger(QINT4OID, 2147483647LL, data) == 4 && binary::readInt32(data) == 2147483647);
+    CODEC_CHECK(binary::encodeInteger(QINT4OID, 2147483648LL, data) == 0);
+    CODEC_CHECK(binary::encodeInteger(QINT4OID, -2147483649LL, data) == 0);
+    CODEC_CHECK(binary::encodeInteger(QOIDOID, 4294967295LL, data) == 4 && binary::readUInt32(data) == 4294967295U);
+    CODEC_CHECK(binary::encodeInteger(QOIDOID, -1, data) == 0);
+    CODEC_CHECK(binary::encodeInteger(QOIDOID, 4294967296LL, data) == 0);
+    CODEC_CHECK(binary::encodeInteger(QTEXTOID, 1, data) == 0);
+
+    // an UInt64 above the Int64 range only fits a real
+    const Int64 big = (Int64)18446744073709551615ULL;
+    CODEC_CHECK(binary::encodeInteger(QINT8OID, big, data) == 8 && binary::readInt64(data) == -1);
+    CODEC_CHECK(binary::encodeInteger(QINT8OID, big, data, True) == 0);
+    CODEC_CHECK(binary::encodeInteger(QNUMERICOID, big, data, True) == 0);
+    CODEC_CHECK(binary::encodeInteger(QFLOAT8OID, big, data, True) == 8 &&
+                binary::readDouble(data) == 18446744073709551615.0);
+
+    // reals, an integer type only takes an integral value of its range
+    CODEC_CHECK(binary::encodeReal(QINT4OID, 3.0, data) == 4 && binary::readInt32(data) == 3);
+    CODEC_CHECK(binary::encodeReal(QINT4OID, 1.5, data) == 0);
+    CODEC_CHECK(binary::encodeReal(QINT4OID, 2147483648.0, data) == 0);
+    CODEC_CHECK(binary::encodeReal(QINT2OID, -32769.0, data) == 0);
+    CODEC_CHECK(binary::encodeReal(QBOOLOID, 0.5, data) == 0);
+    CODEC_CHECK(binary::encodeReal(QINT8OID, -9223372036854775808.0, data) == 8 &&
+                binary::readInt64(data) == std::numeric_limits<Int64>::min());
+    CODEC_CHECK(binary::encodeReal(QINT8OID, 9223372036854775808.0, data) == 0);
+    CODEC_CHECK(binary::encodeReal(QINT8OID, std::numeric_limits<Double>::quiet_NaN(), data) == 0);
+    CODEC_CHECK(binary::encodeReal(QINT8OID, std::numeric_limits<Double>::infinity(), data) == 0);
+
+    // a float4 keeps the NaN and the infinities, but not a finite value out of its range
+    CODEC_CHECK(binary::encodeReal(QFLOAT4OID, 1e39, data) == 0);
+    CODEC_CHECK(binary::encodeReal(QFLOAT4OID, -1e39, data) == 0);
+    CODEC_CHECK(binary::encodeReal(QFLOAT4OID, 1e38, data) == 4);
+    CODEC_CHECK(binary::encodeReal(QFLOAT4OID, std::numeric_limits<Double>::infinity(), data) == 4 &&
+                std::isinf(binary::readFloat(data)));
+    CODEC_CHECK(binary::encodeReal(QFLOAT8OID, 1e300, data) == 8 && binary::readDouble(data) == 1e300);
+    CODEC_CHECK(binary::encodeReal(QTEXTOID, 1.0, data) == 0);
+}
+
+static void checkNumerics()
+{
+    static const Int64 values[] = {
+        0, 1, -1, 7, -7, 9999, 10000, -10001, 12345, -123456789, 99999999,
+        1000000000000000000LL, std::numeric_limits<Int64>::max(), -std::numeric_limits<Int64>::max()
+    };
+
+    // exact round trips, and the nearest double
+    for (Int64 v : values) {
+        for (UInt32 scale = 0; scale <= 18; ++scale) {
+            Int64 out = 0;
+            CODEC_CHECK(rescale(v, scale, scale, out) && out == v);
+            CODEC_CHECK(toDouble(v, scale) == nearest(v, scale));
+        }
+    }
+
+    Int64 out = 0;
+
+    // scale greater than the weight, 0.000005
+    CODEC_CHECK(rescale(5, 6, 6, out) && out == 5);
+    CODEC_CHECK(rescale(5, 6, 5, out) && out == 1);
+    CODEC_CHECK(rescale(-5, 6, 5, out) && out == -1);
+    CODEC_CHECK(rescale(5, 6, 4, out) && out == 0);
+    CODEC_CHECK(toDouble(5, 6) == 0.000005);
+
+    // half away from zero
+    CODEC_CHECK(rescale(125, 3, 2, out) && out == 13);
+    CODEC_CHECK(rescale(-125, 3, 2, out) && out == -13);
+    CODEC_CHECK(rescale(124, 3, 2, out) && out == 12);
+    CODEC_CHECK(rescale(12345, 2, 4, out) && out == 1234500);
+
+    // overflow
+    CODEC_CHECK(!rescale(std::numeric_limits<Int64>::max(), 0, 1, out));
+    CODEC_CHECK(!rescale(1000000000000000000LL, 0, 1, out));
+    CODEC_CHECK(!rescale(-1000000000000000000LL, 0, 1, out));
+    CODEC_CHECK(!rescale(1, 0, 19, out));
+
+    // zero
+    CODEC_CHECK(rescale(0, 4, 0, out) && out == 0);
+    CODEC_CHECK(rescale(0, 0, 18, out) && out == 0);
+    CODEC_CHECK(toDouble(0, 4) == 0.0);
+
+    // NaN and infinities
+    UInt8 data[binary::NUMERIC_FIXED_SIZE];
+    UInt32 len = binary::encodeNumeric(std::numeric_limits<Double>::quiet_NaN(), data);
+    CODEC_CHECK(len == 8 && std::isnan(binary::decodeNumeric(data, len)));
+    CODEC_CHECK(!binary::decodeNumeric(data, len, 2, out));
+
+    len = binary::encodeNumeric(-std::numeric_limits<Double>::infinity(), data);
+    CODEC_CHECK(len == 8 && binary::decodeNumeric(data, len) == -std::numeric_limits<Double>::infinity());
+    CODEC_CHECK(!binary::decodeNumeric(data, len, 2, out));
+
+    // doubles with the fewest digits
+    static const Double reals[] = { 0.0, 0.1, -2.5, 1e-10, 123456.789, 1e15, -0.3 };
+
+    for (Double v : reals) {
+        len = binary::encodeNumeric(v, data);
+        CODEC_CHECK(len > 0 && binary::decodeNumeric(data, len) == v);
+    }
+
+    CODEC_CHECK(binary::encodeNumeric(1e30, data) == 0);
+    CODEC_CHECK(binary::encodeNumeric(1e-30, data) == 0);
+
+    // more digits than a double
+    std::vector<UInt8> numeric = makeNumeric({ 1234, 5678, 9012, 3456, 7890 }, 2, True);
+    CODEC_CHECK(binary::decodeNumeric(numeric.data(), (UInt32)numeric.size()) ==
+                strtod("-12345678901234567890e-8", nullptr));
+    CODEC_CHECK(binary::decodeNumeric(numeric.data(), (UInt32)numeric.size(), 0, out) &&
+                out == -123456789012LL);
+    CODEC_CHECK(binary::decodeNumeric(numeric.data(), (UInt32)numeric.size(), 4, out) &&
+                out == -1234567890123457LL);
+
+    numeric = makeNumeric({ 1 }, -10, False);
+    CODEC_CHECK(binary::decodeNumeric(numeric.data(), (UInt32)numeric.size()) == 1e-40);
+
+    numeric = makeNumeric({ 12, 3400, 0, 0 }, 1, False);
+    CODEC_CHECK(binary::decodeNumeric(numeric.data(), (UInt32)numeric.size()) == 123400.0);
+
+    // truncated
+    CODEC_CHECK(!binary::decodeNumeric(numeric.data(), 10, 0, out));
+}
+
+static void checkDates()
+{
+    CODEC_CHECK(binary::daysFromCivil(1970, 1, 1) == 0);
+    CODEC_CHECK(binary::daysFromCivil(2000, 1, 1) == binary::PG_EPOCH_DAYS);
+
+    // leap years
+    CODEC_CHECK(binary::daysFromCivil(2000, 3, 1) - binary::daysFromCivil(2000, 2, 28) == 2);
+    CODEC_CHECK(binary::daysFromCivil(2024, 3, 1) - binary::daysFromCivil(2024, 2, 28) == 2);
+    CODEC_CHECK(binary::daysFromCivil(1600, 3, 1) - binary::daysFromCivil(1600, 2, 28) == 2);
+    CODEC_CHECK(binary::daysFromCivil(1900, 3, 1) - binary::daysFromCivil(1900, 2, 28) == 1);
+    CODEC_CHECK(binary::daysFromCivil(2100, 3, 1) - binary::daysFromCivil(2100, 2, 28) == 1);
+    CODEC_CHECK(binary::daysFromCivil(2001, 1, 1) - binary::daysFromCivil(2000, 1, 1) == 366);
+
+    // about 2700 years around 2000-01-01
+    Int32 year;
+    UInt32 month, mday;
+    UInt32 bad = 0;
+
+    for (Int32 days = -1000000; days <= 1000000; ++days) {
+        binary::civilFromDays(days, year, month, mday);
+        if (month < 1 || month > 12 || mday < 1 || mday > 31 ||
+            binary::daysFromCivil(year, month, mday) != days) {
+            ++bad;
+        }
+    }
+
+    CODEC_CHECK(bad == 0);
+
+    DateTime date;
+
+    binary::toDateTime(0, date);
+    CODEC_CHECK(date.year == 2000 && date.month == JANUARY && date.mday == 0 && date.day == SATURDAY);
+    CODEC_CHECK(date.hour == 0 && date.minute == 0 && date.second == 0 && date.microsecond == 0);
+
+    binary::toDateTime(-1, date);
+    CODEC_CHECK(date.year == 1999 && date.month == DECEMBER && date.mday == 30 && date.day == FRIDAY);
+    CODEC_CHECK(date.hour == 23 && date.minute == 59 && date.second == 59 && date.microsecond == 999999);
+
+    // 2000-02-29 12:00
+    binary::toDateTime(59 * binary::USECS_PER_DAY + 12 * 3600 * binary::USECS_PER_SEC, date);
+    CODEC_CHECK(date.year == 2000 && date.month == FEBRUARY && date.mday == 28 && date.day == TUESDAY);
+    CODEC_CHECK(date.hour == 12 && date.minute == 0);
+
+    Date day;
+    binary::toDate(binary::daysFromCivil(2024, 2, 29) - binary::PG_EPOCH_DAYS, day);
+    CODEC_CHECK(day.year == 2024 && day.month == FEBRUARY && day.mday == 28 && day.day == THURSDAY);
+
+    // date times around the leap days and the epoch
+    static const Int64 offsets[] = { 0, 1, binary::USECS_PER_SEC - 1, binary::USECS_PER_DAY - 1 };
+    bad = 0;
+
+    for (Int32 days = -1500; days <= 1500; ++days) {
+        for (Int64 offset : offsets) {
+            const Int64 usecs = days * binary::USECS_PER_DAY + offset;
+
+            binary::toDateTime(usecs, date);
+            if (binary::fromDateTime(date) != usecs) {
+                ++bad;
+            }
+        }
+    }
+
+    CODEC_CHECK(bad == 0);
+}
+
+static void checkArrays()
+{
+    UInt8 data[binary::ARRAY_HEADER_SIZE + 3 * 8];
+    UInt8 *p = data + binary::writeArrayHeader(data, QINT4OID, 3);
+
+    for (Int32 i = 0; i < 3; ++i, p += 8) {
+        binary::writeInt32(p, 4);
+        binary::writeInt32(p + 4, -i * 1000);
+    }
+
+    binary::ArrayHeader header;
+    CODEC_CHECK(binary::readArrayHeader(data, sizeof(data), header));
+    CODEC_CHECK(header.elementType == QINT4OID && header.count == 3 && !header.hasNull);
+    CODEC_CHECK(header.elements == data + binary::ARRAY_HEADER_SIZE && header.end == data + sizeof(data));
+
+    Int32 values[3] = { 1, 1, 1 };
+    CODEC_CHECK(binary::decodeArrayElements(header, 4, values));
+    CODEC_CHECK(values[0] == 0 && values[1] == -1000 && values[2] == -2000);
+
+    // empty, without dimension
+    CODEC_CHECK(binary::writeArrayHeader(data, QINT8OID, 0) == 12);
+    CODEC_CHECK(binary::readArrayHeader(data, 12, header));
+    CODEC_CHECK(header.elementType == QINT8OID && header.count == 0);
+
+    // two dimensions of 2 x 3, with a NULL
+    UInt8 matrix[12 + 2 * 8];
+    binary::writeInt32(matrix, 2);
+    binary::writeInt32(matrix + 4, 1);
+    binary::writeUInt32(matrix + 8, QINT4OID);
+    binary::writeInt32(matrix + 12, 2);
+    binary::writeInt32(matrix + 16, 1);
+    binary::writeInt32(matrix + 20, 3);
+    binary::writeInt32(matrix + 24, 1);
+
+    CODEC_CHECK(binary::readArrayHeader(matrix, sizeof(matrix), header));
+    CODEC_CHECK(header.count == 6 && header.hasNull && header.elements == matrix + sizeof(matrix));
+
+    // NULL elements are zero, {7, NULL, -7}
+    UInt8 nulls[12 + 8 + 8 + 4 + 8];
+    binary::writeInt32(nulls, 1);
+    binary::writeInt32(nulls + 4, 1);
+    binary::writeUInt32(nulls + 8, QINT4OID);
+    binary::writeInt32(nulls + 12, 3);
+    binary::writeInt32(nulls + 16, 1);
+    binary::writeInt32(nulls + 20, 4);
+    binary::writeInt32(nulls + 24, 7);
+    binary::writeInt32(nulls + 28, -1);
+    binary::writeInt32(nulls + 32, 4);
+    binary::writeInt32(nulls + 36, -7);
+
+    CODEC_CHECK(binary::readArrayHeader(nulls, sizeof(nulls), header));
+    CODEC_CHECK(header.elementType == QINT4OID && header.count == 3 && header.hasNull);
+
+    values[1] = 1;
+    CODEC_CHECK(binary::decodeArrayElements(header, 4, values));
+    CODEC_CHECK(values[0] == 7 && values[1] == 0 && values[2] == -7);
+
+    // truncated element, or of another size
+    CODEC_CHECK(binary::readArrayHeader(nulls, sizeof(nulls) - 2, header));
+    CODEC_CHECK(!binary::decodeArrayElements(header, 4, values));
+
+    CODEC_CHECK(binary::readArrayHeader(nulls, sizeof(nulls), header));
+    CODEC_CHECK(!binary::decodeArrayElements(header, 8, values));
+
+    // invalid headers
+    CODEC_CHECK(!binary::readArrayHeader(matrix, 11, header));
+    CODEC_CHECK(!binary::readArrayHeader(matrix, 20, header));
+
+    binary::writeInt32(matrix + 20, -3);
+    CODEC_CHECK(!binary::readArrayHeader(matrix, sizeof(matrix), header));
+
+    binary::writeInt32(matrix, -1);
+    CODEC_CHECK(!binary::readArrayHeader(matrix, sizeof(matrix), header));
+}
+
+UInt32 checkCodecs()
+{
+    ms_failures = 0;
+
+    checkRanges();
+    checkNumerics();
+    checkDates();
+    checkArrays();
+
+    return ms_failures;
+}
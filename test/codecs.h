@@ -0,0 +1,22 @@
+/**
+ * @file codecs.h
+ * @brief Checks of the binary codecs of the pgsql module, without a server.
+ * @author Frederic SCHERMA (frederic.scherma@dreamoverflow.org)
+ * @date 2019-03-09
+ * @copyright Copyright (c) 2001-2019 Dream Overflow. All rights reserved.
+ * @details
+ */
+
+#ifndef _O3D_PGSQL_TEST_CODECS_H
+#define _O3D_PGSQL_TEST_CODECS_H
+
+#include <o3d/core/base.h>
+
+/**
+ * @brief Check the range of the integer and real encoders, and the numeric, date and
+ * array codecs against known values, printing each failed check.
+ * @return The number of failed checks.
+ */
+o3d::UInt32 checkCodecs();
+
+#endif // _O3D_PGSQL_TEST_CODECS_H
@@ -14,6 +14,9 @@
 
 #include <o3d/pgsql/pgsqldb.h>
 
+#include "codecs.h"
+#include "server.h"
+
 #include <cstdio>
 #include <iostream>
 
@@ -29,6 +32,10 @@ static Int32 main()
 {
     PgSql::init();
 
+    // the codecs don't need a server
+    UInt32 errors = checkCodecs();
+    std::cout << "Codecs checked, " << errors << " failure(s)" << std::endl;
+
     PgSqlDb *pgsql = new PgSqlDb();
 
     std::cout << "Connecting to the PgSql db..." << std::endl;
@@ -44,6 +51,11 @@ static Int32 main()
 
     std::cout << "Successfully connected:" << std::endl;
 
+    UInt32 serverErrors = checkServer(pgsql);
+    std::cout << "Server checked, " << serverErrors << " failure(s)" << std::endl;
+
+    errors += serverErrors;
+
 //	std::cout << "Create an STMT Request..." << std::endl;
 //    DbQuery *query = mysql.registerQuery("test","SELECT Login, PlayersId FROM user WHERE UId = ?");
 
@@ -98,7 +110,7 @@ static Int32 main()
     o3d::deletePtr(pgsql);
 
     PgSql::quit();
-    return 0;
+    return errors > 0 ? -1 : 0;
 }
 };
 
@@ -0,0 +1,213 @@
+/**
+ * @file server.cpp
+ * @brief Checks of the pgsql module against a server.
+ * @author Frederic SCHERMA (frederic.scherma@dreamoverflow.org)
+ * @date 2019-03-09
+ * @copyright Copyright (c) 2001-2019 Dream Overflow. All rights reserved.
+ * @details
+ */
+
+#include "server.h"
+
+#include <o3d/core/error.h>
+
+#include <o3d/pgsql/pgsqlbinary.h>
+#include <o3d/pgsql/pgsqlcopyreader.h>
+#include <o3d/pgsql/pgsqlcopywriter.h>
+#include <o3d/pgsql/pgsqlexception.h>
+
+#include <cstdio>
+#include <vector>
+
+using namespace o3d;
+using namespace o3d::pgsql;
+
+static UInt32 ms_failures = 0;
+
+static void check(Bool ok, const char *what, Int32 line)
+{
+    if (!ok) {
+        fprintf(stderr, "server.cpp:%i: check failed: %s\n", line, what);
+        ++ms_failures;
+    }
+}
+
+#define SERVER_CHECK(cond) check((cond), #cond, __LINE__)
+
+#define SERVER_CHECK_THROW(expr, E) { \
+    Bool thrown = False; \
+    try { expr; } catch (E &) { thrown = True; } \
+    check(thrown, #expr " throws " #E, __LINE__); }
+
+static PgSqlQuery* newQuery(PgSqlDb *pgsql, const String &name, const CString &sql)
+{
+    return static_cast<PgSqlQuery*>(pgsql->registerQuery(name, sql));
+}
+
+static void checkRoundTrips(PgSqlDb *pgsql)
+{
+    // numeric, more digits than a double
+    PgSqlQuery *query = newQuery(pgsql, "test_numeric", "SELECT $1::numeric");
+
+    query->setNumeric(0, -1234567890123456789LL, 6);
+    query->execute();
+
+    Int64 v = 0;
+    SERVER_CHECK(query->fetch() && query->getNumeric(0, 6, v) && v == -1234567890123456789LL);
+    SERVER_CHECK(query->getNumeric(0, 4, v) && v == -12345678901234568LL);
+
+    // date, on a leap day
+    query = newQuery(pgsql, "test_date", "SELECT $1::date, $1::date - 1");
+
+    Date date;
+    date.year = 2024;
+    date.month = FEBRUARY;
+    date.mday = 28;
+
+    query->setDate(0, date);
+    query->execute();
+
+    const Int64 leapDay = binary::daysFromCivil(2024, 2, 29) * binary::USECS_PER_DAY;
+
+    SERVER_CHECK(query->fetch() && query->getEpochUs(0, v) && v == leapDay);
+    SERVER_CHECK(query->getEpochUs(1, v) && v == leapDay - binary::USECS_PER_DAY);
+    SERVER_CHECK(query->getOut(0).asDate().year == 2024 && query->getOut(0).asDate().month == FEBRUARY &&
+                 query->getOut(0).asDate().mday == 28);
+
+    // an oid above 2^31 is not negative
+    query = newQuery(pgsql, "test_oid", "SELECT 3000000000::oid");
+    query->execute();
+
+    SERVER_CHECK(query->fetch() && query->getOut(0).asUInt32() == 3000000000U);
+
+    // an integer out of the range of the parameter is refused by the server
+    query = newQuery(pgsql, "test_int2", "SELECT $1::int2");
+
+    query->setInt32(0, 40000);
+    SERVER_CHECK_THROW(query->execute(), E_PgSqlError);
+
+    query->setInt32(0, -32768);
+    query->execute();
+
+    SERVER_CHECK(query->fetch() && query->getOut(0).asInt32() == -32768);
+
+    // a fraction is not truncated to an integer
+    query->setDouble(0, 1.5);
+    SERVER_CHECK_THROW(query->execute(), E_PgSqlError);
+}
+
+static void checkArrays(PgSqlDb *pgsql)
+{
+    PgSqlQuery *query = newQuery(pgsql, "test_array",
+                                 "SELECT ARRAY[7, NULL, -7]::int4[], NULL::int4[], ARRAY[]::int8[]");
+    query->execute();
+    SERVER_CHECK(query->fetch());
+
+    // the NULL elements are zero
+    ArrayInt32 values;
+    SERVER_CHECK(query->getArrayInt32(0, values) == 3);
+    SERVER_CHECK(values.getSize() == 3 && values[0] == 7 && values[1] == 0 && values[2] == -7);
+
+    UInt32 len = 0;
+    binary::ArrayHeader header;
+    const UInt8 *data = query->getData(0, len);
+
+    SERVER_CHECK(data && binary::readArrayHeader(data, len, header));
+    SERVER_CHECK(header.hasNull && header.count == 3 && header.elementType == binary::QINT4OID);
+
+    // a NULL array, and an empty one
+    SERVER_CHECK(query->getArrayInt32(1, values) == 0);
+    SERVER_CHECK(query->getOut(1).isNull());
+
+    ArrayInt64 empty;
+    SERVER_CHECK(query->getArrayInt64(2, empty) == 0 && !query->getOut(2).isNull());
+
+    // a parameter array round trip
+    query = newQuery(pgsql, "test_array_param", "SELECT $1::int8[]");
+
+    const Int64 params[] = { -1, 0, 1LL << 40 };
+    query->setArrayInt64(0, params, 3);
+    query->execute();
+
+    ArrayInt64 out;
+    SERVER_CHECK(query->fetch() && query->getArrayInt64(0, out) == 3);
+    SERVER_CHECK(out[0] == -1 && out[1] == 0 && out[2] == (1LL << 40));
+}
+
+static void checkCopyWriter(PgSqlDb *pgsql)
+{
+    newQuery(pgsql, "test_copy_table",
+             "CREATE TEMPORARY TABLE test_copy (a int2, b int4, c float4, d bigint)")->update();
+
+    PgSqlCopyWriter *writer = pgsql->newCopyWriter("test_copy", { "a", "b", "c", "d" });
+
+    // out of the range of the column, or not integral, refused before sending the row
+    SERVER_CHECK_THROW(writer->setInt32(0, 40000), E_InvalidParameter);
+    SERVER_CHECK_THROW(writer->setInt64(1, 2147483648LL), E_InvalidParameter);
+    SERVER_CHECK_THROW(writer->setDouble(1, 1.5), E_InvalidParameter);
+    SERVER_CHECK_THROW(writer->setDouble(2, 1e39), E_InvalidParameter);
+    SERVER_CHECK_THROW(writer->setUInt64(3, 18446744073709551615ULL), E_InvalidParameter);
+
+    writer->setInt32(0, -32768);
+    writer->setUInt32(1, 2147483647U);
+    writer->setDouble(2, 1e38);
+    writer->setDouble(3, -9223372036854775808.0);
+    writer->writeRow();
+
+    SERVER_CHECK(writer->end() == 1);
+    deletePtr(writer);
+
+    PgSqlQuery *query = newQuery(pgsql, "test_copy_select", "SELECT a, b, d FROM test_copy");
+    query->execute();
+
+    SERVER_CHECK(query->fetch() && query->getOut(0).asInt32() == -32768);
+    SERVER_CHECK(query->getOut(1).asInt32() == 2147483647);
+    SERVER_CHECK(query->getOut(2).asInt64() == (-9223372036854775807LL - 1));
+}
+
+static void checkCopyReader(PgSqlDb *pgsql)
+{
+    PgSqlQuery *query = newQuery(pgsql, "test_copy_other", "SELECT 1");
+    PgSqlCopyReader *reader = pgsql->newCopyReader("SELECT generate_series(1, 1000) AS n");
+
+    SERVER_CHECK(reader->fetch() && reader->asInt32(0) == 1);
+
+    // the copy out would be truncated by another execution
+    SERVER_CHECK_THROW(query->execute(), E_InvalidOperation);
+    SERVER_CHECK_THROW(newQuery(pgsql, "test_copy_refused", "SELECT 2"), E_InvalidOperation);
+
+    Int64 sum = 1;
+    while (reader->fetch()) {
+        sum += reader->asInt32(0);
+    }
+
+    SERVER_CHECK(reader->getNumRows() == 1000 && sum == 500500);
+
+    // available once the last row is fetched
+    query->execute();
+    SERVER_CHECK(query->fetch() && query->getOut(0).asInt32() == 1);
+
+    deletePtr(reader);
+
+    // available once a reader is deleted before its last row
+    reader = pgsql->newCopyReader("SELECT generate_series(1, 100000) AS n");
+    SERVER_CHECK(reader->fetch());
+
+    SERVER_CHECK_THROW(query->execute(), E_InvalidOperation);
+    deletePtr(reader);
+
+    query->execute();
+    SERVER_CHECK(query->fetch() && query->getOut(0).asInt32() == 1);
+}
+
+UInt32 checkServer(PgSqlDb *pgsql)
+{
+    ms_failures = 0;
+
+    checkRoundTrips(pgsql);
+    checkArrays(pgsql);
+    checkCopyWriter(pgsql);
+    checkCopyReader(pgsql);
+
+    return ms_failures;
+}
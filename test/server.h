@@ -0,0 +1,23 @@
+/**
+ * @file server.h
+ * @brief Checks of the pgsql module against a server.
+ * @author Frederic SCHERMA (frederic.scherma@dreamoverflow.org)
+ * @date 2019-03-09
+ * @copyright Copyright (c) 2001-2019 Dream Overflow. All rights reserved.
+ * @details
+ */
+
+#ifndef _O3D_PGSQL_TEST_SERVER_H
+#define _O3D_PGSQL_TEST_SERVER_H
+
+#include <o3d/pgsql/pgsqldb.h>
+
+/**
+ * @brief Check the parameters and results round trips, the range of the copied values,
+ * and the refusal of an execution during a copy, printing each failed check.
+ * @param pgsql A connected database, where temporary tables are created.
+ * @return The number of failed checks.
+ */
+o3d::UInt32 checkServer(o3d::pgsql::PgSqlDb *pgsql);
+
+#endif // _O3D_PGSQL_TEST_SERVER_H